@@ -1,30 +1,44 @@
 #include "actions.hh"
 #include "config.hh"
+#include "deposits.hh"
+#include "digitise.hh"
 #include "io.hh"
+#include "physics-list.hh"
+#include "sampling.hh"
+#include "scan.hh"
+#include "timing.hh"
 
 #include <n4-inspect.hh>
 #include <n4-mandatory.hh>
 #include <n4-random.hh>
 #include <n4-sequences.hh>
 
+#include <G4LogicalVolume.hh>
 #include <G4PrimaryVertex.hh>
+#include <G4Region.hh>
+#include <G4RunManager.hh>
+#include <G4TrackStatus.hh>
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdlib>
+#include <iomanip>
+#include <map>
 #include <optional>
+#include <stdexcept>
 
 using generator_fn = n4::generator::function;
 
-auto at_centre() {
-  static auto const sipm_positions = my.sipm_positions();
-  static auto params = my.scint_params();
-  static size_t event_number = 0;
-  const auto N = event_number++ % (params.n_sipms_x * params.n_sipms_y);
-  auto [x, y, _] = n4::unpack(sipm_positions[N]);
-  return new G4PrimaryVertex(x, y, -params.scint_depth, 0);
+auto at_centre(const resolved_config& cfg, G4int event_id) {
+  // Derived from the event ID rather than a counter, so that the SiPM a
+  // given event is aimed at does not depend on the thread that runs it
+  const auto N = static_cast<size_t>(event_id) % cfg.n_sipms;
+  auto [x, y, _] = n4::unpack(cfg.sipm_positions[N]);
+  return new G4PrimaryVertex(x, y, -cfg.scint_params.scint_depth, 0);
 }
 
-auto uniform(bool in_volume) {
-  static auto [sx, sy, sz] = n4::unpack(my.scint_size());
+auto uniform(const resolved_config& cfg, bool in_volume) {
+  auto [sx, sy, sz] = n4::unpack(cfg.scint_size);
   auto x =              n4::random::uniform_width(sx);
   auto y =              n4::random::uniform_width(sy);
   auto z = in_volume ? -n4::random::uniform   (0, sz) :
@@ -32,78 +46,176 @@ auto uniform(bool in_volume) {
   return new G4PrimaryVertex(x, y, z, 0);
 }
 
-generator_fn gammas_from_outside_crystal() {
-  static G4GenericMessenger msg{nullptr, "/source/", "Commands specific to gamma generator"};
-  static bool sipm_centres = true;
-  msg.DeclareProperty("sipm_centres", sipm_centres);
-  return [](G4Event *event) {
+// Each generator is a copyable object whose STATE is derived from the
+// config snapshot. Every thread works on its own copy, and the state is
+// rebuilt whenever a new snapshot is published, so settings changed
+// between runs are never silently ignored.
+template<class STATE>
+class reconfigurable_generator {
+public:
+  void operator()(G4Event* event) {
+    const auto& conf = cfg.get();
+    if (! state.has_value() || state_generation != conf.generation) {
+      state.emplace(conf);
+      state_generation = conf.generation;
+    }
+    state.value().generate(conf, event);
+  }
+private:
+  frozen_config        cfg;
+  std::optional<STATE> state;
+  unsigned long        state_generation = 0;
+};
+
+struct gamma_state {
+  gamma_state(const resolved_config&) {}
+
+  void generate(const resolved_config& conf, G4Event* event) {
     static auto particle_type = n4::find_particle("gamma");
-    auto vertex = sipm_centres ? at_centre() : uniform(false) ;
+    auto vertex = conf.sipm_centres ? at_centre(conf, event -> GetEventID()) : uniform(conf, false);
+    // Collisions can only be forced in volumes which the gamma enters
+    if (conf.force_interaction) { vertex -> SetPosition(vertex -> GetX0(), vertex -> GetY0(), vertex -> GetZ0() - 1 * nm); }
     vertex -> SetPrimary(new G4PrimaryParticle(
                            particle_type,
-                           0,0, my.particle_energy() // parallel to z-axis
+                           0,0, conf.particle_energy() // parallel to z-axis
                          ));
     event  -> AddPrimaryVertex(vertex);
-  };
-}
+  }
+};
+
+generator_fn gammas_from_outside_crystal() { return reconfigurable_generator<gamma_state>{}; }
 
 const double xe_kshell_binding_energy = 34.56 * keV;
 
-generator_fn photoelectric_electrons() {
-  auto isotropic         = n4::random::direction{};
-  auto electron_K        = my.particle_energy() - xe_kshell_binding_energy;
-  auto electron_mass     = 0.510'998'91 * MeV;
-  auto electron_momentum = std::sqrt(     electron_K * electron_K
-                                    + 2 * electron_K * electron_mass);
-  return [isotropic, electron_momentum] (G4Event *event) {
+struct electron_state {
+  n4::random::direction isotropic{};
+  double                electron_momentum;
+
+  electron_state(const resolved_config& conf) {
+    auto electron_K    = conf.particle_energy() - xe_kshell_binding_energy;
+    auto electron_mass = 0.510'998'91 * MeV;
+    electron_momentum  = std::sqrt(     electron_K * electron_K
+                                  + 2 * electron_K * electron_mass);
+  }
+
+  void generate(const resolved_config& conf, G4Event* event) {
     static auto particle_type = n4::find_particle("e-");
-    auto vertex = uniform(true);
+    auto vertex = uniform(conf, true);
     auto p  = isotropic.get() * electron_momentum;
     vertex -> SetPrimary(new G4PrimaryParticle(
                            particle_type,
                            p.x(), p.y(), p.z()
                          ));
     event  -> AddPrimaryVertex(vertex);
-  };
-}
+  }
+};
 
-generator_fn pointlike_photon_source() {
-  static G4GenericMessenger msg{nullptr, "/source/", "Commands specific to photon generator"};
-  static unsigned nphot = 1'000;
-  msg.DeclareProperty("nphotons", nphot);
+generator_fn photoelectric_electrons() { return reconfigurable_generator<electron_state>{}; }
 
-  auto isotropic = n4::random::direction{};
+struct photon_state {
+  // Reused across events to avoid reallocating
+  std::vector<double>        energies;
+  std::vector<G4ThreeVector> directions;
+  std::vector<G4ThreeVector> polarisations;
 
+  photon_state(const resolved_config& conf) {
+    energies     .reserve(conf.nphotons);
+    directions   .reserve(conf.nphotons);
+    polarisations.reserve(conf.nphotons);
+  }
+
+  void generate(const resolved_config& conf, G4Event* event) {
+    auto vertex = uniform(conf, true);
+    emit(conf, vertex);
+    event  -> AddPrimaryVertex(vertex);
+  }
 
-  return [isotropic] (G4Event *event) {
+  void emit(const resolved_config& conf, G4PrimaryVertex* vertex) {
     static auto particle_type = n4::find_particle("opticalphoton");
-    auto vertex = uniform(true);
+    auto nphot = conf.nphotons;
 
+    conf.particle_energies(energies, nphot);
+    isotropic_directions(nphot, directions, polarisations);
     for (unsigned i=0; i<nphot; ++i) {
-      auto p = isotropic.get() * my.particle_energy();
+      auto p = directions[i] * energies[i];
       auto particle = new G4PrimaryParticle(
                         particle_type,
                         p.x(), p.y(), p.z()
                         );
-      particle -> SetPolarization(isotropic.get());
+      particle -> SetPolarization(polarisations[i]);
       vertex   -> SetPrimary(particle);
     }
+  }
+};
+
+generator_fn pointlike_photon_source() { return reconfigurable_generator<photon_state>{}; }
+
+// Photon bursts on a grid of positions, each repeated for a fixed number
+// of consecutive events, for building light response functions
+struct scan_state : photon_state {
+  using photon_state::photon_state;
+
+  void generate(const resolved_config& conf, G4Event* event) {
+    auto position = conf.scan.position(conf.scan.position_of_event(event -> GetEventID()), conf.scint_size);
+    auto vertex   = new G4PrimaryVertex(position, 0);
+    emit(conf, vertex);
     event  -> AddPrimaryVertex(vertex);
-  };
-}
+  }
+};
 
-enum class generators {gammas_from_outside_crystal, photoelectric_electrons, pointlike_photon_source};
-
-generators string_to_generator(std::string s) {
-  for (auto& c: s) { c = std::tolower(c); }
-  if (s == "gammas_from_outside_crystal"        ||
-      s == "gammas"                  ) { return generators::gammas_from_outside_crystal; }
-  if (s == "photoelectric_electrons" ||
-      s == "electrons"               ) { return generators::photoelectric_electrons;     }
-  if (s == "pointlike_photon_source" ||
-      s == "photons"                 ) { return generators::pointlike_photon_source;     }
-  throw "Invalid generator name: `" + s + "'"; // TODO think about failure propagation out of here
-}
+generator_fn scan_positions() { return reconfigurable_generator<scan_state>{}; }
+
+// Stage 2 of a two-stage simulation: emits the scintillation photons of
+// recorded deposits into the current geometry, without transporting the
+// gammas again
+struct replay_state {
+  std::vector<deposit_event> events;
+  scintillation_params       scint;
+  alias_sampler              spectrum;
+  std::vector<double>        energies;
+  std::vector<G4ThreeVector> directions;
+  std::vector<G4ThreeVector> polarisations;
+
+  static std::vector<deposit_event> load(const std::string& filename) {
+    if (filename.empty()) { throw std::invalid_argument{"The replay generator needs /source/deposits"}; }
+    auto events = read_deposits(filename);
+    if (! events.ok()) { throw std::invalid_argument{"Could not read deposits: " + events.status().ToString()}; }
+    if (events -> empty()) { throw std::invalid_argument{"No events in deposits file " + filename}; }
+    return std::move(events).ValueOrDie();
+  }
+
+  replay_state(const resolved_config& conf)
+    : events  {load(conf.replay_deposits)}
+    , scint   {scintillation_params_of(n4::find_logical("crystal") -> GetMaterial())}
+    , spectrum{scint_spectrum(conf.scint_params.scint)}
+  {}
+
+  void generate(const resolved_config&, G4Event* event) {
+    static auto particle_type = n4::find_particle("opticalphoton");
+    const auto& recorded = events[event -> GetEventID() % events.size()];
+
+    // Carries no particles: it only records where the gamma came from
+    event -> AddPrimaryVertex(new G4PrimaryVertex(recorded.primary_pos, 0));
+
+    for (const auto& d: recorded.deposits) {
+      auto n = n_scintillation_photons(d.edep, scint);
+      if (n == 0) { continue; }
+      spectrum.sample(energies, n);
+      isotropic_directions(n, directions, polarisations);
+      for (unsigned i=0; i<n; ++i) {
+        // One vertex per photon, as each is emitted with its own delay
+        auto vertex   = new G4PrimaryVertex({d.x, d.y, d.z}, d.t + scintillation_delay(scint));
+        auto p        = directions[i] * energies[i];
+        auto particle = new G4PrimaryParticle(particle_type, p.x(), p.y(), p.z());
+        particle -> SetPolarization(polarisations[i]);
+        vertex   -> SetPrimary(particle);
+        event    -> AddPrimaryVertex(vertex);
+      }
+    }
+  }
+};
+
+generator_fn replay_deposits() { return reconfigurable_generator<replay_state>{}; }
 
 std::function<generator_fn((void))> select_generator() {
   auto symbol = string_to_generator(my.generator);
@@ -111,21 +223,107 @@ std::function<generator_fn((void))> select_generator() {
     case generators::gammas_from_outside_crystal       : return gammas_from_outside_crystal;
     case generators::photoelectric_electrons: return photoelectric_electrons;
     case generators::pointlike_photon_source: return pointlike_photon_source;
+    case generators::replay_deposits        : return replay_deposits;
+    case generators::scan_positions         : return scan_positions;
   }
   throw "[select_generator]: unreachable";
 }
 
+// Steps taken in each volume by each particle type: shows what the cuts
+// and step limits of each region cost
+using step_key = std::pair<const G4LogicalVolume*, const G4ParticleDefinition*>;
+static std::map<step_key, size_t> step_counts;
+
+size_t n_steps_of(const std::string& particle_name) {
+  auto particle = n4::find_particle(particle_name);
+  size_t n = 0;
+  for (const auto& [key, count]: step_counts) { if (key.second == particle) { n += count; } }
+  return n;
+}
+
+void print_step_report(const std::map<step_key, size_t>& counts) {
+  std::vector<std::pair<step_key, size_t>> rows{begin(counts), end(counts)};
+  std::sort(begin(rows), end(rows), [] (const auto& a, const auto& b) { return a.second > b.second; });
+
+  std::map<std::string, size_t> per_region;
+  size_t total = 0;
+  using std::setw;
+  std::cout << "\n----- steps per volume and particle -----\n"
+            << std::left << setw(16) << "volume" << setw(16) << "region" << setw(16) << "particle"
+            << std::right << setw(14) << "steps" << '\n';
+  for (const auto& [key, n]: rows) {
+    auto [volume, particle] = key;
+    std::string region = volume -> GetRegion() ? volume -> GetRegion() -> GetName() : std::string{};
+    per_region[region] += n;
+    total              += n;
+    std::cout << std::left << setw(16) << volume -> GetName() << setw(16) << region << setw(16) << particle -> GetParticleName()
+              << std::right << setw(14) << n << '\n';
+  }
+  for (const auto& [region, n]: per_region) {
+    std::cout << std::left << setw(48) << "total in " + region << std::right << setw(14) << n << '\n';
+  }
+  std::cout << std::left << setw(48) << "total" << std::right << setw(14) << total << std::endl;
+}
+
 n4::actions* create_actions(run_stats& stats) {
   static std::optional<parquet_writer> writer;
+  static std::optional<deposit_writer> deposits_writer;
+  static G4LogicalVolume*              crystal = nullptr;
 
-  auto  open_file = [&] (auto) { writer.emplace();};
-  auto close_file = [&] (auto) { writer.reset  ();};
+  static std::optional<scan_writer>         scan_out;
+  static std::optional<scan_accumulator>    scan_acc;
+  static size_t                             scan_position = 0;
+  static std::optional<run_summary>         summary_acc;
+  static std::optional<convergence_monitor> convergence;
+
+  static std::shared_ptr<const resolved_config> cfg;
+
+  // Positions are visited in order, so each one is summarised as soon as
+  // the scan moves on to the next
+  auto flush_scan = [] {
+    if (! scan_acc.has_value() || scan_acc -> empty()) { return; }
+    auto status = scan_out.value().append(scan_acc -> summarise(scan_position));
+    if (! status.ok()) { std::cerr << "could not append scan position " << scan_position << std::endl; }
+    scan_acc -> reset();
+  };
+
+  auto  open_file = [&] (auto) {
+    cfg = my.freeze();
+    if (string_to_generator(my.generator) == generators::scan_positions) {
+      scan_out.emplace(cfg);
+      scan_acc.emplace(cfg -> scan, cfg -> n_sipms);
+      scan_position = 0;
+    } else {
+      writer.emplace(cfg);
+      if (cfg -> summary.enabled) { summary_acc.emplace(cfg -> summary, cfg -> n_sipms); }
+      if (cfg -> stopping.target != stop_target_enum::none) { convergence.emplace(cfg -> stopping); }
+    }
+    if (! cfg -> record_deposits.empty()) { deposits_writer.emplace(cfg -> record_deposits, cfg -> chunk_size); }
+    if (! cfg -> record_deposits.empty() || cfg -> force_interaction) { crystal = n4::find_logical("crystal"); }
+    step_counts.clear();
+    store_physics_tables(); // The tables have just been built
+  };
+  auto close_file = [&, flush_scan] (auto) {
+    flush_scan();
+    if (cfg -> report_steps) { print_step_report(step_counts); }
+    if (summary_acc.has_value() && ! write_summary(*summary_acc, cfg).ok()) {
+      std::cerr << "could not write run summary to " << cfg -> summary.outfile << std::endl;
+    }
+    summary_acc.reset(); convergence.reset();
+    writer.reset(); deposits_writer.reset(); scan_out.reset(); scan_acc.reset();
+  };
   auto interactions_in_event = std::make_shared<std::vector<interaction>>();
+  auto     deposits_in_event = std::make_shared<std::vector<deposit>>();
+  auto       weight_of_event = std::make_shared<std::optional<float>>();
 
-  auto clear_interactions = [interactions_in_event] (auto) { interactions_in_event -> clear(); };
+  auto clear_interactions = [interactions_in_event, deposits_in_event, weight_of_event] (auto) {
+    interactions_in_event -> clear();
+        deposits_in_event -> clear();
+          weight_of_event -> reset();
+  };
 
-  auto store_event = [&, interactions_in_event] (const G4Event* event) {
-    stats.n_over_threshold += stats.n_detected_evt >= my.event_threshold;
+  auto store_event = [&, flush_scan, interactions_in_event, deposits_in_event, weight_of_event] (const G4Event* event) {
+    stats.n_over_threshold += stats.n_detected_evt >= cfg -> event_threshold;
     stats.n_detected_total += stats.n_detected_evt;
 
     std::cout << n4::event_number() << ' ';
@@ -145,17 +343,104 @@ n4::actions* create_actions(run_stats& stats) {
     //     << setw( 7) << my.event_threshold << " photons."
     //     << std::endl;
 
+    if (scan_acc.has_value()) {
+      auto position = cfg -> scan.position_of_event(event -> GetEventID());
+      if (position != scan_position) { flush_scan(); scan_position = position; }
+      scan_acc -> add(stats.n_detected_at_sipm);
+      stats.n_detected_evt = 0;
+      stats.n_detected_at_sipm.clear();
+      stats.arrival_times_at_sipm.clear();
+      return;
+    }
+
+    optional_columns extra;
+    if (cfg -> digitise) {
+      auto digis = digitise(stats.arrival_times_at_sipm, cfg -> n_sipms, cfg -> digi_params);
+      extra.charge = std::move(digis.charge);
+      if (cfg -> digitise_times) { extra.sipm_time = std::move(digis.time); }
+    }
+    if (cfg -> n_arrival_times > 0) {
+      auto timing = summarise_arrival_times(stats.arrival_times_at_sipm, cfg -> n_sipms, cfg -> n_arrival_times, cfg -> time_quantile);
+      extra.arrival_times = std::move(timing.first_times);
+      extra.t_first       = std::move(timing.earliest);
+      extra.t_quantile    = std::move(timing.quantile);
+    }
+    if (cfg -> force_interaction) { extra.weight = weight_of_event -> value_or(1); }
+
+    auto photoabsorbed = std::any_of(begin(*interactions_in_event), end(*interactions_in_event), [] (const auto& i) { return i.type == 1; });
+    if (summary_acc.has_value()) {
+      summary_acc -> add(stats.n_detected_at_sipm, photoabsorbed, stats.n_detected_evt >= cfg -> event_threshold);
+    }
+
+    // The event being stored is still written: a soft abort only stops
+    // the run from starting new ones
+    if (convergence.has_value()) {
+      convergence -> add(stats.n_detected_evt, photoabsorbed, stats.n_detected_evt >= cfg -> event_threshold);
+      if (convergence -> converged()) {
+        std::cout << "\n" << stop_target_enum_to_string(cfg -> stopping.target) << " converged after "
+                  << convergence -> n_events() << " events: " << convergence -> estimate()
+                  << " (relative error " << convergence -> relative_error() << ")" << std::endl;
+        G4RunManager::GetRunManager() -> AbortRun(true);
+      }
+    }
+
     auto primary_pos = event -> GetPrimaryVertex() -> GetPosition();
-    auto status = writer.value().append(primary_pos, *interactions_in_event, stats.n_detected_at_sipm);
+    auto status = writer.value().append(primary_pos, *interactions_in_event, stats.n_detected_at_sipm, extra);
+    if (status.IsCapacityError()) {
+      // Dropping the event would bias the output towards lower counts
+      std::cerr << "\n\n    Could not store event " << n4::event_number() << ": " << status.message() << "\n\n\n";
+      std::exit(EXIT_FAILURE);
+    }
     if (! status.ok()) {
       std::cerr << "could not append event " << n4::event_number() << std::endl;
     }
+    if (deposits_writer.has_value()) {
+      status = deposits_writer.value().append(primary_pos, *deposits_in_event);
+      if (! status.ok()) {
+        std::cerr << "could not append deposits of event " << n4::event_number() << std::endl;
+      }
+    }
     stats.n_detected_evt = 0;
     stats.n_detected_at_sipm.clear();
+    stats.arrival_times_at_sipm.clear();
   };
 
-  auto record_interaction = [interactions_in_event] (const G4Step* step) {
+  auto record_deposit = [deposits_in_event] (const G4Step* step) {
+    static auto optical_photon = n4::find_particle("opticalphoton");
+    auto track = step -> GetTrack();
+    // Only left if the optical physics was already built when recording
+    // was switched on
+    if (track -> GetParticleDefinition() == optical_photon) { track -> SetTrackStatus(fStopAndKill); return; }
+
+    auto edep = step -> GetTotalEnergyDeposit();
+    if (edep <= 0) { return; }
+    auto pre  = step -> GetPreStepPoint();
+    auto post = step -> GetPostStepPoint();
+    if (pre -> GetTouchable() -> GetVolume() -> GetLogicalVolume() != crystal) { return; }
+
+    auto [x, y, z] = n4::unpack((pre -> GetPosition() + post -> GetPosition()) / 2);
+    auto t         =            (pre -> GetGlobalTime() + post -> GetGlobalTime()) / 2;
+    deposits_in_event -> push_back({ static_cast<float>(x), static_cast<float>(y), static_cast<float>(z)
+                                   , static_cast<float>(t), static_cast<float>(edep)
+                                   , track -> GetParticleDefinition() -> GetPDGEncoding() });
+  };
+
+  // Everything deposited in the crystal descends from the forced
+  // interaction, so it all carries the same weight
+  auto record_weight = [weight_of_event] (const G4Step* step) {
+    if (weight_of_event -> has_value() || step -> GetTotalEnergyDeposit() <= 0) { return; }
+    if (step -> GetPreStepPoint() -> GetTouchable() -> GetVolume() -> GetLogicalVolume() != crystal) { return; }
+    *weight_of_event = step -> GetTrack() -> GetWeight();
+  };
+
+  auto record_interaction = [interactions_in_event, record_deposit, record_weight] (const G4Step* step) {
     static auto gamma = n4::find_particle("gamma");
+    if (cfg -> report_steps) {
+      ++step_counts[{ step -> GetPreStepPoint() -> GetTouchable() -> GetVolume() -> GetLogicalVolume()
+                    , step -> GetTrack() -> GetParticleDefinition() }];
+    }
+    if (deposits_writer.has_value()) { record_deposit(step); }
+    if (cfg -> force_interaction)    { record_weight (step); }
     if (step -> GetTrack() -> GetParticleDefinition() != gamma) { return; }
     auto pt = step -> GetPostStepPoint();
     auto process_name = pt -> GetProcessDefinedStep() -> GetProcessName();
@@ -4,12 +4,20 @@
 
 #include <n4-mandatory.hh>
 
+#include <string>
+
 n4::generator::function gammas_from_outside_crystal();
 n4::generator::function photoelectric_electrons();
 n4::generator::function pointlike_photon_source();
+n4::generator::function replay_deposits();
+n4::generator::function scan_positions();
 
 std::function<n4::generator::function((void))> select_generator();
 
 n4::actions* create_actions(run_stats& data);
 
+// Steps taken by one particle type in the last run; only counted with
+// /my/report_steps
+size_t n_steps_of(const std::string& particle_name);
+
 extern const double xe_kshell_binding_energy;
@@ -0,0 +1,167 @@
+#include "analysis.hh"
+#include "io.hh"
+#include "reconstruction.hh"
+
+#include <parquet/arrow/reader.h>
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+void count_features::resize(size_t n_events) {
+  total           .resize(n_events);
+  max             .resize(n_events);
+  argmax          .resize(n_events);
+  n_over_threshold.resize(n_events);
+  x               .resize(n_events);
+  y               .resize(n_events);
+}
+
+void count_kernels(const uint32_t* counts, size_t n_events, size_t n_sipms, uint32_t sipm_threshold,
+                   count_features& out, size_t first) {
+  for (size_t e=0; e<n_events; e++) {
+    const uint32_t* c = counts + e * n_sipms;
+    // Branch-free reductions, one per pass, which vectorise well
+    uint32_t total = 0, max = 0, over = 0;
+    for (size_t i=0; i<n_sipms; i++) { total += c[i]; }
+    for (size_t i=0; i<n_sipms; i++) { max = std::max(max, c[i]); }
+    for (size_t i=0; i<n_sipms; i++) { over += c[i] >= sipm_threshold; }
+    out.total           [first + e] = total;
+    out.max             [first + e] = max;
+    out.n_over_threshold[first + e] = over;
+    out.argmax          [first + e] = std::find(c, c + n_sipms, max) - c;
+  }
+}
+
+// Metadata values come from the file: one which does not parse is
+// reported like any other problem with the file, not thrown
+template<class PARSE>
+static auto parse_metadata(const std::string& key, const std::string& value, const std::string& filename, PARSE parse)
+  -> arrow::Result<decltype(parse(value))> {
+  try {
+    return parse(value);
+  } catch (const std::exception&) {
+    return arrow::Status::Invalid("Could not parse ", key, " '", value, "' in the metadata of ", filename);
+  }
+}
+
+static arrow::Result<std::vector<G4ThreeVector>> sipm_positions(std::unordered_map<std::string, std::string>& meta, const std::string& filename) {
+  std::vector<G4ThreeVector> out;
+  auto to_double = [] (const std::string& s) { return std::stod(s); };
+  for (size_t n=0; meta.contains("x_" + std::to_string(n)); n++) {
+    auto x_key = "x_" + std::to_string(n), y_key = "y_" + std::to_string(n);
+    if (! meta.contains(y_key)) { return arrow::Status::Invalid("No ", y_key, " in the metadata of ", filename); }
+    ARROW_ASSIGN_OR_RAISE(auto x, parse_metadata(x_key, meta[x_key], filename, to_double));
+    ARROW_ASSIGN_OR_RAISE(auto y, parse_metadata(y_key, meta[y_key], filename, to_double));
+    out.emplace_back(x, y, 0);
+  }
+  if (out.empty()) { return arrow::Status::Invalid("No SiPM positions in the metadata of ", filename); }
+  return out;
+}
+
+arrow::Result<std::vector<G4ThreeVector>> sipm_positions_from_metadata(const std::string& filename) {
+  ARROW_ASSIGN_OR_RAISE(auto meta, read_metadata(filename));
+  return sipm_positions(meta, filename);
+}
+
+arrow::Result<count_features> analyse_counts(const std::string& filename, unsigned n_threads,
+                                             std::optional<uint32_t> sipm_threshold) {
+  // The footer of a parquet file is parsed once, and shared by every
+  // reader. Arrow IPC input is opened only once, as a pipe can only be
+  // read once: the metadata comes with the table.
+  ARROW_ASSIGN_OR_RAISE(auto format, file_format(filename));
+  std::unique_ptr<parquet::arrow::FileReader>  reader;
+  std::shared_ptr<parquet::FileMetaData>       file_meta;
+  std::shared_ptr<arrow::Table>                ipc_table;
+  std::unordered_map<std::string, std::string> meta;
+  if (format == output_format_enum::parquet) {
+    ARROW_ASSIGN_OR_RAISE(reader, open_parquet(filename));
+    file_meta = reader -> parquet_reader() -> metadata();
+    if (file_meta -> key_value_metadata()) { file_meta -> key_value_metadata() -> ToUnorderedMap(&meta); }
+  } else {
+    ARROW_ASSIGN_OR_RAISE(ipc_table, read_table(filename));
+    if (ipc_table -> schema() -> metadata()) { ipc_table -> schema() -> metadata() -> ToUnorderedMap(&meta); }
+  }
+  ARROW_ASSIGN_OR_RAISE(auto positions, sipm_positions(meta, filename));
+  if (! sipm_threshold.has_value() && meta.contains("sipm_threshold")) {
+    auto to_uint32 = [] (const std::string& s) {
+      auto n = std::stoul(s);
+      if (n > std::numeric_limits<uint32_t>::max()) { throw std::out_of_range{s}; }
+      return static_cast<uint32_t>(n);
+    };
+    ARROW_ASSIGN_OR_RAISE(sipm_threshold, parse_metadata("sipm_threshold", meta["sipm_threshold"], filename, to_uint32));
+  }
+  if (! sipm_threshold.has_value()) { sipm_threshold = 1; }
+  auto n_sipms = positions.size();
+
+  // The unit of work is a row group of a parquet file, or a record batch
+  // of an Arrow IPC file, which is read whole and memory-mapped
+  std::shared_ptr<arrow::ChunkedArray> ipc_column;
+  std::shared_ptr<arrow::Schema>       counts_schema; // of parquet files, to widen narrower counts
+  int                                  column = -1;
+  std::vector<size_t>                  first_row{0};
+  if (format == output_format_enum::parquet) {
+    std::shared_ptr<arrow::Schema> schema;
+    ARROW_RETURN_NOT_OK(reader -> GetSchema(&schema));
+    column = schema -> GetFieldIndex("photon_counts");
+    if (column < 0) { return arrow::Status::Invalid("No photon_counts column in ", filename); }
+    counts_schema = arrow::schema({schema -> field(column)});
+    for (int g=0; g<file_meta -> num_row_groups(); g++) { first_row.push_back(first_row.back() + file_meta -> RowGroup(g) -> num_rows()); }
+  } else {
+    ipc_column = ipc_table -> GetColumnByName("photon_counts");
+    if (! ipc_column) { return arrow::Status::Invalid("No photon_counts column in ", filename); }
+    for (const auto& chunk: ipc_column -> chunks()) { first_row.push_back(first_row.back() + chunk -> length()); }
+  }
+  int n_blocks = first_row.size() - 1;
+
+  // Every block knows where its events go, so the threads write
+  // straight into the shared output without synchronisation
+  count_features out;
+  out.resize(first_row.back());
+
+  if (n_threads == 0) { n_threads = std::max(std::thread::hardware_concurrency(), 1u); }
+  n_threads = std::min<unsigned>(n_threads, std::max(n_blocks, 1));
+
+  auto work = [&] (unsigned thread_id) -> arrow::Status {
+    std::unique_ptr<parquet::arrow::FileReader> reader;
+    if (column >= 0) { ARROW_ASSIGN_OR_RAISE(reader, open_parquet(filename, file_meta)); }
+    reconstructor centroids{{.method = reco_method_enum::anger, .truncation = 0, .lrf_file = ""}, positions};
+    reco_batch    centroid;
+    for (int b=thread_id; b<n_blocks; b+=n_threads) {
+      std::vector<std::shared_ptr<arrow::Array>> chunks;
+      if (column >= 0) {
+        std::shared_ptr<arrow::ChunkedArray> row_group;
+        ARROW_RETURN_NOT_OK(reader -> RowGroup(b) -> Column(column) -> Read(&row_group));
+        ARROW_ASSIGN_OR_RAISE(auto counts, dequantise(arrow::Table::Make(counts_schema, {row_group})));
+        chunks = counts -> column(0) -> chunks();
+      } else {
+        chunks = {ipc_column -> chunk(b)};
+      }
+      auto first = first_row[b];
+      for (const auto& chunk: chunks) {
+        const auto counts_list  = static_pointer_cast<arrow::FixedSizeListArray>(chunk);
+        const auto counts_start = static_pointer_cast<arrow::UInt32Array>(counts_list -> values()) -> raw_values()
+                                + counts_list -> value_offset(0);
+        if (static_cast<size_t>(counts_list -> value_length()) != n_sipms) {
+          return arrow::Status::Invalid("photon_counts has ", counts_list -> value_length(), " SiPMs, the metadata ", n_sipms);
+        }
+        size_t n_events = counts_list -> length();
+        count_kernels(counts_start, n_events, n_sipms, sipm_threshold.value(), out, first);
+        centroids.reconstruct(counts_start, n_events, centroid);
+        std::copy(begin(centroid.x), end(centroid.x), begin(out.x) + first);
+        std::copy(begin(centroid.y), end(centroid.y), begin(out.y) + first);
+        first += n_events;
+      }
+    }
+    return arrow::Status::OK();
+  };
+
+  std::vector<arrow::Status> status(n_threads);
+  std::vector<std::thread>   threads;
+  for (unsigned t=0; t<n_threads; t++) { threads.emplace_back([&, t] { status[t] = work(t); }); }
+  for (auto& t: threads) { t.join(); }
+  for (const auto& s: status) { ARROW_RETURN_NOT_OK(s); }
+  return out;
+}
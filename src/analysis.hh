@@ -0,0 +1,42 @@
+#pragma once
+
+#include <G4ThreeVector.hh>
+
+#include <arrow/api.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Per-event features of the photon counts, one entry per row of the file
+struct count_features {
+  std::vector<uint32_t> total;
+  std::vector<uint32_t> max;
+  std::vector<uint32_t> argmax;           // SiPM with the most counts; the first one on ties
+  std::vector<uint32_t> n_over_threshold; // SiPMs with at least `sipm_threshold` counts
+  std::vector<float>    x, y;             // Light centroid, NaN when no light was seen
+
+  size_t size() const { return total.size(); }
+  void resize(size_t n_events);
+};
+
+// Fills the integer features of events [first, first + n_events) of `out`
+// from a contiguous block of counts laid out as in the photon_counts
+// column: one row of `n_sipms` per event. The loops run over plain
+// arrays so that the compiler can vectorise them.
+void count_kernels(const uint32_t* counts, size_t n_events, size_t n_sipms, uint32_t sipm_threshold,
+                   count_features& out, size_t first);
+
+// Computes the features of every event in a file written by
+// `parquet_writer`. Only the photon_counts column is read, straight from
+// its UInt32Array (widened first when stored narrower), and the row groups (record batches of Arrow IPC files)
+// are shared between `n_threads` threads (0: one per core), each with its
+// own reader. The SiPM positions and, unless given, the threshold are
+// taken from the file's metadata.
+arrow::Result<count_features> analyse_counts(const std::string& filename, unsigned n_threads = 0,
+                                             std::optional<uint32_t> sipm_threshold = std::nullopt);
+
+// SiPM positions stored in the metadata of every output file
+arrow::Result<std::vector<G4ThreeVector>> sipm_positions_from_metadata(const std::string& filename);
@@ -1,5 +1,6 @@
 #include "config.hh"
 #include "n4-random.hh"
+#include "sampling.hh"
 
 #include <pet-materials.hh>
 
@@ -7,8 +8,20 @@
 
 #include <G4ThreeVector.hh>
 
+#include <CLHEP/Random/JamesRandom.h>
+#include <CLHEP/Random/MixMaxRng.h>
+#include <CLHEP/Random/MTwistEngine.h>
+#include <CLHEP/Random/RanecuEngine.h>
+#include <CLHEP/Random/Ranlux64Engine.h>
+#include <CLHEP/Random/RanluxEngine.h>
+#include <CLHEP/Random/RanshiEngine.h>
+
+#include <algorithm>
 #include <cctype>
+#include <cmath>
+#include <cstdint>
 #include <cstdlib>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
@@ -53,20 +66,26 @@ config::config()
 // The trailing slash after '/my_geometry' is CRUCIAL: without it, the
 // messenger violates the principle of least surprise.
 , msg{new G4GenericMessenger{this, "/my/", "docs: bla bla bla"}}
+, source_msg{new G4GenericMessenger{this, "/source/", "Commands specific to the generators"}}
 {
   G4UnitDefinition::BuildUnitsTable();
   new G4UnitDefinition("1/MeV","1/MeV", "1/Energy", 1/MeV);
+  new G4UnitDefinition("kHz/mm2","kHz/mm2", "Frequency/Surface", kilohertz/mm2);
 
   msg -> DeclareMethod          ("config_type"         ,          &config::set_config_type    );
   msg -> DeclarePropertyWithUnit("reflector_thickness" ,    "mm",  reflector_thickness        );
   msg -> DeclareMethodWithUnit  ("particle_energy"     ,   "keV", &config::set_particle_energy);
   msg -> DeclareProperty        (   "fixed_energy"     ,           fixed_energy               );
   msg -> DeclareProperty        ("physics_verbosity"   ,           physics_verbosity          );
+  msg -> DeclareMethod          ("physics_list"        ,          &config::set_physics_list   );
+  msg -> DeclareMethod          ("em_physics"          ,          &config::set_em_physics     );
   msg -> DeclareMethod          ("seed"                ,          &config::set_random_seed    );
+  msg -> DeclareMethod          ("rng_engine"          ,          &config::set_rng_engine     );
   msg -> DeclareProperty        ("debug"               ,           debug                      );
   msg -> DeclareMethodWithUnit  ("scint_yield"         , "1/MeV", &config::set_scint_yield    );
   msg -> DeclareMethod          ("reflector_model"     ,          &config::set_reflector_model);
   msg -> DeclareMethod          ("wrapping"            ,          &config::set_wrapping       );
+  msg -> DeclareMethod          ("sipm_placement"      ,          &config::set_sipm_placement );
   msg -> DeclareProperty        ("event_threshold"     ,           event_threshold            );
   msg -> DeclareProperty        ( "sipm_threshold"     ,            sipm_threshold            );
   msg -> DeclareMethod          ("reflectivity"        ,          &config::set_reflectivity   );
@@ -75,6 +94,52 @@ config::config()
   msg -> DeclareProperty        ( "outfile"            ,           outfile                    );
   msg -> DeclareProperty        ( "chunk_size"         ,           chunk_size                 );
   msg -> DeclareProperty        ( "compression"        ,           compression                );
+  msg -> DeclareMethod          ( "output_format"      ,          &config::set_output_format  );
+  msg -> DeclareProperty        ( "ipc_compression"    ,           ipc_compression            );
+  msg -> DeclareProperty        ( "read_memory_map"    ,           read_memory_map            );
+  msg -> DeclareProperty        ( "read_threads"       ,           read_threads               );
+  msg -> DeclareProperty        ( "read_pre_buffer"    ,           read_pre_buffer            );
+  msg -> DeclareProperty        ( "digitise"           ,           digitise                   );
+  msg -> DeclareProperty        ( "digitise_times"     ,           digitise_times             );
+  msg -> DeclarePropertyWithUnit( "microcell_pitch"    ,    "um",  microcell_pitch            );
+  msg -> DeclarePropertyWithUnit( "microcell_recovery" ,    "ns",  microcell_recovery         );
+  msg -> DeclareProperty        ( "crosstalk_prob"     ,           crosstalk_prob             );
+  msg -> DeclareProperty        ( "afterpulse_prob"    ,           afterpulse_prob            );
+  msg -> DeclarePropertyWithUnit( "afterpulse_tau"     ,    "ns",  afterpulse_tau             );
+  msg -> DeclarePropertyWithUnit( "dark_count_rate"    ,"kHz/mm2", dark_count_rate           );
+  msg -> DeclarePropertyWithUnit( "digitisation_window",    "ns",  digitisation_window        );
+  msg -> DeclareProperty        ( "n_arrival_times"    ,           n_arrival_times            );
+  msg -> DeclareProperty        ( "time_quantile"      ,           time_quantile              );
+  msg -> DeclareProperty        ( "record_deposits"    ,           record_deposits            );
+  msg -> DeclareProperty        ( "force_interaction"  ,           force_interaction          );
+  msg -> DeclareProperty        ( "scan_outfile"       ,           scan_outfile               );
+  msg -> DeclareProperty        ( "scan_hist_bins"     ,           scan_hist_bins             );
+  msg -> DeclareProperty        ( "scan_hist_max"      ,           scan_hist_max              );
+  msg -> DeclareProperty        ( "summary"            ,           summary                    );
+  msg -> DeclareProperty        ( "summary_bins"       ,           summary_bins               );
+  msg -> DeclareProperty        ( "summary_sipm_max"   ,           summary_sipm_max           );
+  msg -> DeclareProperty        ( "summary_total_max"  ,           summary_total_max          );
+  msg -> DeclareMethod          ( "stop_when"          ,          &config::set_stop_when      );
+  msg -> DeclareProperty        ( "stop_rel_error"     ,           stop_rel_error             );
+  msg -> DeclareProperty        ( "stop_check_every"   ,           stop_check_every           );
+  msg -> DeclareProperty        ( "stop_min_events"    ,           stop_min_events            );
+  msg -> DeclareMethod          ( "reco"               ,          &config::set_reco           );
+  msg -> DeclareProperty        ( "reco_truncation"    ,           reco_truncation            );
+  msg -> DeclareProperty        ( "reco_lrf"           ,           reco_lrf                   );
+  msg -> DeclarePropertyWithUnit( "position_resolution",    "um",  position_resolution        );
+  msg -> DeclarePropertyWithUnit( "edep_resolution"    ,   "keV",  edep_resolution            );
+  msg -> DeclareProperty        ( "count_bits"         ,           count_bits                 );
+  msg -> DeclarePropertyWithUnit( "default_cut"        ,    "mm",  default_cut                );
+  msg -> DeclarePropertyWithUnit( "crystal_cut"        ,    "mm",  crystal_cut                );
+  msg -> DeclarePropertyWithUnit( "readout_cut"        ,    "mm",  readout_cut                );
+  msg -> DeclarePropertyWithUnit( "crystal_max_step"   ,    "mm",  crystal_max_step           );
+  msg -> DeclareProperty        ( "report_steps"       ,           report_steps               );
+  msg -> DeclareMethod          ( "enable_optical_process" ,      &config:: enable_optical_process);
+  msg -> DeclareMethod          ("disable_optical_process" ,      &config::disable_optical_process);
+  msg -> DeclareProperty        ( "cerenkov_max_photons"   ,       cerenkov_max_photons           );
+  msg -> DeclareProperty        ( "track_secondaries_first",       track_secondaries_first        );
+  msg -> DeclareProperty        ( "scint_by_particle_type" ,       scint_by_particle_type         );
+  msg -> DeclareProperty        ( "physics_table_cache"    ,       physics_table_cache            );
 
   msg -> DeclareMethod        ("scint"      ,       &config::set_scint);
   msg -> DeclareMethodWithUnit("scint_depth", "mm", &config::set_scint_depth);
@@ -83,6 +148,14 @@ config::config()
   msg -> DeclareMethod        ("n_sipms_xy" ,       &config::set_n_sipms_xy);
   msg -> DeclareMethodWithUnit("sipm_size"  , "mm", &config::set_sipm_size);
 
+  source_msg -> DeclareProperty("sipm_centres", sipm_centres);
+  source_msg -> DeclareProperty("nphotons"    , nphotons    );
+  source_msg -> DeclareProperty("deposits"    , replay_deposits);
+  source_msg -> DeclareProperty("scan_nx"     , scan_nx    );
+  source_msg -> DeclareProperty("scan_ny"     , scan_ny    );
+  source_msg -> DeclareProperty("scan_nz"     , scan_nz    );
+  source_msg -> DeclareProperty("scan_events" , scan_events);
+
   set_random_seed(seed);
 }
 
@@ -167,6 +240,188 @@ std::string wrapping_enum_to_string(wrapping_enum s) {
   return "unreachable!";
 }
 
+sipm_placement_enum string_to_sipm_placement_enum(std::string s) {
+  for (auto& c: s) { c = std::tolower(c); }
+  if (s == "individual"   ) { return sipm_placement_enum::individual   ; }
+  if (s == "parameterised") { return sipm_placement_enum::parameterised; }
+  if (s == "parameterized") { return sipm_placement_enum::parameterised; }
+  if (s == "plane"        ) { return sipm_placement_enum::plane        ; }
+  std::cerr << "\n\n\n\n         ERROR in string_to_sipm_placement_enum: unknown placement '" << s << "'\n\n\n\n" << std::endl;
+  throw "up"; // TODO think about failure propagation out of string_to_scintillator_type
+}
+
+std::string sipm_placement_enum_to_string(sipm_placement_enum s) {
+  switch (s) {
+    case sipm_placement_enum::individual   : return "individual"   ;
+    case sipm_placement_enum::parameterised: return "parameterised";
+    case sipm_placement_enum::plane        : return "plane"        ;
+  }
+  return "unreachable!";
+}
+
+
+rng_engine_enum string_to_rng_engine_enum(std::string s) {
+  for (auto& c: s) { c = std::tolower(c); }
+  if (s == "mixmax"  ) { return rng_engine_enum::mixmax  ; }
+  if (s == "ranlux"  ) { return rng_engine_enum::ranlux  ; }
+  if (s == "ranlux64") { return rng_engine_enum::ranlux64; }
+  if (s == "mtwist"  ) { return rng_engine_enum::mtwist  ; }
+  if (s == "ranecu"  ) { return rng_engine_enum::ranecu  ; }
+  if (s == "ranshi"  ) { return rng_engine_enum::ranshi  ; }
+  if (s == "james"   ) { return rng_engine_enum::james   ; }
+  std::cerr << "\n\n\n\n         ERROR in string_to_rng_engine_enum: unknown engine '" << s << "'\n\n\n\n" << std::endl;
+  throw "up"; // TODO think about failure propagation out of string_to_scintillator_type
+}
+
+std::string rng_engine_enum_to_string(rng_engine_enum s) {
+  switch (s) {
+    case rng_engine_enum::mixmax  : return "mixmax"  ;
+    case rng_engine_enum::ranlux  : return "ranlux"  ;
+    case rng_engine_enum::ranlux64: return "ranlux64";
+    case rng_engine_enum::mtwist  : return "mtwist"  ;
+    case rng_engine_enum::ranecu  : return "ranecu"  ;
+    case rng_engine_enum::ranshi  : return "ranshi"  ;
+    case rng_engine_enum::james   : return "james"   ;
+  }
+  return "unreachable!";
+}
+
+physics_list_enum string_to_physics_list_enum(std::string s) {
+  for (auto& c: s) { c = std::tolower(c); }
+  if (s == "full") { return physics_list_enum::full; }
+  if (s == "lean") { return physics_list_enum::lean; }
+  std::cerr << "\n\n\n\n         ERROR in string_to_physics_list_enum: unknown physics list '" << s << "'\n\n\n\n" << std::endl;
+  throw "up"; // TODO think about failure propagation out of string_to_scintillator_type
+}
+
+std::string physics_list_enum_to_string(physics_list_enum s) {
+  switch (s) {
+    case physics_list_enum::full: return "full";
+    case physics_list_enum::lean: return "lean";
+  }
+  return "unreachable!";
+}
+
+em_physics_enum string_to_em_physics_enum(std::string s) {
+  for (auto& c: s) { c = std::tolower(c); }
+  if (s == "option4" ) { return em_physics_enum::option4 ; }
+  if (s == "option3" ) { return em_physics_enum::option3 ; }
+  if (s == "standard") { return em_physics_enum::standard; }
+  if (s == "option0" ) { return em_physics_enum::standard; }
+  std::cerr << "\n\n\n\n         ERROR in string_to_em_physics_enum: unknown EM physics '" << s << "'\n\n\n\n" << std::endl;
+  throw "up"; // TODO think about failure propagation out of string_to_scintillator_type
+}
+
+std::string em_physics_enum_to_string(em_physics_enum s) {
+  switch (s) {
+    case em_physics_enum::option4 : return "option4" ;
+    case em_physics_enum::option3 : return "option3" ;
+    case em_physics_enum::standard: return "standard";
+  }
+  return "unreachable!";
+}
+
+stop_target_enum string_to_stop_target_enum(std::string s) {
+  for (auto& c: s) { c = std::tolower(c); }
+  if (s == "none"                   ) { return stop_target_enum::none;                    }
+  if (s == "over_threshold_fraction") { return stop_target_enum::over_threshold_fraction; }
+  if (s == "light_collection"       ) { return stop_target_enum::light_collection;        }
+  if (s == "resolution"             ) { return stop_target_enum::resolution;              }
+  std::cerr << "\n\n\n\n         ERROR in string_to_stop_target_enum: unknown stopping target '" << s << "'\n\n\n\n" << std::endl;
+  throw "up"; // TODO think about failure propagation out of string_to_scintillator_type
+}
+
+std::string stop_target_enum_to_string(stop_target_enum s) {
+  switch (s) {
+    case stop_target_enum::none                   : return "none";
+    case stop_target_enum::over_threshold_fraction: return "over_threshold_fraction";
+    case stop_target_enum::light_collection       : return "light_collection";
+    case stop_target_enum::resolution             : return "resolution";
+  }
+  return "unreachable!";
+}
+
+reco_method_enum string_to_reco_method_enum(std::string s) {
+  for (auto& c: s) { c = std::tolower(c); }
+  if (s == "none"     ) { return reco_method_enum::none;      }
+  if (s == "anger"    ) { return reco_method_enum::anger;     }
+  if (s == "truncated") { return reco_method_enum::truncated; }
+  if (s == "ml"       ) { return reco_method_enum::ml;        }
+  std::cerr << "\n\n\n\n         ERROR in string_to_reco_method_enum: unknown reconstruction method '" << s << "'\n\n\n\n" << std::endl;
+  throw "up"; // TODO think about failure propagation out of string_to_scintillator_type
+}
+
+std::string reco_method_enum_to_string(reco_method_enum s) {
+  switch (s) {
+    case reco_method_enum::none     : return "none";
+    case reco_method_enum::anger    : return "anger";
+    case reco_method_enum::truncated: return "truncated";
+    case reco_method_enum::ml       : return "ml";
+  }
+  return "unreachable!";
+}
+
+generators string_to_generator(std::string s) {
+  for (auto& c: s) { c = std::tolower(c); }
+  if (s == "gammas_from_outside_crystal"        ||
+      s == "gammas"                  ) { return generators::gammas_from_outside_crystal; }
+  if (s == "photoelectric_electrons" ||
+      s == "electrons"               ) { return generators::photoelectric_electrons;     }
+  if (s == "pointlike_photon_source" ||
+      s == "photons"                 ) { return generators::pointlike_photon_source;     }
+  if (s == "replay_deposits"         ||
+      s == "replay"                  ) { return generators::replay_deposits;             }
+  if (s == "scan_positions"          ||
+      s == "scan"                    ) { return generators::scan_positions;              }
+  throw "Invalid generator name: `" + s + "'"; // TODO think about failure propagation out of here
+}
+
+output_format_enum string_to_output_format_enum(std::string s) {
+  for (auto& c: s) { c = std::tolower(c); }
+  if (s == "auto"   ) { return output_format_enum::automatic; }
+  if (s == "parquet") { return output_format_enum::parquet;   }
+  if (s == "feather") { return output_format_enum::feather;   }
+  if (s == "arrow"  ) { return output_format_enum::feather;   }
+  if (s == "stream" ) { return output_format_enum::stream;    }
+  std::cerr << "\n\n\n\n         ERROR in string_to_output_format_enum: unknown output format '" << s << "'\n\n\n\n" << std::endl;
+  throw "up"; // TODO think about failure propagation out of string_to_scintillator_type
+}
+
+std::string output_format_enum_to_string(output_format_enum s) {
+  switch (s) {
+    case output_format_enum::automatic: return "auto";
+    case output_format_enum::parquet  : return "parquet";
+    case output_format_enum::feather  : return "feather";
+    case output_format_enum::stream   : return "stream";
+  }
+  return "unreachable!";
+}
+
+const std::string& config::checked_optical_process(const std::string& s) {
+  static const std::vector<std::string> known{
+    "Cerenkov", "Scintillation", "OpAbsorption", "OpRayleigh", "OpMieHG", "OpBoundary", "OpWLS", "OpWLS2"
+  };
+  for (const auto& name: known) {
+    if (s == name) { return name; }
+  }
+  std::cerr << "\n\n\n\n         ERROR in checked_optical_process: unknown optical process '" << s << "'\n\n\n\n" << std::endl;
+  throw "up"; // TODO think about failure propagation out of string_to_scintillator_type
+}
+
+// The engine is replaced, so the current seed is applied to the new one
+void config::set_rng_engine(const std::string& s) {
+  rng_engine = string_to_rng_engine_enum(s);
+  switch (rng_engine) {
+    case rng_engine_enum::mixmax  : G4Random::setTheEngine(new CLHEP::MixMaxRng     ); break;
+    case rng_engine_enum::ranlux  : G4Random::setTheEngine(new CLHEP::RanluxEngine  ); break;
+    case rng_engine_enum::ranlux64: G4Random::setTheEngine(new CLHEP::Ranlux64Engine); break;
+    case rng_engine_enum::mtwist  : G4Random::setTheEngine(new CLHEP::MTwistEngine  ); break;
+    case rng_engine_enum::ranecu  : G4Random::setTheEngine(new CLHEP::RanecuEngine  ); break;
+    case rng_engine_enum::ranshi  : G4Random::setTheEngine(new CLHEP::RanshiEngine  ); break;
+    case rng_engine_enum::james   : G4Random::setTheEngine(new CLHEP::HepJamesRandom); break;
+  }
+  set_random_seed(seed);
+}
 
 void config::set_config_type(const std::string& s) {
   switch (string_to_config_type(s)) {
@@ -179,10 +434,10 @@ void config::set_config_type(const std::string& s) {
   return;
 }
 
-n4::random::piecewise_linear_distribution scint_spectrum() {
+alias_sampler scint_spectrum(scintillator_type_enum scint) {
   using namespace petmat;
   std::pair<std::vector<double>, std::vector<double>> data;
-  switch (my.scint_params().scint) {
+  switch (scint) {
     case scintillator_type_enum::csi   : data =    csi_scint_spectrum(); break;
     case scintillator_type_enum::csi_tl: data = csi_tl_scint_spectrum(); break;
     case scintillator_type_enum::lyso  : data =   lyso_scint_spectrum(); break;
@@ -194,7 +449,7 @@ n4::random::piecewise_linear_distribution scint_spectrum() {
 
 double config::particle_energy() const {
   if (fixed_energy) { return particle_energy_; }
-  if (! energy_spectrum.has_value()) { energy_spectrum.emplace(scint_spectrum()); }
+  if (! energy_spectrum.has_value()) { energy_spectrum.emplace(scint_spectrum(scint_params().scint)); }
   return energy_spectrum.value().sample();
 }
 
@@ -205,6 +460,29 @@ G4ThreeVector config::scint_size() const {
          , params.scint_depth                 };
 }
 
+G4ThreeVector world_size(const G4ThreeVector& scint_size) {
+  return {scint_size.x() * 1.5, scint_size.y() * 1.5, scint_size.z() * 2.5};
+}
+
+double largest_coordinate(const G4ThreeVector& scint_size) {
+  auto world = world_size(scint_size);
+  return std::max({world.x(), world.y(), world.z()}) / 2;
+}
+
+// Narrowest width of the fixed-point encoding of values up to `max`, in
+// magnitude; 0 when not quantised
+unsigned fixed_point_bits(double resolution, double max, double max_16_bit) {
+  if (resolution <= 0) { return 0; }
+  return std::round(max / resolution) <= max_16_bit ? 16 : 32;
+}
+
+// Only the photon source bounds the counts: no SiPM sees more photons
+// than were generated
+unsigned auto_count_bits(const std::string& generator, unsigned nphotons) {
+  if (string_to_generator(generator) != generators::pointlike_photon_source) { return 32; }
+  return nphotons <= UINT8_MAX ? 8 : nphotons <= UINT16_MAX ? 16 : 32;
+}
+
 G4Material* scintillator_material(scintillator_type_enum type) {
   using namespace petmat;
   switch (type) {
@@ -265,13 +543,17 @@ std::unordered_map<std::string, std::string> config::as_map() {
   it["n_sipms_x"          ] = std::to_string(params.n_sipms_x);
   it["n_sipms_y"          ] = std::to_string(params.n_sipms_y);
   it["sipm_size"          ] = std::to_string(params.sipm_size/mm) + " mm";
+  it["sipm_placement"     ] = sipm_placement_enum_to_string(my.sipm_placement);
   it["sipm_thickness"     ] = std::to_string(my.sipm_thickness/mm) + " mm";
   it[ "gel_thickness"     ] = std::to_string(my. gel_thickness/mm) + " mm";
   it["reflector_thickness"] = std::to_string(my.reflector_thickness/mm) + " mm";
   it["particle_energy"    ] = std::to_string(my.particle_energy_/keV) + " keV";
   it["fixed_energy"       ] = std::to_string(my.fixed_energy);
   it["physics_verbosity"  ] = std::to_string(my.physics_verbosity);
+  it["physics_list"       ] = physics_list_enum_to_string(my.physics_list);
+  it["em_physics"         ] = em_physics_enum_to_string(my.em_physics);
   it["seed"               ] = std::to_string(my.seed);
+  it["rng_engine"         ] = rng_engine_enum_to_string(my.rng_engine);
   it["debug"              ] = std::to_string(my.debug);
   it["event_threshold"    ] = std::to_string(my.event_threshold);
   it[ "sipm_threshold"    ] = std::to_string(my. sipm_threshold);
@@ -281,6 +563,64 @@ std::unordered_map<std::string, std::string> config::as_map() {
   it["absorbent_opposite" ] = my.absorbent_opposite ? "true" : "false";
   it["generator"          ] = my.generator;
   it["outfile"            ] = my.outfile;
+  it["output_format"      ] = output_format_enum_to_string(my.output_format);
+  if (my.output_format != output_format_enum::parquet) { it["ipc_compression"] = my.ipc_compression; }
+  it["sipm_centres"       ] = my.sipm_centres ? "true" : "false";
+  it["nphotons"           ] = std::to_string(my.nphotons);
+  if (! my.record_deposits.empty()) { it["record_deposits"] = my.record_deposits; }
+  if (! my.replay_deposits.empty()) { it["replay_deposits"] = my.replay_deposits; }
+  it["force_interaction"  ] = my.force_interaction ? "true" : "false";
+  it["default_cut"        ] = std::to_string(my.default_cut/mm) + " mm";
+  it["crystal_cut"        ] = std::to_string(my.crystal_cut/mm) + " mm";
+  it["readout_cut"        ] = std::to_string(my.readout_cut/mm) + " mm";
+  for (const auto& [process, active]: my.optical_processes) {
+    it["optical_" + process] = active ? "on" : "off";
+  }
+  it["cerenkov_max_photons"   ] = std::to_string(my.cerenkov_max_photons);
+  it["track_secondaries_first"] = my.track_secondaries_first ? "true" : "false";
+  it["scint_by_particle_type" ] = my.scint_by_particle_type  ? "true" : "false";
+  if (! my.physics_table_cache.empty()) { it["physics_table_cache"] = my.physics_table_cache; }
+  it["crystal_max_step"   ] = my.crystal_max_step > 0 ? std::to_string(my.crystal_max_step/mm) + " mm" : "NULL";
+  if (string_to_generator(my.generator) == generators::scan_positions) {
+    it["scan_grid"        ] = std::to_string(my.scan_nx) + "x" + std::to_string(my.scan_ny) + "x" + std::to_string(my.scan_nz);
+    it["scan_events"      ] = std::to_string(my.scan_events);
+    it["scan_hist_bins"   ] = std::to_string(my.scan_hist_bins);
+    it["scan_hist_max"    ] = std::to_string(my.scan_hist_max);
+  }
+  it["summary"            ] = my.summary ? "true" : "false";
+  if (my.summary) {
+    it["summary_bins"     ] = std::to_string(my.summary_bins);
+    it["summary_sipm_max" ] = std::to_string(my.summary_sipm_max);
+    it["summary_total_max"] = std::to_string(my.summary_total_max);
+  }
+  it["stop_when"          ] = stop_target_enum_to_string(my.stop_when);
+  if (my.stop_when != stop_target_enum::none) {
+    it["stop_rel_error"   ] = std::to_string(my.stop_rel_error);
+    it["stop_check_every" ] = std::to_string(my.stop_check_every);
+    it["stop_min_events"  ] = std::to_string(my.stop_min_events);
+  }
+  it["reco"               ] = reco_method_enum_to_string(my.reco);
+  if (my.reco == reco_method_enum::truncated) { it["reco_truncation"] = std::to_string(my.reco_truncation); }
+  if (my.reco == reco_method_enum::ml       ) { it["reco_lrf"       ] = my.reco_lrf; }
+  if (my.position_resolution > 0) { it["position_resolution"] = std::to_string(my.position_resolution/um) + " um"; }
+  if (my.edep_resolution     > 0) { it["edep_resolution"    ] = std::to_string(my.edep_resolution/keV) + " keV"; }
+  it["count_bits"         ] = my.count_bits > 0 ? std::to_string(my.count_bits) : "auto";
+  it["digitise"           ] = my.digitise       ? "true" : "false";
+  it["digitise_times"     ] = my.digitise_times ? "true" : "false";
+  if (my.digitise) {
+    it["microcell_pitch"    ] = std::to_string(my.microcell_pitch/um) + " um";
+    it["microcell_recovery" ] = std::to_string(my.microcell_recovery/ns) + " ns";
+    it["crosstalk_prob"     ] = std::to_string(my.crosstalk_prob);
+    it["afterpulse_prob"    ] = std::to_string(my.afterpulse_prob);
+    it["afterpulse_tau"     ] = std::to_string(my.afterpulse_tau/ns) + " ns";
+    it["dark_count_rate"    ] = std::to_string(my.dark_count_rate/(kilohertz/mm2)) + " kHz/mm2";
+    it["digitisation_window"] = std::to_string(my.digitisation_window/ns) + " ns";
+  }
+  it["n_arrival_times"    ] = std::to_string(my.n_arrival_times);
+  if (my.n_arrival_times > 0) {
+    it["time_quantile"        ] = std::to_string(my.time_quantile);
+    it["arrival_time_encoding"] = "delta ps";
+  }
 
   size_t n = 0;
   for (const auto& p: sipm_positions()) {
@@ -292,3 +632,132 @@ std::unordered_map<std::string, std::string> config::as_map() {
 
   return it;
 }
+
+#define VALIDATE(condition, message) if (! (condition)) { errors << "\n    " << message; }
+void validate(const resolved_config& r) {
+  std::ostringstream errors;
+  VALIDATE(r.n_sipms > 0                             , "There must be at least one SiPM");
+  VALIDATE(r.scint_params.sipm_size   > 0            , "sipm_size must be positive");
+  VALIDATE(r.scint_params.scint_depth > 0            , "scint_depth must be positive");
+  VALIDATE(r.chunk_size > 0                          , "chunk_size must be positive");
+  VALIDATE(! r.outfile.empty()                       , "outfile must not be empty");
+  {
+    auto spec = r.ipc_compression;
+    for (auto& c: spec) { c = std::tolower(c); }
+    VALIDATE(spec == "none" || spec == "lz4" || spec == "zstd", "ipc_compression must be none, lz4 or zstd");
+  }
+  VALIDATE(r.time_quantile >= 0 && r.time_quantile <= 1, "time_quantile must be in [0, 1]");
+  VALIDATE(r.scan.n_positions()        > 0           , "scan_nx, scan_ny and scan_nz must be positive");
+  VALIDATE(r.scan.events_per_position  > 0           , "scan_events must be positive");
+  VALIDATE(r.scan.hist_bins            > 0           , "scan_hist_bins must be positive");
+  VALIDATE(r.scan.hist_max             > 0           , "scan_hist_max must be positive");
+  if (r.stopping.target != stop_target_enum::none) {
+    VALIDATE(r.stopping.relative_error > 0, "stop_rel_error must be positive");
+    VALIDATE(r.stopping.check_every    > 0, "stop_check_every must be positive");
+  }
+  if (r.reco.method == reco_method_enum::truncated) {
+    VALIDATE(r.reco.truncation >= 0 && r.reco.truncation < 1, "reco_truncation must be in [0, 1)");
+  }
+  if (r.reco.method == reco_method_enum::ml) {
+    VALIDATE(! r.reco.lrf_file.empty(), "ml reconstruction needs reco_lrf");
+  }
+  VALIDATE(r.quantisation.position_resolution >= 0, "position_resolution must not be negative");
+  VALIDATE(r.quantisation.edep_resolution     >= 0, "edep_resolution must not be negative");
+  VALIDATE(r.quantisation.count_bits == 8 || r.quantisation.count_bits == 16 || r.quantisation.count_bits == 32,
+           "count_bits must be 8, 16 or 32");
+  if (r.summary.enabled) {
+    VALIDATE(r.summary.bins      > 0, "summary_bins must be positive");
+    VALIDATE(r.summary.sipm_max  > 0, "summary_sipm_max must be positive");
+    VALIDATE(r.summary.total_max > 0, "summary_total_max must be positive");
+  }
+  if (r.digitise) {
+    const auto& d = r.digi_params;
+    VALIDATE(d.crosstalk_prob  >= 0 && d.crosstalk_prob  < 1, "crosstalk_prob must be in [0, 1)");
+    VALIDATE(d.afterpulse_prob >= 0 && d.afterpulse_prob < 1, "afterpulse_prob must be in [0, 1)");
+    VALIDATE(d.recovery_time   >  0                         , "microcell_recovery must be positive");
+    VALIDATE(d.window          >  0                         , "digitisation_window must be positive");
+  }
+  auto message = errors.str();
+  if (! message.empty()) {
+    std::cerr << "\n\n\n\n         ERROR in config:" << message << "\n\n\n\n" << std::endl;
+    throw std::invalid_argument{"invalid config:" + message};
+  }
+}
+#undef VALIDATE
+
+std::shared_ptr<const resolved_config> config::resolve() const {
+  auto params = scint_params();
+  auto r = std::make_shared<resolved_config>(resolved_config{
+    .generation            = generation() + 1,
+    .scint_params          = params,
+    .scint_size            = scint_size(),
+    .sipm_positions        = sipm_positions(),
+    .n_sipms               = n_sipms(),
+    . gel_thickness        =  gel_thickness,
+    .sipm_thickness        = sipm_thickness,
+    .sipm_placement        = sipm_placement,
+    .fixed_energy          = fixed_energy,
+    .fixed_particle_energy = particle_energy_,
+    .energy_spectrum       = fixed_energy ? std::nullopt : std::make_optional(scint_spectrum(params.scint)),
+    .event_threshold       = event_threshold,
+    . sipm_threshold       =  sipm_threshold,
+    .chunk_size            = chunk_size,
+    .outfile               = outfile,
+    .output_format         = output_format,
+    .ipc_compression       = ipc_compression,
+    .digitise              = digitise,
+    .digitise_times        = digitise_times,
+    .digi_params           = digitisation_params_from_config(),
+    .n_arrival_times       = n_arrival_times,
+    .time_quantile         = time_quantile,
+    .sipm_centres          = sipm_centres,
+    .nphotons              = nphotons,
+    .record_deposits       = record_deposits,
+    .replay_deposits       = replay_deposits,
+    .force_interaction     = force_interaction,
+    .report_steps          = report_steps,
+    .scan                  = { .nx                  = scan_nx
+                             , .ny                  = scan_ny
+                             , .nz                  = scan_nz
+                             , .events_per_position = scan_events
+                             , .hist_bins           = scan_hist_bins
+                             , .hist_max            = scan_hist_max },
+    .scan_outfile          = scan_outfile,
+    .summary               = { .enabled   = summary
+                             , .bins      = summary_bins
+                             , .sipm_max  = summary_sipm_max
+                             , .total_max = summary_total_max
+                             , .outfile   = summary_filename(outfile) },
+    .stopping              = { .target         = stop_when
+                             , .relative_error = stop_rel_error
+                             , .check_every    = stop_check_every
+                             , .min_events     = stop_min_events },
+    .reco                  = { .method     = reco
+                             , .truncation = reco_truncation
+                             , .lrf_file   = reco_lrf },
+    // Every point of the events lies in the world, centred on the origin,
+    // and no deposit exceeds the energy of the gamma
+    .quantisation          = { .position_resolution = position_resolution
+                             , .position_bits       = fixed_point_bits(position_resolution, largest_coordinate(scint_size()), INT16_MAX)
+                             , .edep_resolution     = edep_resolution
+                             , .edep_bits           = fixed_point_bits(edep_resolution, fixed_energy ? particle_energy_ : HUGE_VAL, UINT16_MAX)
+                             , .count_bits          = count_bits > 0 ? count_bits : auto_count_bits(generator, nphotons) },
+  });
+  validate(*r);
+  return r;
+}
+
+std::shared_ptr<const resolved_config> config::freeze() {
+  std::lock_guard lock{snapshot_mutex};
+  snapshot = resolve();
+  generation_.store(snapshot -> generation, std::memory_order_release);
+  return snapshot;
+}
+
+std::shared_ptr<const resolved_config> config::frozen() {
+  {
+    std::lock_guard lock{snapshot_mutex};
+    if (snapshot) { return snapshot; }
+  }
+  return freeze();
+}
@@ -7,10 +7,20 @@
 #include <G4UnitsTable.hh>
 #include <Randomize.hh>
 
+#include "digitise.hh"
+#include "sampling.hh"
+#include "reconstruction.hh"
+#include "scan.hh"
+#include "summary.hh"
+
 #include <n4-random.hh>
 #include <n4-run-manager.hh>
 
+#include <atomic>
 #include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <unordered_map>
 
@@ -19,6 +29,24 @@ enum class scintillator_type_enum { lyso, bgo, csi, csi_tl };
 enum class config_type_enum       { lyso, bgo, csi, csi_mono };
 enum class reflector_model_enum   { lambertian, specular, lut, davis };
 enum class wrapping_enum          { teflon, esr, none };
+enum class sipm_placement_enum    { individual, parameterised, plane };
+enum class rng_engine_enum        { mixmax, ranlux, ranlux64, mtwist, ranecu, ranshi, james };
+enum class physics_list_enum      { full, lean };
+enum class em_physics_enum        { option4, option3, standard };
+enum class output_format_enum     { automatic, parquet, feather, stream };
+enum class generators             { gammas_from_outside_crystal, photoelectric_electrons, pointlike_photon_source, replay_deposits, scan_positions };
+
+// Fixed-point encodings of the event columns written by `parquet_writer`:
+// values are stored as round(value / resolution), in 16 bits when every
+// value the geometry or the source allows fits, in 32 otherwise. 0 bits
+// means float32, as without quantisation.
+struct quantisation_params {
+  double   position_resolution;
+  unsigned position_bits;       // signed: x, y, z of events and interactions
+  double   edep_resolution;
+  unsigned edep_bits;
+  unsigned count_bits;          // photon_counts: 8, 16 or 32, never 0
+};
 
 struct scint_parameters {
   scintillator_type_enum scint;
@@ -48,9 +76,82 @@ reflector_model_enum string_to_reflector_model_enum(std::string s);
 std::string wrapping_enum_to_string(wrapping_enum s);
 wrapping_enum string_to_wrapping_enum(std::string s);
 
+std::string sipm_placement_enum_to_string(sipm_placement_enum s);
+sipm_placement_enum string_to_sipm_placement_enum(std::string s);
+
+std::string rng_engine_enum_to_string(rng_engine_enum s);
+rng_engine_enum string_to_rng_engine_enum(std::string s);
+
+std::string physics_list_enum_to_string(physics_list_enum s);
+physics_list_enum string_to_physics_list_enum(std::string s);
+
+std::string em_physics_enum_to_string(em_physics_enum s);
+em_physics_enum string_to_em_physics_enum(std::string s);
+
+std::string stop_target_enum_to_string(stop_target_enum s);
+stop_target_enum string_to_stop_target_enum(std::string s);
+
+std::string reco_method_enum_to_string(reco_method_enum s);
+reco_method_enum string_to_reco_method_enum(std::string s);
+
+generators string_to_generator(std::string s);
+
+std::string output_format_enum_to_string(output_format_enum s);
+output_format_enum string_to_output_format_enum(std::string s);
+
+// Immutable, validated view of the config with all derived quantities
+// precomputed. A new one is taken at the start of every run: the
+// generators, sensitive detector and writer read only this, so they
+// neither pay for recomputation nor race with UI commands.
+struct resolved_config {
+  using sampler = alias_sampler;
+
+  unsigned long              generation;
+  scint_parameters           scint_params;
+  G4ThreeVector              scint_size;
+  std::vector<G4ThreeVector> sipm_positions;
+  size_t                     n_sipms;
+  double                      gel_thickness;
+  double                     sipm_thickness;
+  sipm_placement_enum        sipm_placement;
+  bool                       fixed_energy;
+  double                     fixed_particle_energy;
+  std::optional<sampler>     energy_spectrum;
+  size_t                     event_threshold;
+  size_t                      sipm_threshold;
+  int64_t                    chunk_size;
+  std::string                outfile;
+  output_format_enum         output_format;
+  std::string                ipc_compression;
+  bool                       digitise;
+  bool                       digitise_times;
+  digitisation_params        digi_params;
+  unsigned                   n_arrival_times;
+  double                     time_quantile;
+  bool                       sipm_centres;
+  unsigned                   nphotons;
+  std::string                record_deposits;
+  std::string                replay_deposits;
+  bool                       force_interaction;
+  bool                       report_steps;
+  scan_params                scan;
+  std::string                scan_outfile;
+  summary_params             summary;
+  stopping_params            stopping;
+  reco_params                reco;
+  quantisation_params        quantisation;
+
+  double particle_energy() const { return fixed_energy ? fixed_particle_energy : energy_spectrum.value().sample(); }
+  void particle_energies(std::vector<double>& out, size_t n) const {
+    if (fixed_energy) { out.assign(n, fixed_particle_energy); }
+    else              { energy_spectrum.value().sample(out, n); }
+  }
+  bool record_arrival_times() const { return digitise || n_arrival_times > 0; }
+};
+
 struct config {
 private:
-  using sampler = n4::random::piecewise_linear_distribution;
+  using sampler = resolved_config::sampler;
 
   scint_parameters        scint_params_;
   scint_overrides         overrides           =  {};
@@ -59,8 +160,12 @@ public:
   double                  sipm_thickness      =   1    * mm - gel_thickness;
   double                  reflector_thickness =   0.25 * mm;
   wrapping_enum           wrapping            = wrapping_enum::teflon;
+  sipm_placement_enum     sipm_placement      = sipm_placement_enum::individual;
   int                     physics_verbosity   =   0;
+  physics_list_enum       physics_list        = physics_list_enum::full;
+  em_physics_enum         em_physics          = em_physics_enum::option4;
   long                    seed                = 123456789;
+  rng_engine_enum         rng_engine          = rng_engine_enum::mixmax;
   bool                    debug               = false ;
   std::optional<G4double> scint_yield         = std::nullopt;
   reflector_model_enum    reflector_model     = reflector_model_enum::lambertian;
@@ -73,6 +178,88 @@ public:
   std::string             outfile             = "crystal-out.parquet";
   int64_t                 chunk_size          = 1024; // TODO find out what chuck_size default should be
   std::string             compression         = "brotli";
+  // auto: feather for .arrow and .feather, stream for .arrows and named
+  // pipes, parquet otherwise
+  output_format_enum      output_format       = output_format_enum::automatic;
+  std::string             ipc_compression     = "none"; // none, lz4 or zstd
+  // How output files are read back, by the readers in io.hh
+  bool                    read_memory_map     = true;
+  bool                    read_threads        = true;  // decode columns in parallel
+  bool                    read_pre_buffer     = true;  // coalesce the reads of column chunks
+  bool                    digitise            = false;
+  bool                    digitise_times      = false;
+  double                  microcell_pitch     =  25    * um;
+  double                  microcell_recovery  =  50    * ns;
+  double                  crosstalk_prob      =   0.1;
+  double                  afterpulse_prob     =   0.05;
+  double                  afterpulse_tau      =  20    * ns;
+  double                  dark_count_rate     = 100    * kilohertz / mm2;
+  double                  digitisation_window = 500    * ns;
+  unsigned                n_arrival_times     = 0;
+  double                  time_quantile       = 0.1;
+  // Generator settings, under /source/
+  bool                    sipm_centres        = true;
+  unsigned                nphotons            = 1'000;
+  std::string             replay_deposits     = "";    // read by the replay generator
+  // Stage 1 of a two-stage simulation: write crystal deposits to this
+  // file and do not generate optical photons. Empty means disabled.
+  std::string             record_deposits     = "";
+  // Variance reduction: gammas are forced to interact in the crystal and
+  // events are written with the corresponding weight
+  bool                    force_interaction   = false;
+  // Scan generator: grid of source positions, under /source/, and
+  // the binning of the per-SiPM count histograms written for each one
+  unsigned                scan_nx             =   1;
+  unsigned                scan_ny             =   1;
+  unsigned                scan_nz             =   1;
+  unsigned                scan_events         = 100;
+  unsigned                scan_hist_bins      = 100;
+  double                  scan_hist_max       = 1000;
+  std::string             scan_outfile        = "crystal-scan.parquet";
+  // Run summary: accumulated while the events are stored and written
+  // next to `outfile` at the end of the run
+  bool                    summary             = false;
+  unsigned                summary_bins        = 100;
+  double                  summary_sipm_max    =  1'000;
+  double                  summary_total_max   = 10'000;
+  // Early stopping: the run is aborted once the target statistic is
+  // known to `stop_rel_error`, checked every `stop_check_every` events
+  stop_target_enum        stop_when           = stop_target_enum::none;
+  double                  stop_rel_error      = 0.01;
+  unsigned                stop_check_every    = 100;
+  unsigned                stop_min_events     = 100;
+  // Position reconstruction from the photon counts, written as the
+  // reco_x, reco_y and reco_doi columns
+  reco_method_enum        reco                = reco_method_enum::none;
+  double                  reco_truncation     = 0.2;
+  std::string             reco_lrf            = "";    // scan file, for ml
+  // Fixed-point positions and energy deposits, 0: float32. Counts take
+  // `count_bits`; 0 (auto) narrows them only when the generator bounds
+  // them, and keeps 32 otherwise. A count which does not fit in a width
+  // set by hand stops the run, rather than dropping the event.
+  double                  position_resolution =   0;
+  double                  edep_resolution     =   0;
+  unsigned                count_bits          =   0;
+  // Production cuts and step limits. The crystal and the readout (gel and
+  // SiPMs) are regions of their own, so electron tracking there can be
+  // traded for speed independently of the world and wrapping, which use
+  // `default_cut` and can take a coarse one
+  double                  default_cut         =   0.7  * mm;
+  double                  crystal_cut         =   0.7  * mm;
+  double                  readout_cut         =   0.7  * mm;
+  double                  crystal_max_step    =   0;    // charged particles in the crystal; 0: unlimited
+  bool                    report_steps        = false; // steps per volume and particle, printed at the end of each run
+  // Optical physics. Each active process proposes a step length on every
+  // optical photon step, so unneeded ones are worth switching off.
+  // Processes not mentioned keep the Geant4 default.
+  std::map<std::string, bool> optical_processes   = {};
+  int                     cerenkov_max_photons = 100;   // per step
+  bool                    track_secondaries_first = true;
+  // Needs per-particle yields (ELECTRONSCINTILLATIONYIELD, ...) in the crystal material
+  bool                    scint_by_particle_type  = false;
+  // Physics tables are stored here after being built, and read back by
+  // later jobs with the same physics, cuts and materials. Empty: disabled.
+  std::string             physics_table_cache = "";
 
   config();
 
@@ -81,14 +268,33 @@ public:
   const std::vector<G4ThreeVector>& sipm_positions() const;
   const scint_parameters scint_params() const;
   size_t n_sipms() const;
+  bool record_arrival_times() const { return digitise || n_arrival_times > 0; }
   std::unordered_map<std::string, std::string> as_map();
-  std::unordered_map<std::string, std::string> cli_args() {return n4::run_manager::get_ui().arg_map();}
+
+  // Builds a new snapshot without publishing it
+  std::shared_ptr<const resolved_config> resolve() const;
+  // Publishes a new snapshot: done at the start of every run
+  std::shared_ptr<const resolved_config> freeze();
+  // The most recently published snapshot; published now if there is none yet
+  std::shared_ptr<const resolved_config> frozen();
+  unsigned long generation() const { return generation_.load(std::memory_order_acquire); }
+  // Empty when there is no run manager, e.g. when only doing I/O
+  std::unordered_map<std::string, std::string> cli_args() {
+    if (! n4::run_manager::available()) { return {}; }
+    return n4::run_manager::get_ui().arg_map();
+  }
 
 private:
 
   void set_config_type    (const std::string& s);
   void set_reflector_model(const std::string& s) { reflector_model = string_to_reflector_model_enum(s); }
   void set_wrapping       (const std::string& s) { wrapping  = string_to_wrapping_enum(s) ; }
+  void set_sipm_placement (const std::string& s) { sipm_placement = string_to_sipm_placement_enum(s); }
+  void set_physics_list   (const std::string& s) { physics_list   = string_to_physics_list_enum(s); }
+  void set_em_physics     (const std::string& s) { em_physics     = string_to_em_physics_enum(s); }
+  void set_stop_when      (const std::string& s) { stop_when      = string_to_stop_target_enum(s); }
+  void set_reco           (const std::string& s) { reco           = string_to_reco_method_enum(s); }
+  void set_output_format  (const std::string& s) { output_format  = string_to_output_format_enum(s); }
   void set_scint          (const std::string& s) { overrides.scint = string_to_scintillator_type(s); }
   void set_scint_depth    (double   d)           { overrides.scint_depth = d; }
   void set_particle_energy(double   e)           { particle_energy_ = e; }
@@ -98,17 +304,43 @@ private:
   void set_sipm_size      (double   d)           { overrides.sipm_size   = d; sipm_positions_need_recalculating = true; }
 
   void set_scint_yield(double   y) { scint_yield = y; }
-  void set_random_seed(long  seed) { G4Random::setTheSeed(seed); }
+  void set_random_seed(long  seed) { this -> seed = seed; G4Random::setTheSeed(seed); }
+  void set_rng_engine (const std::string& s);
   void set_reflectivity(double  r) { reflectivity = r; }
+  void   enable_optical_process(const std::string& s) { optical_processes[checked_optical_process(s)] = true ; }
+  void  disable_optical_process(const std::string& s) { optical_processes[checked_optical_process(s)] = false; }
+  static const std::string& checked_optical_process(const std::string& s);
   G4GenericMessenger* msg;
+  G4GenericMessenger* source_msg;
 
   double                             particle_energy_ = 511 * keV;
   mutable std::optional<sampler>     energy_spectrum  = {};
   mutable std::vector<G4ThreeVector> sipm_positions_;
   mutable bool                       sipm_positions_need_recalculating = true;
   void recalculate_sipm_positions() const;
+
+  std::mutex                             snapshot_mutex;
+  std::shared_ptr<const resolved_config> snapshot;
+  std::atomic<unsigned long>             generation_ = 0;
 };
 
 extern config my;
 
+// Handle on the frozen config for code which runs many times per run:
+// it only goes back to `my` when a new snapshot has been published.
+class frozen_config {
+public:
+  const resolved_config& get() {
+    if (! snapshot || snapshot -> generation != my.generation()) { snapshot = my.frozen(); }
+    return *snapshot;
+  }
+  const resolved_config* operator->() { return &get(); }
+private:
+  std::shared_ptr<const resolved_config> snapshot;
+};
+
+// Full lengths of the world volume around a crystal of `scint_size`
+G4ThreeVector world_size(const G4ThreeVector& scint_size);
+
 G4Material* scintillator_material(scintillator_type_enum type);
+alias_sampler scint_spectrum(scintillator_type_enum type);
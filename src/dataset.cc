@@ -0,0 +1,217 @@
+#include "dataset.hh"
+#include "io.hh"
+
+#include <parquet/arrow/reader.h>
+#include <parquet/file_reader.h>
+
+#include <glob.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+// Metadata entries which may differ between the files of a dataset
+static bool is_per_file_metadata(const std::string& key) {
+  static const std::vector<std::string> keys { "seed", "outfile", "output_format", "ipc_compression", "chunk_size"
+                                             , "physics_table_cache", "physics_verbosity", "debug", "record_deposits" };
+  return key.starts_with("-")       // CLI arguments
+      || key.starts_with("commit-") // git
+      || key.starts_with("ARROW:")  // Arrow schema
+      || std::find(begin(keys), end(keys), key) != end(keys);
+}
+
+static arrow::Result<std::vector<std::string>> expand(const std::string& spec) {
+  std::vector<std::string> out;
+  if (fs::is_directory(spec)) {
+    for (const auto& entry: fs::directory_iterator{spec}) {
+      if (entry.is_regular_file() && entry.path().extension() == ".parquet") { out.push_back(entry.path().string()); }
+    }
+    std::sort(begin(out), end(out));
+  } else {
+    glob_t matches;
+    auto status = glob(spec.c_str(), 0, nullptr, &matches); // Sorted
+    if (status == 0) { out.assign(matches.gl_pathv, matches.gl_pathv + matches.gl_pathc); }
+    globfree(&matches);
+  }
+  if (out.empty()) { return arrow::Status::Invalid("No parquet files match ", spec); }
+  return out;
+}
+
+arrow::Result<dataset> dataset::open(const std::string& spec) {
+  ARROW_ASSIGN_OR_RAISE(auto paths, expand(spec));
+
+  dataset out;
+  for (const auto& path: paths) {
+    ARROW_ASSIGN_OR_RAISE(auto format, file_format(path));
+    if (format != output_format_enum::parquet) { return arrow::Status::Invalid(path, " is not a parquet file"); }
+
+    ARROW_ASSIGN_OR_RAISE(auto reader, open_parquet(path));
+    std::shared_ptr<arrow::Schema> schema;
+    ARROW_RETURN_NOT_OK(reader -> GetSchema(&schema));
+    auto footer = reader -> parquet_reader() -> metadata();
+    std::unordered_map<std::string, std::string> meta;
+    if (footer -> key_value_metadata()) { footer -> key_value_metadata() -> ToUnorderedMap(&meta); }
+
+    if (out.files_.empty()) {
+      out.stored_schema_ = schema;
+      out.metadata_      = std::move(meta);
+    } else {
+      const auto& first = out.files_.front().path;
+      if (! schema -> Equals(*out.stored_schema_, /*check_metadata =*/ false)) {
+        return arrow::Status::Invalid("Columns of ", path, " differ from those of ", first);
+      }
+      // Both ways round, so that settings present in only one file are caught too
+      for (const auto& [a, b]: {std::pair{&meta, &out.metadata_}, std::pair{&out.metadata_, &meta}}) {
+        for (const auto& [key, value]: *a) {
+          if (is_per_file_metadata(key)) { continue; }
+          auto found = b -> find(key);
+          if (found == b -> end() || found -> second != value) {
+            return arrow::Status::Invalid("Config of ", path, " differs from that of ", first, " in '", key, "'");
+          }
+        }
+      }
+    }
+    out.files_.push_back({path, footer});
+  }
+  ARROW_ASSIGN_OR_RAISE(out.schema_, dequantised_schema(out.stored_schema_));
+  return out;
+}
+
+std::vector<std::string> dataset::files() const {
+  std::vector<std::string> out;
+  for (const auto& f: files_) { out.push_back(f.path); }
+  return out;
+}
+
+int64_t dataset::num_rows() const {
+  int64_t n = 0;
+  for (const auto& f: files_) { n += f.footer -> num_rows(); }
+  return n;
+}
+
+// A fixed pool of threads decodes row groups in file order, fixed-point
+// columns included; the window
+// between the next batch to be returned and the next one to be claimed
+// bounds both the memory held and how far the workers run ahead
+class dataset_scanner : public arrow::RecordBatchReader {
+public:
+  struct task {
+    const dataset::file* file;
+    int                  row_group;
+  };
+
+  dataset_scanner(std::vector<dataset::file> files, std::shared_ptr<arrow::Schema> stored_schema, std::shared_ptr<arrow::Schema> schema,
+                  std::vector<int> columns, unsigned n_threads, unsigned prefetch)
+    : files{std::move(files)}, stored_schema{std::move(stored_schema)}, schema_{std::move(schema)}, columns{std::move(columns)}
+    , window{n_threads + prefetch}
+  {
+    for (const auto& f: this -> files) {
+      for (int g=0; g<f.footer -> num_row_groups(); g++) { tasks.push_back({&f, g}); }
+    }
+    results.resize(tasks.size());
+    for (unsigned t=0; t<n_threads; t++) { workers.emplace_back([this] { work(); }); }
+  }
+
+  ~dataset_scanner() override {
+    { std::lock_guard lock{mutex}; stop = true; }
+    room.notify_all();
+    for (auto& w: workers) { w.join(); }
+  }
+
+  std::shared_ptr<arrow::Schema> schema() const override { return schema_; }
+
+  arrow::Status ReadNext(std::shared_ptr<arrow::RecordBatch>* batch) override {
+    if (next_result == tasks.size()) { *batch = nullptr; return arrow::Status::OK(); }
+    std::unique_lock lock{mutex};
+    ready.wait(lock, [&] { return results[next_result].has_value(); });
+    auto result = std::move(results[next_result].value());
+    results[next_result].reset();
+    next_result++;
+    lock.unlock();
+    room.notify_all();
+    ARROW_ASSIGN_OR_RAISE(*batch, std::move(result));
+    return arrow::Status::OK();
+  }
+
+private:
+  arrow::Result<std::shared_ptr<arrow::RecordBatch>> read(const task& t) const {
+    ARROW_ASSIGN_OR_RAISE(auto reader, open_parquet(t.file -> path, t.file -> footer));
+    auto row_group = reader -> RowGroup(t.row_group);
+    std::vector<std::shared_ptr<arrow::ChunkedArray>> arrays;
+    for (auto c: columns) {
+      std::shared_ptr<arrow::ChunkedArray> array;
+      ARROW_RETURN_NOT_OK(row_group -> Column(c) -> Read(&array));
+      arrays.push_back(array);
+    }
+    ARROW_ASSIGN_OR_RAISE(auto batch, arrow::Table::Make(stored_schema, arrays) -> CombineChunksToBatch());
+    return dequantise(batch);
+  }
+
+  void work() {
+    while (true) {
+      size_t t;
+      {
+        std::unique_lock lock{mutex};
+        room.wait(lock, [&] { return stop || next_task == tasks.size() || next_task < next_result + window; });
+        if (stop || next_task == tasks.size()) { return; }
+        t = next_task++;
+      }
+      auto batch = read(tasks[t]);
+      { std::lock_guard lock{mutex}; results[t] = std::move(batch); }
+      ready.notify_all();
+    }
+  }
+
+  std::vector<dataset::file>     files;
+  std::shared_ptr<arrow::Schema> stored_schema;
+  std::shared_ptr<arrow::Schema> schema_;
+  std::vector<int>               columns;
+  size_t                         window;
+  std::vector<task>              tasks;
+
+  std::mutex              mutex;
+  std::condition_variable ready, room;
+  bool                    stop        = false;
+  size_t                  next_task   = 0; // next to be claimed by a worker
+  size_t                  next_result = 0; // next to be returned
+  std::vector<std::optional<arrow::Result<std::shared_ptr<arrow::RecordBatch>>>> results;
+  std::vector<std::thread> workers;
+};
+
+arrow::Result<std::shared_ptr<arrow::RecordBatchReader>> dataset::scan(
+  const std::vector<std::string>& columns, unsigned n_threads, unsigned prefetch) const
+{
+  std::vector<int>                           indices;
+  std::vector<std::shared_ptr<arrow::Field>> fields;
+  if (columns.empty()) {
+    for (int i=0; i<stored_schema_ -> num_fields(); i++) { indices.push_back(i); }
+    fields = stored_schema_ -> fields();
+  }
+  for (const auto& name: columns) {
+    auto i = stored_schema_ -> GetFieldIndex(name);
+    if (i < 0) { return arrow::Status::Invalid("No column '", name, "' in the dataset"); }
+    indices.push_back(i);
+    fields .push_back(stored_schema_ -> field(i));
+  }
+  if (n_threads == 0) { n_threads = std::max(std::thread::hardware_concurrency(), 1u); }
+
+  auto stored_schema = std::make_shared<arrow::Schema>(fields, stored_schema_ -> metadata());
+  ARROW_ASSIGN_OR_RAISE(auto schema, dequantised_schema(stored_schema));
+  return std::make_shared<dataset_scanner>(files_, stored_schema, schema, indices, n_threads, prefetch);
+}
+
+arrow::Result<std::shared_ptr<arrow::Table>> dataset::read_table(const std::vector<std::string>& columns, unsigned n_threads) const {
+  ARROW_ASSIGN_OR_RAISE(auto scanner, scan(columns, n_threads));
+  std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+  for (std::shared_ptr<arrow::RecordBatch> batch;;) {
+    ARROW_RETURN_NOT_OK(scanner -> ReadNext(&batch));
+    if (! batch) { break; }
+    batches.push_back(batch);
+  }
+  return arrow::Table::FromRecordBatches(scanner -> schema(), batches);
+}
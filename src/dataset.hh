@@ -0,0 +1,49 @@
+#pragma once
+
+#include <arrow/api.h>
+#include <parquet/metadata.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Many parquet files written by `parquet_writer` with the same
+// configuration (sharded or rotated runs), read as if they were one.
+// Only their footers are read when the dataset is opened.
+class dataset {
+public:
+  // `spec` is a directory, whose .parquet files are taken in name order, a
+  // glob pattern, or a single file
+  static arrow::Result<dataset> open(const std::string& spec);
+
+  std::vector<std::string>       files   () const;
+  int64_t                        num_rows() const;
+  // As read: fixed-point columns (see `dequantise`) come out as float32
+  // and uint32
+  std::shared_ptr<arrow::Schema> schema  () const { return schema_; }
+  // Config metadata shared by every file; per-file entries such as the
+  // seed, output file or git commit are those of the first file
+  const std::unordered_map<std::string, std::string>& metadata() const { return metadata_; }
+
+  // Streams the row groups of every file, in order, as record batches with
+  // only the given `columns` (all of them when empty). Up to `n_threads`
+  // (0: one per core) row groups are decoded at once, running at most
+  // `prefetch` batches ahead of the consumer.
+  arrow::Result<std::shared_ptr<arrow::RecordBatchReader>> scan(
+    const std::vector<std::string>& columns = {}, unsigned n_threads = 0, unsigned prefetch = 2) const;
+  arrow::Result<std::shared_ptr<arrow::Table>> read_table(
+    const std::vector<std::string>& columns = {}, unsigned n_threads = 0) const;
+
+  struct file {
+    std::string                            path;
+    std::shared_ptr<parquet::FileMetaData> footer;
+  };
+
+private:
+  std::vector<file>                            files_;
+  std::shared_ptr<arrow::Schema>               stored_schema_;
+  std::shared_ptr<arrow::Schema>               schema_;
+  std::unordered_map<std::string, std::string> metadata_;
+};
@@ -0,0 +1,177 @@
+#include "deposits.hh"
+#include "io.hh"
+
+#include <n4-random.hh>
+
+#include <G4Material.hh>
+#include <G4MaterialPropertiesTable.hh>
+#include <G4Poisson.hh>
+#include <Randomize.hh>
+
+#include <arrow/io/api.h>
+
+#include <parquet/arrow/reader.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+const bool NOT_NULLABLE = false;
+
+auto deposit_type = arrow::struct_({
+  arrow::field("x"   , arrow::float32(), NOT_NULLABLE),
+  arrow::field("y"   , arrow::float32(), NOT_NULLABLE),
+  arrow::field("z"   , arrow::float32(), NOT_NULLABLE),
+  arrow::field("t"   , arrow::float32(), NOT_NULLABLE),
+  arrow::field("edep", arrow::float32(), NOT_NULLABLE),
+  arrow::field("pdg" , arrow::  int32(), NOT_NULLABLE),
+});
+
+std::shared_ptr<arrow::Schema> deposit_schema() {
+  return std::make_shared<arrow::Schema>(
+    std::vector<std::shared_ptr<arrow::Field>>{
+      arrow::field("x", arrow::float32(), NOT_NULLABLE),
+      arrow::field("y", arrow::float32(), NOT_NULLABLE),
+      arrow::field("z", arrow::float32(), NOT_NULLABLE),
+      arrow::field("deposits", arrow::list(arrow::field("deposit", deposit_type, NOT_NULLABLE)), NOT_NULLABLE),
+    },
+    metadata());
+}
+
+auto make_deposit_builder(arrow::MemoryPool* pool) {
+  std::vector<std::shared_ptr<arrow::ArrayBuilder>> vec_of_builders {
+    std::make_shared<arrow::FloatBuilder>(pool),
+    std::make_shared<arrow::FloatBuilder>(pool),
+    std::make_shared<arrow::FloatBuilder>(pool),
+    std::make_shared<arrow::FloatBuilder>(pool),
+    std::make_shared<arrow::FloatBuilder>(pool),
+    std::make_shared<arrow::Int32Builder>(pool)
+  };
+  return std::make_shared<arrow::StructBuilder>(deposit_type, pool, vec_of_builders);
+}
+
+deposit_writer::deposit_writer(const std::string& filename, int64_t chunk_size) :
+  chunk_size      {chunk_size}
+, pool            {arrow::default_memory_pool()}
+, x_builder       {std::make_shared<arrow::FloatBuilder>(pool)}
+, y_builder       {std::make_shared<arrow::FloatBuilder>(pool)}
+, z_builder       {std::make_shared<arrow::FloatBuilder>(pool)}
+, deposits_builder{std::make_shared<arrow::ListBuilder>(pool, make_deposit_builder(pool), deposit_type)}
+, schema          {deposit_schema()}
+, writer          {make_writer(schema, pool, filename)}
+{}
+
+deposit_writer::~deposit_writer() {
+  arrow::Status status;
+  status = write();           if (! status.ok()) { std::cerr << "\nCould not write deposits "             << status.ToString() << std::endl; }
+  status = writer -> Close(); if (! status.ok()) { std::cerr << "\nCould not close the deposits file "    << status.ToString() << std::endl; }
+}
+
+arrow::Status deposit_writer::append(const G4ThreeVector& primary_pos, const std::vector<deposit>& deposits) {
+  ARROW_RETURN_NOT_OK(x_builder        -> Append(primary_pos.x()));
+  ARROW_RETURN_NOT_OK(y_builder        -> Append(primary_pos.y()));
+  ARROW_RETURN_NOT_OK(z_builder        -> Append(primary_pos.z()));
+  ARROW_RETURN_NOT_OK(deposits_builder -> Append());
+
+  auto deposit_builder = static_cast<arrow::StructBuilder*>(deposits_builder -> value_builder());
+  auto dx_builder = static_cast<arrow::FloatBuilder*>(deposit_builder -> field_builder(0));
+  auto dy_builder = static_cast<arrow::FloatBuilder*>(deposit_builder -> field_builder(1));
+  auto dz_builder = static_cast<arrow::FloatBuilder*>(deposit_builder -> field_builder(2));
+  auto dt_builder = static_cast<arrow::FloatBuilder*>(deposit_builder -> field_builder(3));
+  auto de_builder = static_cast<arrow::FloatBuilder*>(deposit_builder -> field_builder(4));
+  auto dp_builder = static_cast<arrow::Int32Builder*>(deposit_builder -> field_builder(5));
+
+  for (const auto& d: deposits) {
+    ARROW_RETURN_NOT_OK(deposit_builder -> Append());
+    ARROW_RETURN_NOT_OK(dx_builder -> Append(d.x));
+    ARROW_RETURN_NOT_OK(dy_builder -> Append(d.y));
+    ARROW_RETURN_NOT_OK(dz_builder -> Append(d.z));
+    ARROW_RETURN_NOT_OK(dt_builder -> Append(d.t));
+    ARROW_RETURN_NOT_OK(de_builder -> Append(d.edep));
+    ARROW_RETURN_NOT_OK(dp_builder -> Append(d.pdg));
+  }
+
+  n_rows++;
+  return n_rows == chunk_size ? write() : arrow::Status::OK();
+}
+
+arrow::Status deposit_writer::write() {
+  std::vector<std::shared_ptr<arrow::Array>> arrays;
+  ARROW_ASSIGN_OR_RAISE(auto x_array, x_builder        -> Finish()); arrays.push_back(x_array);
+  ARROW_ASSIGN_OR_RAISE(auto y_array, y_builder        -> Finish()); arrays.push_back(y_array);
+  ARROW_ASSIGN_OR_RAISE(auto z_array, z_builder        -> Finish()); arrays.push_back(z_array);
+  ARROW_ASSIGN_OR_RAISE(auto d_array, deposits_builder -> Finish()); arrays.push_back(d_array);
+  auto table = arrow::Table::Make(schema, arrays);
+  ARROW_RETURN_NOT_OK(writer -> WriteTable(*table, n_rows));
+  n_rows = 0;
+  return arrow::Status::OK();
+}
+
+arrow::Result<std::vector<deposit_event>> read_deposits(const std::string& filename) {
+  std::shared_ptr<arrow::Table> table;
+  ARROW_ASSIGN_OR_RAISE(auto reader, open_parquet(filename));
+  ARROW_RETURN_NOT_OK  (reader -> ReadTable(&table));
+
+  if (! table -> schema() -> Equals(*deposit_schema(), /*check_metadata =*/ false)) {
+    return arrow::Status::Invalid("Not a deposits file: ", filename);
+  }
+
+  ARROW_ASSIGN_OR_RAISE(auto batch, table -> CombineChunksToBatch());
+  auto columns = batch -> columns();
+  const auto* x = columns[0] -> data() -> GetValues<float>(1);
+  const auto* y = columns[1] -> data() -> GetValues<float>(1);
+  const auto* z = columns[2] -> data() -> GetValues<float>(1);
+
+  const auto  deposits_list   = static_pointer_cast<arrow::  ListArray>(columns[3]);
+  const auto  deposits_fields = static_pointer_cast<arrow::StructArray>(deposits_list -> values()) -> fields();
+  const auto* d_x    = deposits_fields[0] -> data() -> GetValues<float  >(1);
+  const auto* d_y    = deposits_fields[1] -> data() -> GetValues<float  >(1);
+  const auto* d_z    = deposits_fields[2] -> data() -> GetValues<float  >(1);
+  const auto* d_t    = deposits_fields[3] -> data() -> GetValues<float  >(1);
+  const auto* d_edep = deposits_fields[4] -> data() -> GetValues<float  >(1);
+  const auto* d_pdg  = deposits_fields[5] -> data() -> GetValues<int32_t>(1);
+
+  std::vector<deposit_event> events;
+  events.reserve(table -> num_rows());
+  for (auto row=0; row < table -> num_rows(); row++) {
+    deposit_event event{{x[row], y[row], z[row]}, {}};
+    for (auto i = deposits_list -> value_offset(row    ) ;
+              i < deposits_list -> value_offset(row + 1) ;
+            ++i                                           )
+    {
+      event.deposits.push_back({d_x[i], d_y[i], d_z[i], d_t[i], d_edep[i], d_pdg[i]});
+    }
+    events.push_back(std::move(event));
+  }
+  return events;
+}
+
+scintillation_params scintillation_params_of(const G4Material* material) {
+  auto mpt = material -> GetMaterialPropertiesTable();
+  auto get = [mpt] (const char* key, double fallback) {
+    return mpt && mpt -> ConstPropertyExists(key) ? mpt -> GetConstProperty(key) : fallback;
+  };
+  return {
+    .yield            = get("SCINTILLATIONYIELD"        , 0),
+    .resolution_scale = get("RESOLUTIONSCALE"           , 1),
+    .decay_time       = get("SCINTILLATIONTIMECONSTANT1", 0),
+    .rise_time        = get("SCINTILLATIONRISETIME1"    , 0),
+  };
+}
+
+unsigned n_scintillation_photons(double edep, const scintillation_params& p) {
+  // Same fluctuations as G4Scintillation
+  auto mean = p.yield * edep;
+  if (mean > 10) {
+    auto sigma = p.resolution_scale * std::sqrt(mean);
+    return static_cast<unsigned>(std::max(G4RandGauss::shoot(mean, sigma) + 0.5, 0.0));
+  }
+  return G4Poisson(mean);
+}
+
+double scintillation_delay(const scintillation_params& p) {
+  auto decay = [] (double tau) { return tau > 0 ? -tau * std::log(n4::random::uniform()) : 0; };
+  if (p.rise_time <= 0) { return decay(p.decay_time); }
+  // Bi-exponential: the sum of the rise and decay delays has exactly this shape
+  return decay(p.rise_time) + decay(p.decay_time);
+}
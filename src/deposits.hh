@@ -0,0 +1,70 @@
+#pragma once
+
+#include "config.hh"
+
+#include <G4ThreeVector.hh>
+
+#include <arrow/api.h>
+#include <parquet/arrow/writer.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class G4Material;
+
+// Energy deposited in the crystal by one step of a charged particle.
+// Recorded in the first stage of a two-stage simulation, so that the
+// optical response of many configurations can be obtained from the same
+// gamma transport.
+struct deposit {
+  float x, y, z; // middle of the step
+  float t;       // global time at the middle of the step
+  float edep;
+  int32_t pdg;   // of the particle making the step
+};
+
+struct deposit_event {
+  G4ThreeVector        primary_pos;
+  std::vector<deposit> deposits;
+};
+
+class deposit_writer {
+public:
+  deposit_writer(const std::string& filename, int64_t chunk_size);
+  ~deposit_writer();
+
+  arrow::Status append(const G4ThreeVector& primary_pos, const std::vector<deposit>& deposits);
+  arrow::Status write();
+
+private:
+  int64_t chunk_size;
+  arrow::MemoryPool* pool;
+  std::shared_ptr<arrow::FloatBuilder>        x_builder;
+  std::shared_ptr<arrow::FloatBuilder>        y_builder;
+  std::shared_ptr<arrow::FloatBuilder>        z_builder;
+  std::shared_ptr<arrow::ListBuilder>         deposits_builder;
+  std::shared_ptr<arrow::Schema>              schema;
+  std::unique_ptr<parquet::arrow::FileWriter> writer;
+
+  int64_t n_rows = 0;
+};
+
+arrow::Result<std::vector<deposit_event>> read_deposits(const std::string& filename);
+
+// What G4Scintillation needs to turn deposits into photons, taken from
+// the material of the crystal in the current geometry
+struct scintillation_params {
+  double yield;            // photons per unit energy
+  double resolution_scale;
+  double decay_time;
+  double rise_time;        // zero if the material has none
+};
+
+scintillation_params scintillation_params_of(const G4Material* material);
+
+// Number of photons emitted by the deposit, as sampled by G4Scintillation
+unsigned n_scintillation_photons(double edep, const scintillation_params&);
+// Emission delay with respect to the deposit
+double scintillation_delay(const scintillation_params&);
@@ -0,0 +1,86 @@
+#include "config.hh"
+#include "digitise.hh"
+
+#include <n4-random.hh>
+
+#include <G4Poisson.hh>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <queue>
+
+digitisation_params digitisation_params_from_config() {
+  auto sipm_size = my.scint_params().sipm_size;
+  auto per_side  = static_cast<unsigned>(sipm_size / my.microcell_pitch);
+  return {
+    .n_microcells    = std::max(per_side * per_side, 1u),
+    .crosstalk_prob  = my.crosstalk_prob,
+    .afterpulse_prob = my.afterpulse_prob,
+    .afterpulse_tau  = my.afterpulse_tau,
+    .recovery_time   = my.microcell_recovery,
+    .dark_count_rate = my.dark_count_rate * sipm_size * sipm_size,
+    .window          = my.digitisation_window,
+  };
+}
+
+struct avalanche {
+  double   t;
+  unsigned cell;
+  bool operator>(const avalanche& other) const { return t > other.t; }
+};
+
+std::pair<float, float> digitise_sipm(const std::vector<double>& arrival_times, const digitisation_params& p) {
+  auto random_cell = [&p] { return std::min(static_cast<unsigned>(n4::random::uniform() * p.n_microcells), p.n_microcells - 1); };
+
+  // Avalanches are processed in time order, as the charge of each one
+  // depends on how long ago its microcell last fired
+  std::priority_queue<avalanche, std::vector<avalanche>, std::greater<avalanche>> pending;
+  for (auto t: arrival_times) { pending.push({t, random_cell()}); }
+
+  auto n_dark = G4Poisson(p.dark_count_rate * p.window);
+  for (G4long i=0; i<n_dark; i++) { pending.push({n4::random::uniform(0, p.window), random_cell()}); }
+
+  std::unordered_map<unsigned, double> last_fired;
+  last_fired.reserve(pending.size());
+
+  float charge = 0;
+  float first  = std::numeric_limits<float>::quiet_NaN();
+  while (! pending.empty()) {
+    auto [t, cell] = pending.top();
+    pending.pop();
+    if (t < 0 || t > p.window) { continue; }
+
+    // A microcell which has not fully recovered produces a smaller pulse
+    auto previous  = last_fired.find(cell);
+    auto amplitude = previous == last_fired.end() ? 1.0 : -std::expm1(-(t - previous -> second) / p.recovery_time);
+    last_fired[cell] = t;
+
+    charge += amplitude;
+    if (std::isnan(first)) { first = t; }
+
+    // Secondary avalanches may themselves trigger further ones
+    if (n4::random::uniform() < p.crosstalk_prob ) { pending.push({t, random_cell()}); }
+    if (n4::random::uniform() < p.afterpulse_prob) {
+      pending.push({t - p.afterpulse_tau * std::log(n4::random::uniform()), cell});
+    }
+  }
+  return {charge, first};
+}
+
+digitised_event digitise( const std::unordered_map<size_t, std::vector<double>>& arrival_times
+                        , size_t n_sipms
+                        , const digitisation_params& params) {
+  static const std::vector<double> no_photons;
+  digitised_event out;
+  out.charge.reserve(n_sipms);
+  out.time  .reserve(n_sipms);
+  for (size_t n=0; n<n_sipms; n++) {
+    auto found = arrival_times.find(n);
+    auto [charge, time] = digitise_sipm(found == arrival_times.end() ? no_photons : found -> second, params);
+    out.charge.push_back(charge);
+    out.time  .push_back(time);
+  }
+  return out;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct digitisation_params {
+  unsigned n_microcells;
+  double   crosstalk_prob;
+  double   afterpulse_prob;
+  double   afterpulse_tau;
+  double   recovery_time;
+  double   dark_count_rate; // per SiPM, not per unit area
+  double   window;
+};
+
+// Digitised output of all SiPMs in one event, indexed by SiPM copy number
+struct digitised_event {
+  std::vector<float> charge; // in photoelectrons
+  std::vector<float> time;   // of first avalanche in window; NaN if none
+};
+
+digitisation_params digitisation_params_from_config();
+
+// Response of a single SiPM to the given photon arrival times
+std::pair<float, float> digitise_sipm(const std::vector<double>& arrival_times, const digitisation_params&);
+
+// Response of every SiPM, including those which detected no photons,
+// as they can still produce dark counts
+digitised_event digitise( const std::unordered_map<size_t, std::vector<double>>& arrival_times
+                        , size_t n_sipms
+                        , const digitisation_params&);
@@ -12,11 +12,23 @@
 #include <n4-sequences.hh>
 #include <n4-shape.hh>
 
+#include <G4BOptrForceCollision.hh>
 #include <G4Colour.hh>
 
 #include <G4OpticalSurface.hh>
 #include <G4LogicalBorderSurface.hh>
+#include <G4NavigationHistory.hh>
+#include <G4PVParameterised.hh>
+#include <G4ProductionCuts.hh>
+#include <G4Region.hh>
+#include <G4RegionStore.hh>
 #include <G4TrackStatus.hh>
+#include <G4UserLimits.hh>
+#include <G4VPVParameterisation.hh>
+#include <G4VTouchable.hh>
+
+#include <algorithm>
+#include <cmath>
 
 G4Colour       bgo_colour{0.9, 0.6, 0.1, 0.3};
 G4Colour       csi_colour{0.0, 0.0, 0.6, 0.3};
@@ -84,6 +96,50 @@ G4OpticalSurface* make_reflector_optical_surface() {
   return reflector_surface;
 }
 
+size_t sipm_channel_at(double x, double y, const scint_parameters& params) {
+  auto index = [size = params.sipm_size] (double u, unsigned n) -> size_t {
+    auto i = static_cast<long>(std::floor(u / size + n / 2.0));
+    return std::clamp<long>(i, 0, n - 1);
+  };
+  return index(x, params.n_sipms_x) * params.n_sipms_y + index(y, params.n_sipms_y);
+}
+
+// Places all SiPMs as a single physical volume, avoiding one
+// G4PVPlacement per SiPM in large matrices
+class sipm_parameterisation : public G4VPVParameterisation {
+public:
+  sipm_parameterisation(std::vector<G4ThreeVector> positions) : positions{std::move(positions)} {}
+  void ComputeTransformation(const G4int copy_no, G4VPhysicalVolume* sipm) const override {
+    sipm -> SetTranslation(positions[copy_no]);
+    sipm -> SetRotation(nullptr);
+  }
+private:
+  std::vector<G4ThreeVector> positions;
+};
+
+std::string placed_materials_description() {
+  auto param = [] (const auto& value) { return value ? std::to_string(*value) : std::string{"default"}; };
+  auto scint = scintillator_type_to_string(my.scint_params().scint);
+  auto teflon = "teflon(" + param(my.reflectivity) + ")";
+  return "G4_AIR"
+    "+" + scint + "(" + param(my.scint_yield) + ")"
+    "+" + teflon + "+" + (my.absorbent_opposite ? "G4_Galactic" : teflon)
+    +  "+wrapping-" + wrapping_enum_to_string(my.wrapping)
+    +  "+optical_gel+silicon";
+}
+
+// Regions and their cuts outlive geometry rebuilds, so both are reused
+static G4Region* region_with_cut(const G4String& name, double cut) {
+  auto region = G4RegionStore::GetInstance() -> FindOrCreateRegion(name);
+  auto cuts   = region -> GetProductionCuts();
+  if (! cuts) {
+    cuts = new G4ProductionCuts;
+    region -> SetProductionCuts(cuts);
+  }
+  cuts -> SetProductionCut(cut);
+  return region;
+}
+
 G4PVPlacement* crystal_geometry(run_stats& stats) {
   auto scintillator = scintillator_material(my.scint_params().scint);
   auto air     = n4::material("G4_AIR");
@@ -93,7 +149,7 @@ G4PVPlacement* crystal_geometry(run_stats& stats) {
   auto gel     = petmat::optical_gel_with_properties();
   auto [sx, sy, sz] = n4::unpack(my.scint_size());
 
-  auto world  = n4::box("world").xyz(sx*1.5, sy*1.5, sz*2.5).place(air).now();
+  auto world  = n4::box("world").xyz(world_size(my.scint_size())).place(air).now();
   auto reflector = n4::box("reflector")
     .x(sx + 2*my.reflector_thickness)
     .y(sy + 2*my.reflector_thickness)
@@ -116,38 +172,97 @@ G4PVPlacement* crystal_geometry(run_stats& stats) {
     .place(scintillator)
     .in(reflector).now();
 
+  // The crystal gets its own production cuts, and so do the gel and
+  // SiPMs (the readout region, below); the world and reflector stay in
+  // the default region, with the default cut set by the physics list,
+  // which can be coarse as nothing is measured there
+  auto crystal_logical = crystal -> GetLogicalVolume();
+  region_with_cut("crystal", my.crystal_cut) -> AddRootLogicalVolume(crystal_logical);
+  if (my.crystal_max_step > 0) {
+    crystal_logical -> SetUserLimits(new G4UserLimits{my.crystal_max_step});
+  }
+
+  // The first interaction of each gamma in the crystal is sampled from
+  // the attenuation law truncated to its path through the crystal. The
+  // part of the history which would have crossed without interacting
+  // flies freely with the complementary weight.
+  if (my.force_interaction) {
+    auto force = new G4BOptrForceCollision("gamma", "force_interaction");
+    force -> AttachTo(crystal_logical);
+  }
+
   auto [pde_energies, pde_values] = sipm_pde();
   static auto pde = n4::interpolator(std::move(pde_energies), std::move(pde_values));
 
-  auto process_hits = [&stats] (G4Step* step) {
+  auto params    = my.scint_params();
+  auto placement = my.sipm_placement;
+  auto process_hits = [&stats, params, placement, cfg = frozen_config{}] (G4Step* step) mutable {
     static auto optical_photon = n4::find_particle("opticalphoton");
     auto track = step -> GetTrack();
     if (track -> GetDefinition() == optical_photon) {
       auto p = pde(step -> GetTrack() -> GetTotalEnergy());
       if (n4::random::uniform() < p) {
         stats.n_detected_evt++;
-        size_t n = step -> GetPreStepPoint() -> GetPhysicalVolume() -> GetCopyNo();
+        auto pre = step -> GetPreStepPoint();
+        auto touchable = pre -> GetTouchable();
+        size_t n;
+        if (placement == sipm_placement_enum::plane) {
+          auto local = touchable -> GetHistory() -> GetTopTransform().TransformPoint(pre -> GetPosition());
+          n = sipm_channel_at(local.x(), local.y(), params);
+        } else {
+          n = touchable -> GetReplicaNumber(); // The copy number, also for parameterised volumes
+        }
         ++stats.n_detected_at_sipm[n];
+        if (cfg -> record_arrival_times()) { stats.arrival_times_at_sipm[n].push_back(pre -> GetGlobalTime()); }
       }
       track -> SetTrackStatus(fStopAndKill);
     }
     return true;
   };
 
-  n4::box("optical-gel")
+  auto optical_gel = n4::box("optical-gel")
     .xyz(my.scint_size()).z(my.gel_thickness) // x,y from scint size, override z
     .vis(gel_colour)
     .place(gel).at_z(my.gel_thickness/2).in(world).now();
 
-  auto sipm = n4::box("sipm")
-    .xy(my.scint_params().sipm_size).z(my.sipm_thickness)
-    .sensitive("sipm", process_hits)
-    .place(silicon).in(world);
+  auto sipm_z = my.gel_thickness + my.sipm_thickness/2;
+  switch (placement) {
+  case sipm_placement_enum::individual: {
+    auto sipm = n4::box("sipm")
+      .xy(params.sipm_size).z(my.sipm_thickness)
+      .sensitive("sipm", process_hits)
+      .place(silicon).in(world);
 
-  auto n=0;
-  for (const auto& pos: my.sipm_positions()) {
+    auto n=0;
+    for (const auto& pos: my.sipm_positions()) {
       sipm.clone().at(pos).copy_no(n++).now();
+    }
+    break;
   }
+  case sipm_placement_enum::parameterised: {
+    auto sipm = n4::box("sipm")
+      .xy(params.sipm_size).z(my.sipm_thickness)
+      .sensitive("sipm", process_hits)
+      .volume(silicon);
+
+    const auto& positions = my.sipm_positions();
+    new G4PVParameterised( "sipm", sipm, world -> GetLogicalVolume(), kUndefined
+                         , positions.size(), new sipm_parameterisation{positions});
+    break;
+  }
+  case sipm_placement_enum::plane:
+    // A single sensitive volume covering the whole readout face: the
+    // SiPMs tile it exactly, so channels are computed from the position
+    n4::box("sipm")
+      .x(sx).y(sy).z(my.sipm_thickness)
+      .sensitive("sipm", process_hits)
+      .place(silicon).at_z(sipm_z).in(world).now();
+    break;
+  }
+
+  auto readout_region = region_with_cut("readout", my.readout_cut);
+  readout_region -> AddRootLogicalVolume(optical_gel -> GetLogicalVolume());
+  readout_region -> AddRootLogicalVolume(n4::find_logical("sipm"));
 
   // TODO add abstraction for placing optical surface between volumes
   auto reflector_surface = make_reflector_optical_surface();
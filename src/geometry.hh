@@ -1,5 +1,6 @@
 #pragma once
 
+#include "config.hh"
 #include "run_stats.hh"
 
 #include <G4PVPlacement.hh>
@@ -7,4 +8,12 @@
 
 G4OpticalSurface* make_reflector_optical_surface(); // exposed so it can be tested
 
+// Copy number of the SiPM covering the given point in the plane of the
+// SiPMs, consistent with the order of `config::sipm_positions`
+size_t sipm_channel_at(double x, double y, const scint_parameters& params);
+
+// Every material `crystal_geometry` places, with the parameters that shape
+// them: keep in step with it, as it keys the physics table cache
+std::string placed_materials_description();
+
 G4PVPlacement* crystal_geometry(run_stats&);
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+// FNV-1a: unlike std::hash, stable across builds, so usable to key
+// results cached on disk
+inline uint64_t fnv1a(const std::string& s) {
+  uint64_t h = 14695981039346656037ull;
+  for (unsigned char c: s) { h ^= c; h *= 1099511628211ull; }
+  return h;
+}
+
+inline std::string fnv1a_hex(const std::string& s) {
+  std::ostringstream hex;
+  hex << std::hex << std::setw(16) << std::setfill('0') << fnv1a(s);
+  return hex.str();
+}
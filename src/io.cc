@@ -1,18 +1,32 @@
 #include "config.hh"
+#include "hash.hh"
 #include "io.hh"
 
 #include <n4-sequences.hh>
 
 #include <arrow/io/api.h>
+#include <arrow/ipc/api.h>
+#include <arrow/util/compression.h>
 
 #include <parquet/arrow/reader.h>
+#include <parquet/exception.h>
+#include <parquet/file_reader.h>
 
 #include <boost/algorithm/string/split.hpp>          // boost::split
 #include <boost/algorithm/string/classification.hpp> // boost::is_any_of
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cmath>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
 #include <memory>
+#include <sstream>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -27,31 +41,82 @@ auto interaction_type = arrow::struct_({
   arrow::field("type", arrow:: uint32(), NOT_NULLABLE),
 });
 
-std::vector<std::shared_ptr<arrow::Field>> fields() {
-  return {
-    arrow::field("x", arrow::float32(), NOT_NULLABLE),
-    arrow::field("y", arrow::float32(), NOT_NULLABLE),
-    arrow::field("z", arrow::float32(), NOT_NULLABLE),
+auto arrival_times_type = arrow::list(arrow::field("dt", arrow::uint32(), NOT_NULLABLE));
+
+// Type of the fixed-point values of `quantisation_params`
+std::shared_ptr<arrow::DataType> fixed_point_type(unsigned bits, bool is_signed) {
+  if (bits ==  0) { return arrow::float32(); }
+  if (bits ==  8) { return is_signed ? arrow::int8 () : arrow::uint8 (); }
+  if (bits == 16) { return is_signed ? arrow::int16() : arrow::uint16(); }
+  return is_signed ? arrow::int32() : arrow::uint32();
+}
+
+// `interaction_type`, as stored in files with quantised columns
+std::shared_ptr<arrow::DataType> stored_interaction_type(const quantisation_params& q) {
+  auto position = fixed_point_type(q.position_bits, true);
+  return arrow::struct_({
+    arrow::field("x"   , position                            , NOT_NULLABLE),
+    arrow::field("y"   , position                            , NOT_NULLABLE),
+    arrow::field("z"   , position                            , NOT_NULLABLE),
+    arrow::field("edep", fixed_point_type(q.edep_bits, false), NOT_NULLABLE),
+    arrow::field("type", arrow::uint32()                     , NOT_NULLABLE),
+  });
+}
+
+std::shared_ptr<arrow::DataType> per_sipm(const std::string& name, std::shared_ptr<arrow::DataType> type, size_t n_sipms) {
+  return arrow::fixed_size_list(arrow::field(name, type, NOT_NULLABLE), n_sipms);
+}
+
+std::vector<std::shared_ptr<arrow::Field>> fields(const resolved_config& cfg) {
+  auto n = cfg.n_sipms;
+  const auto& q = cfg.quantisation;
+  auto position = fixed_point_type(q.position_bits, true);
+  std::vector<std::shared_ptr<arrow::Field>> out {
+    arrow::field("x", position, NOT_NULLABLE),
+    arrow::field("y", position, NOT_NULLABLE),
+    arrow::field("z", position, NOT_NULLABLE),
     arrow::field("interactions"
                 , arrow::list(arrow::field( "interaction"
-                                          , interaction_type
+                                          , stored_interaction_type(q)
                                           , NOT_NULLABLE))
                 , NOT_NULLABLE),
-    arrow::field("photon_counts"
-                , arrow::fixed_size_list(arrow::field("photon_count"
-                                                     , arrow:: uint32()
-                                                     , NOT_NULLABLE
-)
-                                        , my.n_sipms())
-                , NOT_NULLABLE)
+    arrow::field("photon_counts", per_sipm("photon_count", fixed_point_type(q.count_bits, false), n), NOT_NULLABLE)
   };
+  if (cfg.digitise) {
+    out.push_back(arrow::field("charge", per_sipm("charge", arrow::float32(), n), NOT_NULLABLE));
+    if (cfg.digitise_times) {
+      out.push_back(arrow::field("sipm_time", per_sipm("sipm_time", arrow::float32(), n), NOT_NULLABLE));
+    }
+  }
+  if (cfg.n_arrival_times > 0) {
+    out.push_back(arrow::field("arrival_times", per_sipm("arrival_times", arrival_times_type, n), NOT_NULLABLE));
+    out.push_back(arrow::field("t_first"      , per_sipm("t_first"      , arrow::float32() , n), NOT_NULLABLE));
+    out.push_back(arrow::field("t_quantile"   , per_sipm("t_quantile"   , arrow::float32() , n), NOT_NULLABLE));
+  }
+  if (cfg.force_interaction) {
+    out.push_back(arrow::field("weight", arrow::float32(), NOT_NULLABLE));
+  }
+  if (cfg.reco.method != reco_method_enum::none) {
+    // NaN when no light was seen
+    out.push_back(arrow::field("reco_x"  , arrow::float32(), NOT_NULLABLE));
+    out.push_back(arrow::field("reco_y"  , arrow::float32(), NOT_NULLABLE));
+    out.push_back(arrow::field("reco_doi", arrow::float32(), NOT_NULLABLE));
+  }
+  return out;
+}
+
+std::shared_ptr<arrow::FixedSizeListBuilder> counts(arrow::MemoryPool* pool, size_t n_sipms) {
+  return std::make_shared<arrow::FixedSizeListBuilder>(pool, std::make_shared<arrow::UInt32Builder>(), per_sipm("photon_count", arrow::uint32(), n_sipms));
 }
 
-std::shared_ptr<arrow::FixedSizeListBuilder> counts(arrow::MemoryPool* pool) {
-  auto single_count_type  = arrow::uint32();
-  auto single_count_field = std::make_shared<arrow::Field>("photon_count", single_count_type, NOT_NULLABLE);
-  auto counts_list_type   = arrow::fixed_size_list(single_count_field, my.n_sipms());
-  return std::make_shared<arrow::FixedSizeListBuilder>(pool, std::make_shared<arrow::UInt32Builder>(), counts_list_type);
+std::shared_ptr<arrow::FixedSizeListBuilder> floats_per_sipm(const std::string& name, arrow::MemoryPool* pool, size_t n_sipms) {
+  return std::make_shared<arrow::FixedSizeListBuilder>(pool, std::make_shared<arrow::FloatBuilder>(), per_sipm(name, arrow::float32(), n_sipms));
+}
+
+std::shared_ptr<arrow::FixedSizeListBuilder> arrival_times(arrow::MemoryPool* pool, size_t n_sipms) {
+  auto dt_builder = std::make_shared<arrow::UInt32Builder>(pool);
+  auto per_sipm_builder = std::make_shared<arrow::ListBuilder>(pool, dt_builder, arrival_times_type);
+  return std::make_shared<arrow::FixedSizeListBuilder>(pool, per_sipm_builder, per_sipm("arrival_times", arrival_times_type, n_sipms));
 }
 
 #define EXIT(stuff) std::cerr << "\n\n    " << stuff << "\n\n\n"; std::exit(EXIT_FAILURE);
@@ -99,7 +164,8 @@ std::tuple<arrow::Compression::type, std::optional<int>> parse_compression_spec(
 
 std::unique_ptr<parquet::arrow::FileWriter> make_writer(
   std::shared_ptr<arrow::Schema> schema,
-  arrow::MemoryPool* pool)
+  arrow::MemoryPool* pool,
+  const std::string& filename)
 {
   // Choose compression and opt to store Arrow schema for easier reads
   // back into Arrow
@@ -111,10 +177,159 @@ std::unique_ptr<parquet::arrow::FileWriter> make_writer(
   auto file_props = file_props_builder.build();
 
   auto arrow_props = parquet::ArrowWriterProperties::Builder().store_schema() -> build();
-  auto outfile = arrow::io::FileOutputStream::Open(my.outfile).ValueOrDie();
+  auto outfile = arrow::io::FileOutputStream::Open(filename).ValueOrDie();
   return parquet::arrow::FileWriter::Open(*schema, pool, outfile, file_props, arrow_props).ValueOrDie();
 }
 
+class parquet_sink : public table_sink {
+public:
+  parquet_sink(std::unique_ptr<parquet::arrow::FileWriter> writer) : writer{std::move(writer)} {}
+  arrow::Status write(const arrow::Table& table, int64_t chunk_size) override { return writer -> WriteTable(table, chunk_size); }
+  arrow::Status close()                                              override { return writer -> Close(); }
+private:
+  std::unique_ptr<parquet::arrow::FileWriter> writer;
+};
+
+// Arrow's files need to know their size or position, which pipes have
+// not: these only count the bytes which went through
+class pipe_output : public arrow::io::OutputStream {
+public:
+  explicit pipe_output(int fd) : fd{fd} {}
+  ~pipe_output() override { if (fd >= 0) { ::close(fd); } }
+
+  arrow::Status Close() override {
+    if (fd >= 0 && ::close(fd) != 0) { fd = -1; return arrow::Status::IOError("Could not close pipe: ", std::strerror(errno)); }
+    fd = -1;
+    return arrow::Status::OK();
+  }
+  bool                   closed() const override { return fd < 0; }
+  arrow::Result<int64_t> Tell  () const override { return position; }
+
+  arrow::Status Write(const void* data, int64_t nbytes) override {
+    auto bytes = static_cast<const char*>(data);
+    for (int64_t done = 0; done < nbytes;) {
+      auto n = ::write(fd, bytes + done, nbytes - done);
+      if (n < 0 && errno == EINTR) { continue; }
+      if (n < 0) { return arrow::Status::IOError("Could not write to pipe: ", std::strerror(errno)); }
+      done += n;
+    }
+    position += nbytes;
+    return arrow::Status::OK();
+  }
+
+private:
+  int     fd;
+  int64_t position = 0;
+};
+
+class pipe_input : public arrow::io::InputStream {
+public:
+  explicit pipe_input(int fd) : fd{fd} {}
+  ~pipe_input() override { if (fd >= 0) { ::close(fd); } }
+
+  arrow::Status Close() override {
+    if (fd >= 0) { ::close(fd); }
+    fd = -1;
+    return arrow::Status::OK();
+  }
+  bool                   closed() const override { return fd < 0; }
+  arrow::Result<int64_t> Tell  () const override { return position; }
+
+  // Short only at the end of the stream, once the writer closed its end
+  arrow::Result<int64_t> Read(int64_t nbytes, void* out) override {
+    auto bytes = static_cast<char*>(out);
+    int64_t done = 0;
+    while (done < nbytes) {
+      auto n = ::read(fd, bytes + done, nbytes - done);
+      if (n < 0 && errno == EINTR) { continue; }
+      if (n < 0) { return arrow::Status::IOError("Could not read from pipe: ", std::strerror(errno)); }
+      if (n == 0) { break; }
+      done += n;
+    }
+    position += done;
+    return done;
+  }
+
+  arrow::Result<std::shared_ptr<arrow::Buffer>> Read(int64_t nbytes) override {
+    ARROW_ASSIGN_OR_RAISE(auto buffer, arrow::AllocateResizableBuffer(nbytes));
+    ARROW_ASSIGN_OR_RAISE(auto n     , Read(nbytes, buffer -> mutable_data()));
+    ARROW_RETURN_NOT_OK(buffer -> Resize(n, false));
+    return std::shared_ptr<arrow::Buffer>{std::move(buffer)};
+  }
+
+private:
+  int     fd;
+  int64_t position = 0;
+};
+
+// Opening either end of a pipe blocks until the other end is opened too
+arrow::Result<std::shared_ptr<arrow::io::OutputStream>> open_output(const std::string& filename) {
+  if (! std::filesystem::is_fifo(filename)) { return arrow::io::FileOutputStream::Open(filename); }
+  auto fd = ::open(filename.c_str(), O_WRONLY);
+  if (fd < 0) { return arrow::Status::IOError("Could not open pipe ", filename, ": ", std::strerror(errno)); }
+  return std::make_shared<pipe_output>(fd);
+}
+
+arrow::Result<std::shared_ptr<arrow::io::InputStream>> open_input(const std::string& filename) {
+  if (! std::filesystem::is_fifo(filename)) { return arrow::io::ReadableFile::Open(filename); }
+  auto fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) { return arrow::Status::IOError("Could not open pipe ", filename, ": ", std::strerror(errno)); }
+  return std::make_shared<pipe_input>(fd);
+}
+
+// Every table becomes one record batch per `chunk_size` rows
+class ipc_sink : public table_sink {
+public:
+  ipc_sink(std::shared_ptr<arrow::io::OutputStream> out, std::shared_ptr<arrow::ipc::RecordBatchWriter> writer)
+    : out{std::move(out)}, writer{std::move(writer)} {}
+  arrow::Status write(const arrow::Table& table, int64_t chunk_size) override {
+    if (table.num_rows() == 0) { return arrow::Status::OK(); }
+    ARROW_RETURN_NOT_OK(writer -> WriteTable(table, chunk_size));
+    return out -> Flush(); // So that readers of a pipe see every chunk as soon as it is written
+  }
+  arrow::Status close() override {
+    ARROW_RETURN_NOT_OK(writer -> Close());
+    return out -> Close();
+  }
+private:
+  std::shared_ptr<arrow::io::OutputStream>       out;
+  std::shared_ptr<arrow::ipc::RecordBatchWriter> writer;
+};
+
+output_format_enum resolve_output_format(output_format_enum format, const std::string& filename) {
+  if (format != output_format_enum::automatic) { return format; }
+  if (std::filesystem::is_fifo(filename)) { return output_format_enum::stream; }
+  auto extension = std::filesystem::path{filename}.extension();
+  if (extension == ".arrow" || extension == ".feather") { return output_format_enum::feather; }
+  if (extension == ".arrows"                          ) { return output_format_enum::stream ; }
+  return output_format_enum::parquet;
+}
+
+#define EXIT(stuff) std::cerr << "\n\n    " << stuff << "\n\n\n"; std::exit(EXIT_FAILURE);
+std::unique_ptr<table_sink> make_sink(std::shared_ptr<arrow::Schema> schema, arrow::MemoryPool* pool, const resolved_config& cfg) {
+  const auto& filename = cfg.outfile;
+  auto format = resolve_output_format(cfg.output_format, filename);
+  if (format == output_format_enum::parquet) { return std::make_unique<parquet_sink>(make_writer(schema, pool, filename)); }
+
+  // IPC buffers can only be compressed with these two
+  auto options = arrow::ipc::IpcWriteOptions::Defaults();
+  options.memory_pool = pool;
+  auto spec = cfg.ipc_compression;
+  for (auto& c: spec) { c = std::tolower(c); }
+  if      (spec == "lz4" ) { options.codec = arrow::util::Codec::Create(arrow::Compression::LZ4_FRAME).ValueOrDie(); }
+  else if (spec == "zstd") { options.codec = arrow::util::Codec::Create(arrow::Compression::ZSTD     ).ValueOrDie(); }
+  else if (spec != "none") { EXIT("Unrecognized IPC compression '" << cfg.ipc_compression << "': use none, lz4 or zstd") }
+
+  // The IPC writer issues many small writes per record batch
+  auto raw    = open_output(filename).ValueOrDie();
+  auto out    = arrow::io::BufferedOutputStream::Create(1 << 20, pool, raw).ValueOrDie();
+  auto writer = format == output_format_enum::feather
+    ? arrow::ipc::MakeFileWriter  (out, schema, options).ValueOrDie()
+    : arrow::ipc::MakeStreamWriter(out, schema, options).ValueOrDie();
+  return std::make_unique<ipc_sink>(out, writer);
+}
+#undef EXIT
+
 std::string run_shell_cmd(const std::string& cmd, size_t buffer_size = 1024) {
   std::unique_ptr<FILE, decltype(&pclose)> pipe(popen(cmd.c_str(), "r"), pclose);
   if (!pipe) { std::cerr << "popen() failed!" << std::endl; exit(EXIT_FAILURE); }
@@ -125,23 +340,28 @@ std::string run_shell_cmd(const std::string& cmd, size_t buffer_size = 1024) {
   return result;
 }
 
-std::unordered_map<std::string, std::string> git_metadata() {
-  std::unordered_map<std::string, std::string> out;
+// Every output file of a process gets the same: the commit does not
+// change while it runs, so git is only asked once
+const std::unordered_map<std::string, std::string>& git_metadata() {
+  static const auto out = [] {
+    std::unordered_map<std::string, std::string> out;
 
-  auto commit_hash = run_shell_cmd("git log -1 --pretty=format:\"%H\"");
-  auto commit_date = run_shell_cmd("git log -1 --pretty=format:\"%ad\" --date=iso8601");
-  auto commit_msg  = run_shell_cmd("git log -1 --pretty=format:\"%s\"");
+    auto commit_hash = run_shell_cmd("git log -1 --pretty=format:\"%H\"");
+    auto commit_date = run_shell_cmd("git log -1 --pretty=format:\"%ad\" --date=iso8601");
+    auto commit_msg  = run_shell_cmd("git log -1 --pretty=format:\"%s\"");
 
-  out["commit-hash"] = commit_hash;
-  out["commit-date"] = commit_date;
-  out["commit-msg" ] = commit_msg ;
+    out["commit-hash"] = commit_hash;
+    out["commit-date"] = commit_date;
+    out["commit-msg" ] = commit_msg ;
 
+    return out;
+  }();
   return out;
 }
 
 std::shared_ptr<const arrow::KeyValueMetadata> metadata() {
   auto config_map = my.as_map();
-  auto   git_meta = git_metadata();
+  const auto& git_meta = git_metadata();
   auto   cli_args = my.cli_args();
 
   auto N = config_map.size()
@@ -158,8 +378,17 @@ std::shared_ptr<const arrow::KeyValueMetadata> metadata() {
   return std::make_shared<const arrow::KeyValueMetadata>(keys, values);
 }
 
-std::shared_ptr<arrow::Schema> make_schema() {
-  return std::make_shared<arrow::Schema>(fields(), metadata());
+std::shared_ptr<arrow::Schema> make_schema(const resolved_config& cfg) {
+  auto meta = metadata() -> Copy();
+  meta -> Append("schema_fingerprint", expected_fingerprint(cfg));
+
+  // In mm and MeV per unit, exact, for the readers to decode the
+  // fixed-point columns
+  auto exact = [] (double value) { std::ostringstream out; out << std::setprecision(17) << value; return out.str(); };
+  const auto& q = cfg.quantisation;
+  if (q.position_bits > 0) { meta -> Append("position_scale", exact(q.position_resolution)); }
+  if (q.edep_bits     > 0) { meta -> Append(    "edep_scale", exact(q.    edep_resolution)); }
+  return std::make_shared<arrow::Schema>(fields(cfg), meta);
 }
 
 auto make_interaction_builder() {
@@ -174,26 +403,240 @@ auto make_interaction_builder() {
   return std::make_shared<arrow::StructBuilder>(interaction_type, pool, vec_of_builders);
 }
 
-parquet_writer::parquet_writer() :
-  pool                {arrow::default_memory_pool()}
+// ----- Fixed-point columns ---------------------------------------------------------------------------------
+// The builders always make float32 positions and energies and uint32
+// counts; whole finished columns are converted to and from the types of
+// `quantisation_params` in single passes over plain arrays
+
+template<class T>
+arrow::Result<std::shared_ptr<arrow::Array>> fixed_point(const arrow::FloatArray& in, double resolution, arrow::MemoryPool* pool) {
+  arrow::NumericBuilder<T> out{pool};
+  ARROW_RETURN_NOT_OK(out.Reserve(in.length()));
+  const auto* values = in.raw_values();
+  for (int64_t i=0; i<in.length(); i++) { out.UnsafeAppend(static_cast<typename T::c_type>(std::round(values[i] / resolution))); }
+  return out.Finish();
+}
+
+template<class T>
+arrow::Result<std::shared_ptr<arrow::Array>> floating_point(const arrow::Array& in, double resolution, arrow::MemoryPool* pool) {
+  arrow::FloatBuilder out{pool};
+  ARROW_RETURN_NOT_OK(out.Reserve(in.length()));
+  const auto* values = static_cast<const arrow::NumericArray<T>&>(in).raw_values();
+  for (int64_t i=0; i<in.length(); i++) { out.UnsafeAppend(values[i] * resolution); }
+  return out.Finish();
+}
+
+template<class FROM, class TO>
+arrow::Result<std::shared_ptr<arrow::Array>> converted(const arrow::Array& in, arrow::MemoryPool* pool) {
+  arrow::NumericBuilder<TO> out{pool};
+  ARROW_RETURN_NOT_OK(out.Reserve(in.length()));
+  const auto* values = static_cast<const arrow::NumericArray<FROM>&>(in).raw_values();
+  for (int64_t i=0; i<in.length(); i++) { out.UnsafeAppend(static_cast<typename TO::c_type>(values[i])); }
+  return out.Finish();
+}
+
+arrow::Result<std::shared_ptr<arrow::Array>> to_fixed_point(const std::shared_ptr<arrow::Array>& in, unsigned bits, bool is_signed,
+                                                             double resolution, arrow::MemoryPool* pool) {
+  const auto& floats = static_cast<const arrow::FloatArray&>(*in);
+  switch (fixed_point_type(bits, is_signed) -> id()) {
+    case arrow::Type:: INT16: return fixed_point<arrow:: Int16Type>(floats, resolution, pool);
+    case arrow::Type:: INT32: return fixed_point<arrow:: Int32Type>(floats, resolution, pool);
+    case arrow::Type::UINT16: return fixed_point<arrow::UInt16Type>(floats, resolution, pool);
+    case arrow::Type::UINT32: return fixed_point<arrow::UInt32Type>(floats, resolution, pool);
+    default                 : return in;
+  }
+}
+
+arrow::Result<std::shared_ptr<arrow::Array>> to_floating_point(const std::shared_ptr<arrow::Array>& in, const std::string& name,
+                                                                double resolution, arrow::MemoryPool* pool) {
+  if (in -> type_id() == arrow::Type::FLOAT) { return in; }
+  if (resolution <= 0) { return arrow::Status::Invalid("Fixed-point column '", name, "' without its scale in the metadata"); }
+  switch (in -> type_id()) {
+    case arrow::Type:: INT16: return floating_point<arrow:: Int16Type>(*in, resolution, pool);
+    case arrow::Type:: INT32: return floating_point<arrow:: Int32Type>(*in, resolution, pool);
+    case arrow::Type::UINT16: return floating_point<arrow::UInt16Type>(*in, resolution, pool);
+    case arrow::Type::UINT32: return floating_point<arrow::UInt32Type>(*in, resolution, pool);
+    default: return arrow::Status::Invalid("Unexpected type of column '", name, "': ", in -> type() -> ToString());
+  }
+}
+
+// photon_counts with values of `type`: narrower when written, uint32 when read
+arrow::Result<std::shared_ptr<arrow::Array>> with_count_type(const std::shared_ptr<arrow::Array>& in, std::shared_ptr<arrow::DataType> type,
+                                                             arrow::MemoryPool* pool) {
+  auto list   = static_pointer_cast<arrow::FixedSizeListArray>(in);
+  auto values = list -> values() -> Slice(list -> value_offset(0), list -> length() * list -> value_length());
+  auto from   = values -> type_id();
+  auto to     = type   -> id();
+  if (from == to) { return in; }
+
+  std::shared_ptr<arrow::Array> out;
+  using arrow::Type;
+  if      (from == Type::UINT32 && to == Type::UINT8 ) { ARROW_ASSIGN_OR_RAISE(out, (converted<arrow::UInt32Type, arrow:: UInt8Type>(*values, pool))); }
+  else if (from == Type::UINT32 && to == Type::UINT16) { ARROW_ASSIGN_OR_RAISE(out, (converted<arrow::UInt32Type, arrow::UInt16Type>(*values, pool))); }
+  else if (from == Type::UINT8  && to == Type::UINT32) { ARROW_ASSIGN_OR_RAISE(out, (converted<arrow:: UInt8Type, arrow::UInt32Type>(*values, pool))); }
+  else if (from == Type::UINT16 && to == Type::UINT32) { ARROW_ASSIGN_OR_RAISE(out, (converted<arrow::UInt16Type, arrow::UInt32Type>(*values, pool))); }
+  else { return arrow::Status::Invalid("Unexpected type of photon counts: ", values -> type() -> ToString()); }
+
+  auto list_type = arrow::fixed_size_list(list -> list_type() -> value_field() -> WithType(type), list -> value_length());
+  return std::make_shared<arrow::FixedSizeListArray>(list_type, list -> length(), out);
+}
+
+// The interactions column with every field replaced by `convert(name, field)`.
+// The offsets are shared: only the converted fields are new.
+template<class CONVERT>
+arrow::Result<std::shared_ptr<arrow::Array>> map_interactions(const std::shared_ptr<arrow::Array>& in, CONVERT convert) {
+  auto list    = static_pointer_cast<arrow::  ListArray>(in);
+  auto structs = static_pointer_cast<arrow::StructArray>(list -> values());
+  std::vector<std::shared_ptr<arrow::Array>> children;
+  std::vector<std::shared_ptr<arrow::Field>> fields;
+  for (int i=0; i<structs -> num_fields(); i++) {
+    const auto& field = structs -> type() -> field(i);
+    ARROW_ASSIGN_OR_RAISE(auto child, convert(field -> name(), structs -> field(i)));
+    fields  .push_back(field -> WithType(child -> type()));
+    children.push_back(child);
+  }
+  auto struct_type = arrow::struct_(fields);
+  auto values      = std::make_shared<arrow::StructArray>(struct_type, structs -> length(), children);
+  auto list_type   = arrow::list(list -> list_type() -> value_field() -> WithType(struct_type));
+  return std::make_shared<arrow::ListArray>(list_type, list -> length(), list -> value_offsets(), values, nullptr, 0, list -> offset());
+}
+
+// x, y, z, interactions and photon_counts are the first five columns
+arrow::Status quantise_columns(std::vector<std::shared_ptr<arrow::Array>>& arrays, const quantisation_params& q, arrow::MemoryPool* pool) {
+  for (int i=0; i<3; i++) {
+    ARROW_ASSIGN_OR_RAISE(arrays[i], to_fixed_point(arrays[i], q.position_bits, true, q.position_resolution, pool));
+  }
+  ARROW_ASSIGN_OR_RAISE(arrays[3], map_interactions(arrays[3], [&] (const std::string& name, const std::shared_ptr<arrow::Array>& field) {
+    if (name == "edep") { return to_fixed_point(field, q.edep_bits    , false, q.edep_resolution    , pool); }
+    if (name == "type") { return arrow::Result<std::shared_ptr<arrow::Array>>{field}; }
+    return                       to_fixed_point(field, q.position_bits, true , q.position_resolution, pool);
+  }));
+  ARROW_ASSIGN_OR_RAISE(arrays[4], with_count_type(arrays[4], fixed_point_type(q.count_bits, false), pool));
+  return arrow::Status::OK();
+}
+
+// Events with values out of the range of the fixed-point columns are
+// rejected whole, before anything is appended, so the columns stay
+// aligned. These are capacity errors, which stop the simulation.
+arrow::Status check_fixed_point_range(const quantisation_params& q, const G4ThreeVector& pos,
+                                      const std::vector<interaction>& interactions, const std::unordered_map<size_t, size_t>& counts) {
+  auto check = [] (const char* what, double value, double resolution, unsigned bits, bool is_signed) {
+    if (bits == 0) { return arrow::Status::OK(); }
+    auto max   = std::ldexp(1.0, bits - is_signed) - 1;
+    auto units = std::round(value / resolution);
+    if (units <= max && units >= (is_signed ? -max - 1 : 0)) { return arrow::Status::OK(); }
+    return arrow::Status::CapacityError(what, " ", value, " does not fit in ", bits, "-bit fixed point");
+  };
+  for (auto v: {pos.x(), pos.y(), pos.z()}) { ARROW_RETURN_NOT_OK(check("Position", v, q.position_resolution, q.position_bits, true)); }
+  for (const auto& i: interactions) {
+    for (auto v: {i.x, i.y, i.z}) { ARROW_RETURN_NOT_OK(check("Interaction position", v, q.position_resolution, q.position_bits, true)); }
+    ARROW_RETURN_NOT_OK(check("Energy deposit", i.edep, q.edep_resolution, q.edep_bits, false));
+  }
+  auto max_count = std::ldexp(1.0, q.count_bits) - 1;
+  for (const auto& [sipm, count]: counts) {
+    if (count > max_count) {
+      return arrow::Status::CapacityError("Count of ", count, " at SiPM ", sipm, " does not fit in ", q.count_bits, " bits: raise /my/count_bits");
+    }
+  }
+  return arrow::Status::OK();
+}
+
+arrow::Result<std::shared_ptr<arrow::Array>> dequantise_column(const std::string& name, const std::shared_ptr<arrow::Array>& in,
+                                                               const arrow::KeyValueMetadata* meta) {
+  auto pool  = arrow::default_memory_pool();
+  auto scale = [&] (const std::string& key) -> double {
+    auto i = meta ? meta -> FindKey(key) : -1;
+    return i < 0 ? 0 : std::stod(meta -> value(i));
+  };
+  if (name == "x" || name == "y" || name == "z") { return to_floating_point(in, name, scale("position_scale"), pool); }
+  if (name == "interactions") {
+    return map_interactions(in, [&] (const std::string& field_name, const std::shared_ptr<arrow::Array>& field) {
+      if (field_name == "edep") { return to_floating_point(field, field_name, scale("edep_scale"), pool); }
+      if (field_name == "type") { return arrow::Result<std::shared_ptr<arrow::Array>>{field}; }
+      return                             to_floating_point(field, field_name, scale("position_scale"), pool);
+    });
+  }
+  if (name == "photon_counts") { return with_count_type(in, arrow::uint32(), pool); }
+  return in;
+}
+
+arrow::Result<std::shared_ptr<arrow::Table>> dequantise(const std::shared_ptr<arrow::Table>& table) {
+  auto schema = table -> schema();
+  ARROW_ASSIGN_OR_RAISE(auto decoded_schema, dequantised_schema(schema));
+  std::vector<std::shared_ptr<arrow::ChunkedArray>> columns;
+  for (int c=0; c<table -> num_columns(); c++) {
+    std::vector<std::shared_ptr<arrow::Array>> chunks;
+    for (const auto& chunk: table -> column(c) -> chunks()) {
+      ARROW_ASSIGN_OR_RAISE(auto decoded, dequantise_column(schema -> field(c) -> name(), chunk, schema -> metadata().get()));
+      chunks.push_back(decoded);
+    }
+    columns.push_back(std::make_shared<arrow::ChunkedArray>(chunks, decoded_schema -> field(c) -> type()));
+  }
+  return arrow::Table::Make(decoded_schema, columns, table -> num_rows());
+}
+
+arrow::Result<std::shared_ptr<arrow::RecordBatch>> dequantise(const std::shared_ptr<arrow::RecordBatch>& batch) {
+  auto schema = batch -> schema();
+  ARROW_ASSIGN_OR_RAISE(auto decoded_schema, dequantised_schema(schema));
+  std::vector<std::shared_ptr<arrow::Array>> columns;
+  for (int c=0; c<batch -> num_columns(); c++) {
+    ARROW_ASSIGN_OR_RAISE(auto decoded, dequantise_column(schema -> field(c) -> name(), batch -> column(c), schema -> metadata().get()));
+    columns.push_back(decoded);
+  }
+  return arrow::RecordBatch::Make(decoded_schema, batch -> num_rows(), columns);
+}
+
+arrow::Result<std::shared_ptr<arrow::Schema>> dequantised_schema(const std::shared_ptr<arrow::Schema>& schema) {
+  // The decoded type of an empty column is that of any other
+  std::vector<std::shared_ptr<arrow::Field>> fields;
+  for (const auto& field: schema -> fields()) {
+    ARROW_ASSIGN_OR_RAISE(auto empty  , arrow::MakeEmptyArray(field -> type()));
+    ARROW_ASSIGN_OR_RAISE(auto decoded, dequantise_column(field -> name(), empty, schema -> metadata().get()));
+    fields.push_back(field -> WithType(decoded -> type()));
+  }
+  return std::make_shared<arrow::Schema>(fields, schema -> metadata());
+}
+
+parquet_writer::parquet_writer(std::shared_ptr<const resolved_config> cfg) :
+  cfg                 {cfg}
+, pool                {arrow::default_memory_pool()}
 , x_builder           {std::make_shared<arrow::FloatBuilder>(pool)}
 , y_builder           {std::make_shared<arrow::FloatBuilder>(pool)}
 , z_builder           {std::make_shared<arrow::FloatBuilder>(pool)}
 , interactions_builder{std::make_shared<arrow:: ListBuilder>(pool, make_interaction_builder(), interaction_type)}
-, counts_builder      {counts(pool)}
-, schema              {std::make_shared<arrow::Schema>(fields(), metadata())}
-, writer              {make_writer(schema, pool)}
-{}
+, counts_builder      {counts(pool, cfg -> n_sipms)}
+, charge_builder      {floats_per_sipm("charge"    , pool, cfg -> n_sipms)}
+, sipm_time_builder   {floats_per_sipm("sipm_time" , pool, cfg -> n_sipms)}
+, arrival_times_builder{arrival_times(pool, cfg -> n_sipms)}
+, t_first_builder     {floats_per_sipm("t_first"   , pool, cfg -> n_sipms)}
+, t_quantile_builder  {floats_per_sipm("t_quantile", pool, cfg -> n_sipms)}
+, weight_builder      {std::make_shared<arrow::FloatBuilder>(pool)}
+, schema              {make_schema(*cfg)}
+, writer              {make_sink(schema, pool, *cfg)}
+{
+  auto method = cfg -> reco.method;
+  if (method == reco_method_enum::none) { return; }
+  std::optional<light_response> lrf;
+  if (method == reco_method_enum::ml) {
+    auto read = read_light_response(cfg -> reco.lrf_file);
+    if (! read.ok()) {
+      std::cerr << "\n\n    Could not read light response from '" << cfg -> reco.lrf_file << "': " << read.status().ToString() << "\n\n\n";
+      std::exit(EXIT_FAILURE);
+    }
+    lrf = std::move(read).ValueOrDie();
+  }
+  reco.emplace(cfg -> reco, cfg -> sipm_positions, std::move(lrf));
+}
 
 parquet_writer::~parquet_writer() {
   arrow::Status status;
   status = write();           if (! status.ok()) { std::cerr << "\nCould not write to file "           << status.ToString() << std::endl; }
-  status = writer -> Close(); if (! status.ok()) { std::cerr << "\nCould not close the file properly " << status.ToString()  << std::endl; }
+  status = writer -> close(); if (! status.ok()) { std::cerr << "\nCould not close the file properly " << status.ToString()  << std::endl; }
 }
 
 arrow::Result<std::shared_ptr<arrow::Table>> parquet_writer::make_table() {
   std::vector<std::shared_ptr<arrow::Array>> arrays;
-  arrays.reserve(5);
+  arrays.reserve(schema -> num_fields());
 
   ARROW_ASSIGN_OR_RAISE(auto x_array      , x_builder      -> Finish()); arrays.push_back(x_array);
   ARROW_ASSIGN_OR_RAISE(auto y_array      , y_builder      -> Finish()); arrays.push_back(y_array);
@@ -201,10 +644,52 @@ arrow::Result<std::shared_ptr<arrow::Table>> parquet_writer::make_table() {
   ARROW_ASSIGN_OR_RAISE(auto i_array, interactions_builder -> Finish()); arrays.push_back(i_array);
   ARROW_ASSIGN_OR_RAISE(auto photon_counts, counts_builder -> Finish()); arrays.push_back(photon_counts);
 
+  if (cfg -> digitise) {
+    ARROW_ASSIGN_OR_RAISE(auto charge, charge_builder -> Finish()); arrays.push_back(charge);
+    if (cfg -> digitise_times) {
+      ARROW_ASSIGN_OR_RAISE(auto sipm_time, sipm_time_builder -> Finish()); arrays.push_back(sipm_time);
+    }
+  }
+
+  if (cfg -> n_arrival_times > 0) {
+    ARROW_ASSIGN_OR_RAISE(auto arrival_times, arrival_times_builder -> Finish()); arrays.push_back(arrival_times);
+    ARROW_ASSIGN_OR_RAISE(auto t_first      , t_first_builder       -> Finish()); arrays.push_back(t_first);
+    ARROW_ASSIGN_OR_RAISE(auto t_quantile   , t_quantile_builder    -> Finish()); arrays.push_back(t_quantile);
+  }
+
+  if (cfg -> force_interaction) {
+    ARROW_ASSIGN_OR_RAISE(auto weight, weight_builder -> Finish()); arrays.push_back(weight);
+  }
+
+  if (reco.has_value()) {
+    // The counts of the whole chunk are already contiguous in the finished column
+    const auto counts_list  = static_pointer_cast<arrow::FixedSizeListArray>(photon_counts);
+    const auto counts_start = static_pointer_cast<arrow::UInt32Array>(counts_list -> values()) -> raw_values();
+    reco -> reconstruct(counts_start + counts_list -> value_offset(0), counts_list -> length(), reco_out);
+
+    for (const auto* values: {&reco_out.x, &reco_out.y, &reco_out.doi}) {
+      arrow::FloatBuilder builder{pool};
+      ARROW_RETURN_NOT_OK  (builder.AppendValues(*values));
+      ARROW_ASSIGN_OR_RAISE(auto array, builder.Finish()); arrays.push_back(array);
+    }
+  }
+
+  // Last, so that the reconstruction sees the exact counts
+  ARROW_RETURN_NOT_OK(quantise_columns(arrays, cfg -> quantisation, pool));
   return arrow::Table::Make(schema, arrays);
 };
 
-arrow::Status parquet_writer::append(const G4ThreeVector& pos, const std::vector<interaction>& interactions, std::unordered_map<size_t, size_t> counts) {
+arrow::Status append_per_sipm(arrow::FixedSizeListBuilder& builder, const std::vector<float>& values, size_t n_sipms) {
+  if (values.size() != n_sipms) { return arrow::Status::Invalid("Expected one value per SiPM, got ", values.size()); }
+  ARROW_RETURN_NOT_OK(builder.Append());
+  auto value_builder = static_cast<arrow::FloatBuilder*>(builder.value_builder());
+  return value_builder -> AppendValues(values);
+}
+
+arrow::Status parquet_writer::append(const G4ThreeVector& pos, const std::vector<interaction>& interactions, const std::unordered_map<size_t, size_t>& counts,
+                                     const optional_columns& extra) {
+  auto n_sipms = cfg -> n_sipms;
+  ARROW_RETURN_NOT_OK(check_fixed_point_range(cfg -> quantisation, pos, interactions, counts));
   ARROW_RETURN_NOT_OK(x_builder            -> Append(pos.x()));
   ARROW_RETURN_NOT_OK(y_builder            -> Append(pos.y()));
   ARROW_RETURN_NOT_OK(z_builder            -> Append(pos.z()));
@@ -232,50 +717,319 @@ arrow::Status parquet_writer::append(const G4ThreeVector& pos, const std::vector
   // ----- SiPM photon counts --------------------------------------------------------------------------------
   auto sipm_count_builder = static_cast<arrow::UInt32Builder*>(counts_builder -> value_builder());
 
-  unsigned n;
-  for (size_t i=0; i<my.n_sipms(); i++) {
-    n = counts.contains(i) ? counts[i] : 0;
-    ARROW_RETURN_NOT_OK(sipm_count_builder -> Append(n));
+  for (size_t i=0; i<n_sipms; i++) {
+    auto found = counts.find(i);
+    ARROW_RETURN_NOT_OK(sipm_count_builder -> Append(found == counts.end() ? 0 : found -> second));
   }
 
+  // ----- Optional columns ----------------------------------------------------------------------------------
+  if (cfg -> digitise) {
+    ARROW_RETURN_NOT_OK(append_per_sipm(*charge_builder, extra.charge, n_sipms));
+    if (cfg -> digitise_times) { ARROW_RETURN_NOT_OK(append_per_sipm(*sipm_time_builder, extra.sipm_time, n_sipms)); }
+  }
+
+  if (cfg -> n_arrival_times > 0) {
+    if (extra.arrival_times.size() != n_sipms) { return arrow::Status::Invalid("Expected arrival times for every SiPM"); }
+    ARROW_RETURN_NOT_OK(arrival_times_builder -> Append());
+    auto per_sipm_builder = static_cast<arrow::  ListBuilder*>(arrival_times_builder -> value_builder());
+    auto       dt_builder = static_cast<arrow::UInt32Builder*>(per_sipm_builder      -> value_builder());
+    for (const auto& dts: extra.arrival_times) {
+      ARROW_RETURN_NOT_OK(per_sipm_builder -> Append());
+      ARROW_RETURN_NOT_OK(      dt_builder -> AppendValues(dts));
+    }
+    ARROW_RETURN_NOT_OK(append_per_sipm(*t_first_builder   , extra.t_first   , n_sipms));
+    ARROW_RETURN_NOT_OK(append_per_sipm(*t_quantile_builder, extra.t_quantile, n_sipms));
+  }
+
+  if (cfg -> force_interaction) { ARROW_RETURN_NOT_OK(weight_builder -> Append(extra.weight)); }
+
   n_rows++;
-  return n_rows == my.chunk_size ? write() : arrow::Status::OK();
+  return n_rows == cfg -> chunk_size ? write() : arrow::Status::OK();
 }
 
 arrow::Status parquet_writer::write() {
   ARROW_ASSIGN_OR_RAISE(auto data, make_table());
-  ARROW_RETURN_NOT_OK(writer -> WriteTable( *data.get(), n_rows));
+  ARROW_RETURN_NOT_OK(writer -> write(*data.get(), n_rows));
   n_rows = 0;
   return arrow::Status::OK();
 }
 
-MAYBE_EVENTS read_entire_file(const std::string& filename) {
-  arrow::MemoryPool* pool = arrow::default_memory_pool();
-  std::shared_ptr<arrow::io::RandomAccessFile> input;
+std::shared_ptr<arrow::DataType> histogram_type(const resolved_config& cfg) {
+  return arrow::fixed_size_list(arrow::field("bin", arrow::uint32(), NOT_NULLABLE), cfg.scan.hist_bins);
+}
+
+std::shared_ptr<arrow::Schema> make_scan_schema(const resolved_config& cfg) {
+  auto n = cfg.n_sipms;
+  std::vector<std::shared_ptr<arrow::Field>> out {
+    arrow::field("x"              , arrow::float32(), NOT_NULLABLE),
+    arrow::field("y"              , arrow::float32(), NOT_NULLABLE),
+    arrow::field("z"              , arrow::float32(), NOT_NULLABLE),
+    arrow::field("n_events"       , arrow:: uint32(), NOT_NULLABLE),
+    arrow::field("mean_counts"    , per_sipm("mean_count"    , arrow::float32()   , n), NOT_NULLABLE),
+    arrow::field("variance_counts", per_sipm("variance_count", arrow::float32()   , n), NOT_NULLABLE),
+    arrow::field("count_histogram", per_sipm("histogram"     , histogram_type(cfg), n), NOT_NULLABLE),
+  };
+  return std::make_shared<arrow::Schema>(out, metadata());
+}
+
+std::shared_ptr<arrow::FixedSizeListBuilder> histograms(arrow::MemoryPool* pool, const resolved_config& cfg) {
+  auto bin_builder  = std::make_shared<arrow::UInt32Builder>(pool);
+  auto hist_builder = std::make_shared<arrow::FixedSizeListBuilder>(pool, bin_builder, histogram_type(cfg));
+  return std::make_shared<arrow::FixedSizeListBuilder>(pool, hist_builder, per_sipm("histogram", histogram_type(cfg), cfg.n_sipms));
+}
+
+scan_writer::scan_writer(std::shared_ptr<const resolved_config> cfg) :
+  cfg              {cfg}
+, pool             {arrow::default_memory_pool()}
+, x_builder        {std::make_shared<arrow:: FloatBuilder>(pool)}
+, y_builder        {std::make_shared<arrow:: FloatBuilder>(pool)}
+, z_builder        {std::make_shared<arrow:: FloatBuilder>(pool)}
+, n_events_builder {std::make_shared<arrow::UInt32Builder>(pool)}
+, mean_builder     {floats_per_sipm("mean_count"    , pool, cfg -> n_sipms)}
+, variance_builder {floats_per_sipm("variance_count", pool, cfg -> n_sipms)}
+, histogram_builder{histograms(pool, *cfg)}
+, schema           {make_scan_schema(*cfg)}
+, writer           {make_writer(schema, pool, cfg -> scan_outfile)}
+{}
+
+scan_writer::~scan_writer() {
+  arrow::Status status;
+  status = write();           if (! status.ok()) { std::cerr << "\nCould not write scan summary "     << status.ToString() << std::endl; }
+  status = writer -> Close(); if (! status.ok()) { std::cerr << "\nCould not close the scan file "     << status.ToString() << std::endl; }
+}
+
+arrow::Status scan_writer::append(const scan_summary& summary) {
+  auto n_sipms = cfg -> n_sipms;
+  auto pos     = cfg -> scan.position(summary.position, cfg -> scint_size);
+  ARROW_RETURN_NOT_OK(       x_builder -> Append(pos.x()));
+  ARROW_RETURN_NOT_OK(       y_builder -> Append(pos.y()));
+  ARROW_RETURN_NOT_OK(       z_builder -> Append(pos.z()));
+  ARROW_RETURN_NOT_OK(n_events_builder -> Append(summary.n_events));
+  ARROW_RETURN_NOT_OK(append_per_sipm(*    mean_builder, summary.mean    , n_sipms));
+  ARROW_RETURN_NOT_OK(append_per_sipm(*variance_builder, summary.variance, n_sipms));
+
+  if (summary.histogram.size() != n_sipms) { return arrow::Status::Invalid("Expected a histogram for every SiPM"); }
+  ARROW_RETURN_NOT_OK(histogram_builder -> Append());
+  auto per_sipm_builder = static_cast<arrow::FixedSizeListBuilder*>(histogram_builder -> value_builder());
+  auto      bin_builder = static_cast<arrow::       UInt32Builder*>(per_sipm_builder  -> value_builder());
+  for (const auto& bins: summary.histogram) {
+    if (bins.size() != cfg -> scan.hist_bins) { return arrow::Status::Invalid("Expected ", cfg -> scan.hist_bins, " bins, got ", bins.size()); }
+    ARROW_RETURN_NOT_OK(per_sipm_builder -> Append());
+    ARROW_RETURN_NOT_OK(     bin_builder -> AppendValues(bins));
+  }
+
+  n_rows++;
+  return n_rows == cfg -> chunk_size ? write() : arrow::Status::OK();
+}
+
+arrow::Status scan_writer::write() {
+  if (n_rows == 0) { return arrow::Status::OK(); }
+  std::vector<std::shared_ptr<arrow::Array>> arrays;
+  ARROW_ASSIGN_OR_RAISE(auto x        ,         x_builder -> Finish()); arrays.push_back(x);
+  ARROW_ASSIGN_OR_RAISE(auto y        ,         y_builder -> Finish()); arrays.push_back(y);
+  ARROW_ASSIGN_OR_RAISE(auto z        ,         z_builder -> Finish()); arrays.push_back(z);
+  ARROW_ASSIGN_OR_RAISE(auto n_events ,  n_events_builder -> Finish()); arrays.push_back(n_events);
+  ARROW_ASSIGN_OR_RAISE(auto mean     ,      mean_builder -> Finish()); arrays.push_back(mean);
+  ARROW_ASSIGN_OR_RAISE(auto variance ,  variance_builder -> Finish()); arrays.push_back(variance);
+  ARROW_ASSIGN_OR_RAISE(auto histogram, histogram_builder -> Finish()); arrays.push_back(histogram);
+  ARROW_RETURN_NOT_OK(writer -> WriteTable(*arrow::Table::Make(schema, arrays), n_rows));
+  n_rows = 0;
+  return arrow::Status::OK();
+}
+
+std::shared_ptr<arrow::Schema> make_summary_schema(const resolved_config& cfg, const run_summary& summary) {
+  auto bins = arrow::fixed_size_list(arrow::field("bin", arrow::uint32(), NOT_NULLABLE), cfg.summary.bins);
+  std::vector<std::shared_ptr<arrow::Field>> out {
+    arrow::field("sipm"    , arrow:: int32 (), NOT_NULLABLE), // -1 for the sum over all SiPMs
+    arrow::field("mean"    , arrow::float32(), NOT_NULLABLE),
+    arrow::field("variance", arrow::float32(), NOT_NULLABLE),
+  };
+  for (auto p: run_summary::quantile_probabilities) {
+    out.push_back(arrow::field("q" + std::to_string(static_cast<int>(std::round(100 * p))), arrow::float32(), NOT_NULLABLE));
+  }
+  out.push_back(arrow::field("hist_max" , arrow::float32(), NOT_NULLABLE));
+  out.push_back(arrow::field("histogram", bins            , NOT_NULLABLE));
+
+  auto meta = metadata() -> Copy();
+  meta -> Append("n_events"               , std::to_string(summary.n_events()));
+  meta -> Append("photopeak_fraction"     , std::to_string(summary.photopeak_fraction()));
+  meta -> Append("over_threshold_fraction", std::to_string(summary.over_threshold_fraction()));
+  meta -> Append("quantiles"              , "P2 streaming estimates");
+  return std::make_shared<arrow::Schema>(out, meta);
+}
+
+arrow::Status write_summary(const run_summary& summary, std::shared_ptr<const resolved_config> cfg) {
+  auto pool   = arrow::default_memory_pool();
+  auto schema = make_summary_schema(*cfg, summary);
+
+  arrow::Int32Builder sipm{pool};
+  arrow::FloatBuilder mean{pool}, variance{pool}, hist_max{pool};
+  std::vector<arrow::FloatBuilder> quantiles(run_summary::quantile_probabilities.size());
+  arrow::FixedSizeListBuilder histogram{pool, std::make_shared<arrow::UInt32Builder>(pool), schema -> GetFieldByName("histogram") -> type()};
+  auto bin_builder = static_cast<arrow::UInt32Builder*>(histogram.value_builder());
+
+  auto append = [&] (int id, const channel_summary& channel) {
+    ARROW_RETURN_NOT_OK(sipm    .Append(id));
+    ARROW_RETURN_NOT_OK(mean    .Append(channel.moments.mean));
+    ARROW_RETURN_NOT_OK(variance.Append(channel.moments.variance()));
+    for (size_t q=0; q<quantiles.size(); q++) { ARROW_RETURN_NOT_OK(quantiles[q].Append(channel.quantiles[q].value())); }
+    ARROW_RETURN_NOT_OK(hist_max .Append(channel.counts.max));
+    ARROW_RETURN_NOT_OK(histogram.Append());
+    return bin_builder -> AppendValues(channel.counts.bins);
+  };
+  ARROW_RETURN_NOT_OK(append(-1, summary.total()));
+  for (size_t n=0; n<summary.sipms().size(); n++) { ARROW_RETURN_NOT_OK(append(n, summary.sipms()[n])); }
+
+  std::vector<std::shared_ptr<arrow::Array>> arrays;
+  ARROW_ASSIGN_OR_RAISE(auto sipm_array    , sipm    .Finish()); arrays.push_back(sipm_array);
+  ARROW_ASSIGN_OR_RAISE(auto mean_array    , mean    .Finish()); arrays.push_back(mean_array);
+  ARROW_ASSIGN_OR_RAISE(auto variance_array, variance.Finish()); arrays.push_back(variance_array);
+  for (auto& q: quantiles) { ARROW_ASSIGN_OR_RAISE(auto q_array, q.Finish()); arrays.push_back(q_array); }
+  ARROW_ASSIGN_OR_RAISE(auto max_array     , hist_max .Finish()); arrays.push_back(max_array);
+  ARROW_ASSIGN_OR_RAISE(auto hist_array    , histogram.Finish()); arrays.push_back(hist_array);
+
+  auto writer = make_writer(schema, pool, cfg -> summary.outfile);
+  ARROW_RETURN_NOT_OK(writer -> WriteTable(*arrow::Table::Make(schema, arrays), arrays[0] -> length()));
+  return writer -> Close();
+}
+
+arrow::Result<output_format_enum> file_format(const std::string& filename) {
+  // Pipes cannot be peeked into, and only streams can be written to them
+  if (std::filesystem::is_fifo(filename)) { return output_format_enum::stream; }
+  ARROW_ASSIGN_OR_RAISE(auto input, arrow::io::ReadableFile::Open(filename));
+  ARROW_ASSIGN_OR_RAISE(auto magic, input -> ReadAt(0, 6));
+  auto start = magic -> ToString();
+  if (start.starts_with("PAR1"  )) { return output_format_enum::parquet; }
+  if (start.starts_with("ARROW1")) { return output_format_enum::feather; }
+  return output_format_enum::stream;
+}
+
+arrow::Result<std::shared_ptr<arrow::io::RandomAccessFile>> open_random_access(const std::string& filename) {
+  if (my.read_memory_map) { return arrow::io::MemoryMappedFile::Open(filename, arrow::io::FileMode::READ); }
+  return arrow::io::ReadableFile::Open(filename);
+}
+
+arrow::Result<std::unique_ptr<parquet::arrow::FileReader>> open_parquet(
+  const std::string& filename, std::shared_ptr<parquet::FileMetaData> metadata)
+{
+  ARROW_ASSIGN_OR_RAISE(auto input, open_random_access(filename));
+
+  auto arrow_props = parquet::default_arrow_reader_properties();
+  arrow_props.set_use_threads(my.read_threads);
+  arrow_props.set_pre_buffer (my.read_pre_buffer);
+
+  parquet::arrow::FileReaderBuilder builder;
+  ARROW_RETURN_NOT_OK(builder.Open(input, parquet::default_reader_properties(), metadata));
   std::unique_ptr<parquet::arrow::FileReader> reader;
-  std::shared_ptr<arrow::Table>                table;
+  ARROW_RETURN_NOT_OK(builder.memory_pool(arrow::default_memory_pool())
+                            -> properties(arrow_props)
+                            -> Build(&reader));
+  return reader;
+}
+
+arrow::Result<std::shared_ptr<arrow::Table>> read_ipc_table(const std::string& filename, output_format_enum format,
+                                                            const schema_check& check) {
+  std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+  std::shared_ptr<arrow::Schema> schema;
+  if (format == output_format_enum::feather) {
+    // Memory-mapped, so the columns point straight into the file
+    ARROW_ASSIGN_OR_RAISE(auto input , arrow::io::MemoryMappedFile::Open(filename, arrow::io::FileMode::READ));
+    ARROW_ASSIGN_OR_RAISE(auto reader, arrow::ipc::RecordBatchFileReader::Open(input));
+    if (check) { ARROW_RETURN_NOT_OK(check(*reader -> schema())); }
+    for (int i=0; i<reader -> num_record_batches(); i++) {
+      ARROW_ASSIGN_OR_RAISE(auto batch, reader -> ReadRecordBatch(i));
+      batches.push_back(batch);
+    }
+    schema = reader -> schema();
+  } else {
+    ARROW_ASSIGN_OR_RAISE(auto input , open_input(filename));
+    ARROW_ASSIGN_OR_RAISE(auto reader, arrow::ipc::RecordBatchStreamReader::Open(input));
+    if (check) { ARROW_RETURN_NOT_OK(check(*reader -> schema())); } // Only the schema message has been read
+    std::shared_ptr<arrow::RecordBatch> batch;
+    while (true) {
+      ARROW_RETURN_NOT_OK(reader -> ReadNext(&batch));
+      if (! batch) { break; }
+      batches.push_back(batch);
+    }
+    schema = reader -> schema();
+  }
+  return arrow::Table::FromRecordBatches(schema, batches);
+}
 
-  ARROW_ASSIGN_OR_RAISE(input, arrow::io::ReadableFile::Open(filename));
-  ARROW_RETURN_NOT_OK  (parquet::arrow::OpenFile(input, pool, &reader));
+arrow::Result<std::shared_ptr<arrow::Table>> read_table(const std::string& filename, const schema_check& check) {
+  ARROW_ASSIGN_OR_RAISE(auto format, file_format(filename));
+  if (format != output_format_enum::parquet) {
+    ARROW_ASSIGN_OR_RAISE(auto table, read_ipc_table(filename, format, check));
+    return dequantise(table);
+  }
+
+  std::shared_ptr<arrow::Table> table;
+  ARROW_ASSIGN_OR_RAISE(auto reader, open_parquet(filename));
+  if (check) {
+    // From the footer: no row group has been touched yet
+    std::shared_ptr<arrow::Schema> schema;
+    ARROW_RETURN_NOT_OK(reader -> GetSchema(&schema));
+    ARROW_RETURN_NOT_OK(check(*schema));
+  }
   ARROW_RETURN_NOT_OK  (reader -> ReadTable(&table));
+  return dequantise(table);
+}
+
+std::string schema_fingerprint(const arrow::Schema& schema) {
+  return fnv1a_hex(schema.ToString(/*show_metadata =*/ false));
+}
 
-  if (! make_schema() -> Equals(*table->schema())) { return arrow::Status::Invalid("Schemas do not match"); }
+std::string expected_fingerprint(const resolved_config& cfg) {
+  return schema_fingerprint(arrow::Schema{fields(cfg)});
+}
 
-  auto batch   = table -> CombineChunksToBatch().ValueOrDie();
-  auto columns = batch -> columns();
-  const auto* x = columns[0] -> data() -> GetValues<float>(1); // I do not understand the meaning of 1
-  const auto* y = columns[1] -> data() -> GetValues<float>(1); // I do not understand the meaning of 1
-  const auto* z = columns[2] -> data() -> GetValues<float>(1); // I do not understand the meaning of 1
+// The columns read back into EVENTs must be there, with the types
+// `parquet_writer` gives them; the number of SiPMs is whatever the file has
+arrow::Status check_event_columns(const arrow::Schema& schema, const std::string& filename) {
+  auto check = [&] (const std::string& name, auto matches) {
+    auto field = schema.GetFieldByName(name);
+    if (! field                   ) { return arrow::Status::Invalid("No column '", name, "' in ", filename); }
+    if (! matches(*field -> type())) { return arrow::Status::Invalid("Unexpected type of column '", name, "' in ", filename, ": ", field -> type() -> ToString()); }
+    return arrow::Status::OK();
+  };
+  auto is = [] (std::shared_ptr<arrow::DataType> expected) { return [=] (const arrow::DataType& t) { return t.Equals(*expected); }; };
+  ARROW_RETURN_NOT_OK(check("x"            , is(arrow::float32())));
+  ARROW_RETURN_NOT_OK(check("y"            , is(arrow::float32())));
+  ARROW_RETURN_NOT_OK(check("z"            , is(arrow::float32())));
+  ARROW_RETURN_NOT_OK(check("interactions" , is(arrow::list(arrow::field("interaction", interaction_type, NOT_NULLABLE)))));
+  ARROW_RETURN_NOT_OK(check("photon_counts", [] (const arrow::DataType& t) {
+    return t.id() == arrow::Type::FIXED_SIZE_LIST
+        && static_cast<const arrow::FixedSizeListType&>(t).value_type() -> Equals(*arrow::uint32());
+  }));
+  return arrow::Status::OK();
+}
 
-  const auto  interactions_list   = static_pointer_cast<arrow::  ListArray>(columns[3]);
+MAYBE_EVENTS read_entire_file(const std::string& filename, const std::optional<std::string>& fingerprint) {
+  // The fingerprint is that of the columns as stored, compared before any is read
+  auto check_fingerprint = [&] (const arrow::Schema& stored) {
+    if (schema_fingerprint(stored) == fingerprint.value()) { return arrow::Status::OK(); }
+    return arrow::Status::Invalid("Schema of ", filename, " does not match the expected fingerprint");
+  };
+  ARROW_ASSIGN_OR_RAISE(auto table, read_table(filename, fingerprint.has_value() ? schema_check{check_fingerprint} : schema_check{}));
+
+  auto schema = table -> schema();
+  ARROW_RETURN_NOT_OK(check_event_columns(*schema, filename));
+
+  ARROW_ASSIGN_OR_RAISE(auto batch, table -> CombineChunksToBatch());
+  auto column = [&] (const std::string& name) { return batch -> GetColumnByName(name); };
+  const auto* x = column("x") -> data() -> GetValues<float>(1); // Buffer 1 holds the values; 0 is the validity bitmap
+  const auto* y = column("y") -> data() -> GetValues<float>(1);
+  const auto* z = column("z") -> data() -> GetValues<float>(1);
+
+  const auto  interactions_list   = static_pointer_cast<arrow::  ListArray>(column("interactions"));
   const auto  interactions_fields = static_pointer_cast<arrow::StructArray>(interactions_list -> values()) -> fields();
-  const auto* i_x    = interactions_fields[0] -> data() -> GetValues<float         >(1);
-  const auto* i_y    = interactions_fields[1] -> data() -> GetValues<float         >(1);
-  const auto* i_z    = interactions_fields[2] -> data() -> GetValues<float         >(1);
-  const auto* i_edep = interactions_fields[3] -> data() -> GetValues<float         >(1);
-  const auto* i_type = interactions_fields[4] -> data() -> GetValues<unsigned short>(1);
+  const auto* i_x    = interactions_fields[0] -> data() -> GetValues<float   >(1);
+  const auto* i_y    = interactions_fields[1] -> data() -> GetValues<float   >(1);
+  const auto* i_z    = interactions_fields[2] -> data() -> GetValues<float   >(1);
+  const auto* i_edep = interactions_fields[3] -> data() -> GetValues<float   >(1);
+  const auto* i_type = interactions_fields[4] -> data() -> GetValues<uint32_t>(1);
 
-  const auto counts_list  = static_pointer_cast<arrow::FixedSizeListArray>(columns[4]);
+  const auto counts_list  = static_pointer_cast<arrow::FixedSizeListArray>(column("photon_counts"));
   const auto counts_start = static_pointer_cast<arrow::UInt32Array>(counts_list -> values()) -> raw_values();
 
   std::vector<EVENT> rows;
@@ -301,15 +1055,63 @@ MAYBE_EVENTS read_entire_file(const std::string& filename) {
 
 arrow::Result< std::unordered_map<std::string, std::string>>
 read_metadata(const std::string& filename) {
-  arrow::MemoryPool* pool = arrow::default_memory_pool();
   std::shared_ptr<arrow::io::RandomAccessFile> input;
-  std::unique_ptr<parquet::arrow::FileReader> reader;
+  std::unordered_map<std::string, std::string> meta;
 
-  ARROW_ASSIGN_OR_RAISE(input, arrow::io::ReadableFile::Open(filename));
-  ARROW_RETURN_NOT_OK  (parquet::arrow::OpenFile(input, pool, &reader));
+  ARROW_ASSIGN_OR_RAISE(auto format, file_format(filename));
+  if (format == output_format_enum::feather) {
+    ARROW_ASSIGN_OR_RAISE(input, arrow::io::MemoryMappedFile::Open(filename, arrow::io::FileMode::READ));
+    ARROW_ASSIGN_OR_RAISE(auto ipc_reader, arrow::ipc::RecordBatchFileReader::Open(input));
+    if (ipc_reader -> schema() -> metadata()) { ipc_reader -> schema() -> metadata() -> ToUnorderedMap(&meta); }
+    return meta;
+  }
+  if (format == output_format_enum::stream) {
+    ARROW_ASSIGN_OR_RAISE(auto stream    , open_input(filename));
+    ARROW_ASSIGN_OR_RAISE(auto ipc_reader, arrow::ipc::RecordBatchStreamReader::Open(stream));
+    if (ipc_reader -> schema() -> metadata()) { ipc_reader -> schema() -> metadata() -> ToUnorderedMap(&meta); }
+    return meta;
+  }
 
-  auto kv_meta = reader -> parquet_reader() -> metadata() -> key_value_metadata();
-  std::unordered_map<std::string, std::string> meta;
-  kv_meta -> ToUnorderedMap(&meta);
+  // Only the footer is parsed: no reader, and no row group is touched
+  ARROW_ASSIGN_OR_RAISE(input, open_random_access(filename));
+  std::shared_ptr<parquet::FileMetaData> file_meta;
+  try {
+    file_meta = parquet::ReadMetaData(input);
+  } catch (const parquet::ParquetException& e) {
+    return arrow::Status::IOError("Could not read the metadata of ", filename, ": ", e.what());
+  }
+  if (file_meta -> key_value_metadata()) { file_meta -> key_value_metadata() -> ToUnorderedMap(&meta); }
   return meta;
 }
+
+arrow::Result<light_response> read_light_response(const std::string& filename) {
+  std::shared_ptr<arrow::Table> table;
+  ARROW_ASSIGN_OR_RAISE(auto reader, open_parquet(filename));
+  ARROW_RETURN_NOT_OK  (reader -> ReadTable(&table));
+  ARROW_ASSIGN_OR_RAISE(auto batch, table -> CombineChunksToBatch());
+
+  auto column = [&] (const std::string& name) -> arrow::Result<std::shared_ptr<arrow::Array>> {
+    auto found = batch -> GetColumnByName(name);
+    if (! found) { return arrow::Status::Invalid("No column '", name, "' in ", filename, ": not a scan file?"); }
+    return found;
+  };
+  ARROW_ASSIGN_OR_RAISE(auto x_column   , column("x"));
+  ARROW_ASSIGN_OR_RAISE(auto y_column   , column("y"));
+  ARROW_ASSIGN_OR_RAISE(auto z_column   , column("z"));
+  ARROW_ASSIGN_OR_RAISE(auto mean_column, column("mean_counts"));
+
+  const auto* x = x_column -> data() -> GetValues<float>(1);
+  const auto* y = y_column -> data() -> GetValues<float>(1);
+  const auto* z = z_column -> data() -> GetValues<float>(1);
+  const auto  mean_list  = static_pointer_cast<arrow::FixedSizeListArray>(mean_column);
+  const auto  mean_start = static_pointer_cast<arrow::FloatArray>(mean_list -> values()) -> raw_values();
+
+  auto n_points = batch -> num_rows();
+  light_response out{ .n_sipms = static_cast<size_t>(mean_list -> value_length()) };
+  out.x.assign(x, x + n_points);
+  out.y.assign(y, y + n_points);
+  out.z.assign(z, z + n_points);
+  out.mean.assign( mean_start + mean_list -> value_offset(0)
+                 , mean_start + mean_list -> value_offset(n_points));
+  return out;
+}
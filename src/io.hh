@@ -1,12 +1,22 @@
 #pragma once
 
+#include "config.hh"
+#include "reconstruction.hh"
+#include "scan.hh"
+#include "summary.hh"
+
 #include <G4ThreeVector.hh>
 
 #include <arrow/api.h>
+#include <parquet/arrow/reader.h>
 #include <parquet/arrow/writer.h>
 
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <optional>
 #include <unordered_map>
+#include <vector>
 
 struct interaction {
   float x, y, z;
@@ -18,38 +28,154 @@ struct interaction {
   {}
 };
 
+// Per-event data which is only written when enabled in the config
+struct optional_columns {
+  std::vector<float> charge;    // digitised charge per SiPM, in photoelectrons
+  std::vector<float> sipm_time; // digitised timestamp per SiPM
+  std::vector<std::vector<uint32_t>> arrival_times; // first K per SiPM, delta-encoded ps
+  std::vector<float> t_first;    // earliest arrival time per SiPM
+  std::vector<float> t_quantile; // configured quantile of arrival times per SiPM
+  float weight = 1;              // statistical weight when interactions are forced
+};
+
+
+// Destination of the tables built by `parquet_writer`: a parquet file, or
+// an Arrow IPC file (Feather v2) or stream, which are cheaper to write and
+// to read back, and can be memory-mapped or consumed while being written
+class table_sink {
+public:
+  virtual ~table_sink() = default;
+  virtual arrow::Status write(const arrow::Table& table, int64_t chunk_size) = 0;
+  virtual arrow::Status close() = 0;
+};
+
+// The format `automatic` stands for, given the name of the output file
+output_format_enum resolve_output_format(output_format_enum format, const std::string& filename);
+// Writes to `cfg.outfile`, in `cfg.output_format` with `cfg.ipc_compression`
+std::unique_ptr<table_sink> make_sink(std::shared_ptr<arrow::Schema> schema, arrow::MemoryPool* pool, const resolved_config& cfg);
 
 class parquet_writer {
 public:
-  parquet_writer();
+  parquet_writer(std::shared_ptr<const resolved_config> cfg = my.frozen());
   ~parquet_writer();
 
-  arrow::Status append(const G4ThreeVector& pos, const std::vector<interaction>& interactions, std::unordered_map<size_t, size_t> counts);
+  arrow::Status append(const G4ThreeVector& pos, const std::vector<interaction>& interactions, const std::unordered_map<size_t, size_t>& counts,
+                       const optional_columns& extra = {});
   arrow::Status write();
 
 private:
   arrow::Result<std::shared_ptr<arrow::Table>> make_table();
+  std::shared_ptr<const resolved_config> cfg;
   arrow::MemoryPool* pool;
 
-  // Half float doesn't work
+  // Half float doesn't work: see /my/position_resolution for narrower
+  // columns, converted from these when a chunk is written
   std::shared_ptr<arrow::FloatBuilder>         x_builder;
   std::shared_ptr<arrow::FloatBuilder>         y_builder;
   std::shared_ptr<arrow::FloatBuilder>         z_builder;
   std::shared_ptr<arrow::ListBuilder>          interactions_builder;
   std::shared_ptr<arrow::FixedSizeListBuilder> counts_builder;
+  std::shared_ptr<arrow::FixedSizeListBuilder> charge_builder;
+  std::shared_ptr<arrow::FixedSizeListBuilder> sipm_time_builder;
+  std::shared_ptr<arrow::FixedSizeListBuilder> arrival_times_builder;
+  std::shared_ptr<arrow::FixedSizeListBuilder> t_first_builder;
+  std::shared_ptr<arrow::FixedSizeListBuilder> t_quantile_builder;
+  std::shared_ptr<arrow::FloatBuilder>         weight_builder;
 
   std::shared_ptr<arrow::Schema>               schema;
-  std::unique_ptr<parquet::arrow::FileWriter>  writer;
+  std::unique_ptr<table_sink>                  writer;
+
+  // Positions are reconstructed a whole chunk at a time, from the
+  // finished photon_counts column
+  std::optional<reconstructor> reco;
+  reco_batch                   reco_out;
 
   unsigned n_rows = 0;
 };
 
 
+// One row per scan position, instead of one per event
+class scan_writer {
+public:
+  scan_writer(std::shared_ptr<const resolved_config> cfg = my.frozen());
+  ~scan_writer();
+
+  arrow::Status append(const scan_summary& summary);
+  arrow::Status write();
+
+private:
+  std::shared_ptr<const resolved_config> cfg;
+  arrow::MemoryPool* pool;
+
+  std::shared_ptr<arrow::FloatBuilder>         x_builder;
+  std::shared_ptr<arrow::FloatBuilder>         y_builder;
+  std::shared_ptr<arrow::FloatBuilder>         z_builder;
+  std::shared_ptr<arrow::UInt32Builder>        n_events_builder;
+  std::shared_ptr<arrow::FixedSizeListBuilder> mean_builder;
+  std::shared_ptr<arrow::FixedSizeListBuilder> variance_builder;
+  std::shared_ptr<arrow::FixedSizeListBuilder> histogram_builder;
+
+  std::shared_ptr<arrow::Schema>               schema;
+  std::unique_ptr<parquet::arrow::FileWriter>  writer;
+
+  int64_t n_rows = 0;
+};
+
+// Schema of the files written by `scan_writer`
+std::shared_ptr<arrow::Schema> make_scan_schema(const resolved_config& cfg);
+
+// One row per SiPM and one for their sum (sipm = -1), with the event
+// counts and fractions in the metadata
+std::shared_ptr<arrow::Schema> make_summary_schema(const resolved_config& cfg, const run_summary& summary);
+arrow::Status write_summary(const run_summary& summary, std::shared_ptr<const resolved_config> cfg = my.frozen());
+
+// Shared by every parquet file we write: compression from the config,
+// and the Arrow schema stored for easier reads back into Arrow
+std::unique_ptr<parquet::arrow::FileWriter> make_writer(std::shared_ptr<arrow::Schema> schema, arrow::MemoryPool* pool, const std::string& filename);
+// Hash of the column names and types of a schema, ignoring its metadata
+std::string schema_fingerprint(const arrow::Schema& schema);
+// Fingerprint of the files `parquet_writer` writes with `cfg`, which is
+// also stored in their metadata as `schema_fingerprint`, for tools which
+// only look at the metadata; our readers hash the stored schema instead
+std::string expected_fingerprint(const resolved_config& cfg);
+// Config, git and CLI metadata stored in every output file
+std::shared_ptr<const arrow::KeyValueMetadata> metadata();
+
+
 using EVENT = std::tuple<G4ThreeVector, std::vector<interaction>, std::unordered_map<size_t, size_t>>;
 using MAYBE_EVENTS = arrow::Result<std::vector<EVENT>>;
 
-MAYBE_EVENTS read_entire_file(const std::string& filename);
+// Parquet reader set up by the /my/read_* options: memory-mapped input,
+// columns decoded in parallel and column chunks pre-buffered with
+// coalesced reads. Readers of a file which already has its footer parsed
+// can pass its `metadata`, so that it is not read again.
+arrow::Result<std::unique_ptr<parquet::arrow::FileReader>> open_parquet(
+  const std::string& filename, std::shared_ptr<parquet::FileMetaData> metadata = nullptr);
+
+// Any of the formats written by `parquet_writer`, told apart by content.
+// The layout, including the number of SiPMs, comes from the file itself,
+// not from the config. Given a `fingerprint`, files whose stored columns
+// have another one are rejected from their footer or IPC schema, before
+// any data is read.
+MAYBE_EVENTS read_entire_file(const std::string& filename, const std::optional<std::string>& fingerprint = std::nullopt);
+// `check` is given the schema as stored, before any data is read, and
+// can refuse the file
+using schema_check = std::function<arrow::Status(const arrow::Schema&)>;
+arrow::Result<std::shared_ptr<arrow::Table>> read_table(const std::string& filename, const schema_check& check = {});
+arrow::Result<output_format_enum> file_format(const std::string& filename);
+
+// Files written with /my/position_resolution, /my/edep_resolution or
+// /my/count_bits store fixed-point integers, with their scales in the
+// metadata. These turn them back into the float32 and uint32 columns of
+// other files, leaving those untouched; `read_table` and `dataset` already
+// do so.
+arrow::Result<std::shared_ptr<arrow::Table      >> dequantise(const std::shared_ptr<arrow::Table      >& table);
+arrow::Result<std::shared_ptr<arrow::RecordBatch>> dequantise(const std::shared_ptr<arrow::RecordBatch>& batch);
+arrow::Result<std::shared_ptr<arrow::Schema     >> dequantised_schema(const std::shared_ptr<arrow::Schema>& schema);
 
 arrow::Result<
   std::unordered_map<std::string, std::string>
 > read_metadata(const std::string& filename);
+
+// Light response of every SiPM over the grid of a file written by `scan_writer`
+arrow::Result<light_response> read_light_response(const std::string& filename);
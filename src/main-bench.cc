@@ -0,0 +1,342 @@
+#include <actions.hh>
+#include <analysis.hh>
+#include <config.hh>
+#include <geometry.hh>
+#include <io.hh>
+#include <physics-list.hh>
+#include <synthetic.hh>
+
+#include <n4-all.hh>
+
+#include <G4UImanager.hh>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+void usage() {
+  std::cerr <<
+      "Usage: crystal-bench [OPTIONS]\n"
+      "options\n"
+      "   --events N               events per simulation workload (default 200)\n"
+      "   --rows N                 rows in the writer and reader workloads (default 100000)\n"
+      "   --only NAME,...          run only these workloads\n"
+      "   --list                   list the workloads and exit\n"
+      "   --out FILE               write the JSON report to FILE (default: stdout)\n"
+      "   --baseline FILE          compare against a report written earlier\n"
+      "   --tolerance T            allowed relative regression (default 0.1)\n"
+      "   --tolerance-for METRIC=T allowed relative regression of one metric\n"
+      "\n"
+      "   Exits with status 2 when some metric regressed beyond its tolerance." << std::endl;
+  exit(1);
+}
+
+using metrics = std::map<std::string, double>;
+using report  = std::map<std::string, metrics>;
+
+// Lower is better for these; higher for all others
+bool lower_is_better(const std::string& metric) { return metric == "peak_rss_mb"; }
+
+std::vector<std::string> split(const std::string& s, char sep) {
+  std::vector<std::string> out;
+  std::stringstream stream{s};
+  for (std::string item; std::getline(stream, item, sep);) { if (! item.empty()) { out.push_back(item); } }
+  return out;
+}
+
+double peak_rss_mb() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss / 1024.0; // kB on Linux
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+fs::path scratch_file(const std::string& name) {
+  return fs::temp_directory_path() / ("crystal-bench-" + std::to_string(getpid()) + "-" + name);
+}
+
+// -------------------------------------------------------------------------
+// Workloads: each one runs in its own process, as every simulation needs
+// its own Geant4 run manager, and so that peak RSS is per workload
+
+unsigned n_events = 200;
+size_t   n_rows   = 100'000;
+
+metrics simulate(const std::vector<std::string>& commands) {
+  auto outfile = scratch_file("events.parquet");
+  auto UI = G4UImanager::GetUIpointer();
+  UI -> ApplyCommand("/my/seed 123456789");
+  UI -> ApplyCommand("/my/report_steps false");
+  UI -> ApplyCommand("/my/outfile " + outfile.string());
+  for (const auto& command: commands) { UI -> ApplyCommand(command); }
+
+  run_stats stats;
+  auto rm = n4::run_manager::create()
+    .fake_ui()
+    .physics(physics_list)
+    .geometry([&] {return crystal_geometry(stats);})
+    .actions(create_actions(stats))
+    .run(0); // Initialisation is not part of the measurement
+
+  auto start = std::chrono::steady_clock::now();
+  rm -> run(n_events);
+  auto elapsed = seconds_since(start);
+
+  // Counting steps slows the stepping down, so they are counted in an
+  // untimed second pass over the same events
+  UI -> ApplyCommand("/my/seed 123456789");
+  UI -> ApplyCommand("/my/report_steps true");
+  rm -> run(n_events);
+  auto optical_steps = n_steps_of("opticalphoton");
+  fs::remove(outfile);
+
+  return { {"events_per_s"       , n_events      / elapsed}
+         , {"optical_steps_per_s", optical_steps / elapsed}
+         , {"peak_rss_mb"        , peak_rss_mb()          } };
+}
+
+void write_synthetic(const fs::path& filename) {
+  G4UImanager::GetUIpointer() -> ApplyCommand("/my/config_type csi_mono");
+  my.outfile = filename.string();
+  auto cfg = my.freeze();
+  synthetic_events events{cfg -> sipm_positions, cfg -> scint_size};
+  parquet_writer writer{cfg};
+  for (size_t i=0; i<n_rows; i++) {
+    auto event = events.next();
+    if (! writer.append(event.primary_pos, event.interactions, event.counts).ok()) {
+      throw std::runtime_error{"could not append synthetic event"};
+    }
+  }
+}
+
+metrics write_only() {
+  auto filename = scratch_file("writer.parquet");
+  auto start = std::chrono::steady_clock::now();
+  write_synthetic(filename);
+  auto elapsed = seconds_since(start);
+  auto size_mb = fs::file_size(filename) / 1e6;
+  fs::remove(filename);
+  return { {"writer_mb_per_s" , size_mb / elapsed}
+         , {"writer_rows_per_s", n_rows  / elapsed}
+         , {"peak_rss_mb"     , peak_rss_mb()    } };
+}
+
+metrics read_only() {
+  auto filename = scratch_file("reader.parquet");
+  write_synthetic(filename);
+  auto start = std::chrono::steady_clock::now();
+  auto events = read_entire_file(filename.string());
+  auto elapsed = seconds_since(start);
+  if (! events.ok() || events -> size() != n_rows) { throw std::runtime_error{"could not read back synthetic events"}; }
+  auto size_mb = fs::file_size(filename) / 1e6;
+  fs::remove(filename);
+  return { {"reader_mb_per_s"  , size_mb / elapsed}
+         , {"reader_rows_per_s", n_rows  / elapsed}
+         , {"peak_rss_mb"      , peak_rss_mb()    } };
+}
+
+metrics analyse_only() {
+  auto filename = scratch_file("analysis.parquet");
+  write_synthetic(filename);
+  auto start = std::chrono::steady_clock::now();
+  auto features = analyse_counts(filename.string());
+  auto elapsed = seconds_since(start);
+  if (! features.ok() || features -> size() != n_rows) { throw std::runtime_error{"could not analyse synthetic events"}; }
+  fs::remove(filename);
+  return { {"analysis_rows_per_s", n_rows / elapsed}
+         , {"peak_rss_mb"        , peak_rss_mb()   } };
+}
+
+const std::vector<std::pair<std::string, std::function<metrics()>>> workloads {
+  {"gammas-csi"     , [] { return simulate({"/my/config_type csi"     }); }},
+  {"gammas-lyso"    , [] { return simulate({"/my/config_type lyso"    }); }},
+  {"gammas-bgo"     , [] { return simulate({"/my/config_type bgo"     }); }},
+  {"gammas-csi_mono", [] { return simulate({"/my/config_type csi_mono"}); }},
+  {"photons"        , [] { return simulate({"/my/generator photons", "/source/nphotons 10000"}); }},
+  {"writer"         , write_only},
+  {"reader"         , read_only },
+  {"analysis"       , analyse_only},
+};
+
+// Runs the workload in a child process, whose results come back through
+// a file in the same format as the cache of `stats`
+std::optional<metrics> run_in_child(const std::function<metrics()>& workload) {
+  auto results = scratch_file("results");
+  auto pid = fork();
+  if (pid < 0) { std::cerr << "fork failed" << std::endl; exit(EXIT_FAILURE); }
+  if (pid == 0) {
+    // Geant4 and the event printout are not part of the report
+    auto devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    try {
+      auto values = workload();
+      std::ofstream out{results};
+      out << std::setprecision(17);
+      for (const auto& [name, value]: values) { out << name << ' ' << value << '\n'; }
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      _exit(EXIT_FAILURE);
+    }
+    _exit(EXIT_SUCCESS);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  if (! (WIFEXITED(status) && WEXITSTATUS(status) == 0)) { fs::remove(results); return {}; }
+
+  metrics values;
+  std::ifstream in{results};
+  std::string name; double value;
+  while (in >> name >> value) { values[name] = value; }
+  fs::remove(results);
+  return values;
+}
+
+// -------------------------------------------------------------------------
+// JSON: only what the reports need, an object of objects of numbers
+
+void write_json(std::ostream& out, const report& r) {
+  out << std::setprecision(10) << "{\n";
+  for (auto w = r.begin(); w != r.end(); w++) {
+    out << "  \"" << w -> first << "\": {";
+    for (auto m = w -> second.begin(); m != w -> second.end(); m++) {
+      out << (m == w -> second.begin() ? "" : ",") << "\n    \"" << m -> first << "\": " << m -> second;
+    }
+    out << "\n  }" << (std::next(w) == r.end() ? "" : ",") << '\n';
+  }
+  out << "}\n";
+}
+
+report read_json(std::istream& in) {
+  auto fail = [] (const std::string& what) { throw std::runtime_error{"malformed report: " + what}; };
+  auto skip = [&] { in >> std::ws; };
+  auto expect = [&] (char c) { skip(); if (in.get() != c) { fail(std::string{"expected '"} + c + "'"); } };
+  auto peek_is = [&] (char c) { skip(); return in.peek() == c; };
+  auto string = [&] {
+    expect('"');
+    std::string s;
+    if (! std::getline(in, s, '"')) { fail("unterminated string"); }
+    return s;
+  };
+  // Calls `item` for each key of an object
+  auto object = [&] (auto item) {
+    expect('{');
+    if (peek_is('}')) { in.get(); return; }
+    while (true) {
+      auto key = string();
+      expect(':');
+      item(key);
+      if (! peek_is(',')) { break; }
+      in.get();
+    }
+    expect('}');
+  };
+
+  report r;
+  object([&] (const std::string& workload) {
+    object([&] (const std::string& metric) {
+      double value;
+      if (! (in >> value)) { fail("expected number for " + workload + "." + metric); }
+      r[workload][metric] = value;
+    });
+  });
+  return r;
+}
+
+// -------------------------------------------------------------------------
+
+// Prints every metric present in both reports, returns the number of regressions
+unsigned compare(const report& baseline, const report& current, double tolerance, const std::map<std::string, double>& tolerance_for) {
+  unsigned regressions = 0;
+  using std::setw;
+  std::cerr << std::left << setw(18) << "workload" << setw(22) << "metric" << std::right
+            << setw(14) << "baseline" << setw(14) << "current" << setw(10) << "change" << '\n';
+  for (const auto& [workload, values]: current) {
+    if (! baseline.contains(workload)) { continue; }
+    for (const auto& [metric, value]: values) {
+      if (! baseline.at(workload).contains(metric)) { continue; }
+      auto reference = baseline.at(workload).at(metric);
+      auto change    = reference != 0 ? value / reference - 1 : 0;
+      auto allowed   = tolerance_for.contains(metric) ? tolerance_for.at(metric) : tolerance;
+      auto worse     = lower_is_better(metric) ? change > allowed : change < -allowed;
+      regressions   += worse;
+      std::cerr << std::left << setw(18) << workload << setw(22) << metric << std::right << std::fixed << std::setprecision(2)
+                << setw(14) << reference << setw(14) << value << setw(9) << 100 * change << '%'
+                << (worse ? "  REGRESSION" : "") << '\n';
+    }
+  }
+  return regressions;
+}
+
+int main(int argc, char** argv) {
+  std::vector<std::string> only;
+  std::string out_file, baseline_file;
+  double tolerance = 0.1;
+  std::map<std::string, double> tolerance_for;
+
+  for (int i=1; i<argc; i++) {
+    std::string arg = argv[i];
+    auto next = [&] { if (++i == argc) { usage(); } return std::string{argv[i]}; };
+    if      (arg == "--events"       ) { n_events  = std::stoul(next()); }
+    else if (arg == "--rows"         ) { n_rows    = std::stoul(next()); }
+    else if (arg == "--only"         ) { only      = split(next(), ','); }
+    else if (arg == "--out"          ) { out_file  = next(); }
+    else if (arg == "--baseline"     ) { baseline_file = next(); }
+    else if (arg == "--tolerance"    ) { tolerance = std::stod(next()); }
+    else if (arg == "--tolerance-for") {
+      auto spec = split(next(), '=');
+      if (spec.size() != 2) { usage(); }
+      tolerance_for[spec[0]] = std::stod(spec[1]);
+    }
+    else if (arg == "--list") {
+      for (const auto& [name, _]: workloads) { std::cout << name << '\n'; }
+      return 0;
+    }
+    else { usage(); }
+  }
+
+  report current;
+  unsigned failed = 0;
+  for (const auto& [name, workload]: workloads) {
+    if (! only.empty() && std::find(begin(only), end(only), name) == end(only)) { continue; }
+    std::cerr << "running " << name << std::endl;
+    auto values = run_in_child(workload);
+    if (values.has_value()) { current[name] = std::move(values.value()); }
+    else                    { std::cerr << name << " failed" << std::endl; failed++; }
+  }
+
+  if (out_file.empty()) { write_json(std::cout, current); }
+  else                  { std::ofstream out{out_file}; write_json(out, current); }
+
+  if (failed > 0) { return 1; }
+  if (baseline_file.empty()) { return 0; }
+
+  std::ifstream in{baseline_file};
+  if (! in) { std::cerr << "could not open baseline " << baseline_file << std::endl; return 1; }
+  auto regressions = compare(read_json(in), current, tolerance, tolerance_for);
+  if (regressions > 0) {
+    std::cerr << regressions << " metrics regressed by more than the tolerance" << std::endl;
+    return 2;
+  }
+  return 0;
+}
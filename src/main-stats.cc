@@ -1,3 +1,4 @@
+#include <hash.hh>
 #include <physics-list.hh>
 
 #include <pet-materials.hh>
@@ -7,81 +8,295 @@
 #include <n4-stream.hh>
 #include <n4-will-become-external-lib.hh>
 
+#include <G4Element.hh>
 #include <G4Material.hh>
 #include <G4SystemOfUnits.hh>
 #include <G4UnitsTable.hh>
 
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
 #include <iomanip>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
 
 void usage() {
   std::cerr <<
-      "Usage: stats CALCULATION MATERIAL\n"
+      "Usage: stats CALCULATION MATERIALS [ENERGIES] [OPTIONS]\n"
       "where\n"
-      "   CALCULATION = fractions | interaction-length\n"
-      "   MATERIAL    = bgo | csi | lyso" << std::endl;
+      "   CALCULATION = fractions | interaction-length | table\n"
+      "   MATERIALS   = comma-separated list of bgo | csi | csitl | lyso\n"
+      "   ENERGIES    = comma-separated list of gamma energies in keV (default 511)\n"
+      "options\n"
+      "   -j N         run at most N calculations at once (default: number of cores)\n"
+      "   --csv FILE   also write the table to FILE\n"
+      "   --cache DIR  cache directory (default: $XDG_CACHE_HOME/crystal-stats)\n"
+      "   --no-cache   recalculate everything\n"
+      "\n"
+      "   Process fractions are only available at 511 keV." << std::endl;
   exit(1);
 }
 
-std::vector<double> interaction_lengths(const std::string name, G4Material* material, std::vector<double> distances) {
+std::string downcase(std::string s) {
+  for (auto& c: s) { c = std::tolower(c); }
+  return s;
+}
+
+std::vector<std::string> split(const std::string& s, char sep) {
+  std::vector<std::string> out;
+  std::stringstream stream{s};
+  for (std::string item; std::getline(stream, item, sep);) { if (! item.empty()) { out.push_back(item); } }
+  return out;
+}
+
+const auto distances = n4::scale_by(mm, {5, 10, 15, 20, 25, 30, 35, 40, 45, 50});
+const size_t n_events = 100'000;
+
+enum class calculation { fractions, interaction_length };
+
+struct job {
+  calculation kind;
+  std::string material_name;
+  G4Material* material;
+  double      energy;
+  std::string key;
+};
+
+struct result {
+  std::optional<double> length_mean, length_error;
+  std::optional<double> photoelectric, compton, rayleigh;
+};
+
+// -------------------------------------------------------------------------
+// Cache: one small text file per calculation, named by a hash of everything
+// which determines the result
+
+std::string material_definition(const G4Material* material) {
+  std::ostringstream out;
+  out << std::setprecision(10) << material -> GetName() << ' ' << material -> GetDensity() / (g/cm3);
+  auto fractions = material -> GetFractionVector();
+  for (size_t i=0; i<material -> GetNumberOfElements(); i++) {
+    out << ' ' << material -> GetElement(i) -> GetName() << ':' << fractions[i];
+  }
+  return out.str();
+}
+
+std::string cache_key(calculation kind, const G4Material* material, double energy) {
+  std::ostringstream spec;
+  spec << std::setprecision(10)
+       << (kind == calculation::fractions ? "fractions" : "interaction-length")
+       << '|' << material_definition(material)
+       << '|' << energy / keV
+       << '|' << physics_list_description();
+  if (kind == calculation::interaction_length) {
+    spec << '|' << n_events;
+    for (auto d: distances) { spec << ' ' << d / mm; }
+  }
+  return fnv1a_hex(spec.str());
+}
+
+fs::path default_cache_dir() {
+  if (auto xdg  = std::getenv("XDG_CACHE_HOME")) { return fs::path{xdg } / "crystal-stats"; }
+  if (auto home = std::getenv("HOME"          )) { return fs::path{home} / ".cache" / "crystal-stats"; }
+  return fs::temp_directory_path() / "crystal-stats";
+}
+
+std::optional<std::map<std::string, double>> read_cached(const fs::path& file) {
+  std::ifstream in{file};
+  if (! in) { return std::nullopt; }
+  std::map<std::string, double> values;
+  std::string name; double value;
+  while (in >> name >> value) { values[name] = value; }
+  return values;
+}
+
+// Written under a temporary name and renamed, so that concurrent or
+// interrupted calculations never leave a partial file behind
+void write_cached(const fs::path& file, const std::map<std::string, double>& values) {
+  auto tmp = file; tmp += ".tmp" + std::to_string(getpid());
+  {
+    std::ofstream out{tmp};
+    out << std::setprecision(17);
+    for (const auto& [name, value]: values) { out << name << ' ' << value << '\n'; }
+  }
+  fs::rename(tmp, file);
+}
+
+// -------------------------------------------------------------------------
+// Calculations: each one runs in its own process, as every one of them
+// needs its own Geant4 run manager
+
+std::map<std::string, double> calculate(const job& j) {
+  n4::silence hush{std::cout};
+  if (j.kind == calculation::fractions) {
+    auto fractions = calculate_interaction_process_fractions(j.material, physics_list());
+    return { {"photoelectric", fractions.photoelectric}
+           , {"compton"      , fractions.compton      }
+           , {"rayleigh"     , fractions.rayleigh     } };
+  }
   interaction_length_config config{ .physics         = physics_list()
-                                  , .material        = material
+                                  , .material        = j.material
                                   , .particle_name   = "gamma"
-                                  , .particle_energy = 511 * keV
+                                  , .particle_energy = j.energy
                                   , .distances       = distances
-                                  , .n_events        = 100'000};
-  auto i_lengths = measure_interaction_length(config);
-
-  return i_lengths;
+                                  , .n_events        = n_events};
+  auto lengths = measure_interaction_length(config);
+  auto mean    = n4::stats::mean(lengths).value();
+  double var = 0;
+  for (auto l: lengths) { var += (l - mean) * (l - mean); }
+  var /= std::max<size_t>(lengths.size() - 1, 1);
+  return { {"length_mean" , mean}
+         , {"length_error", std::sqrt(var / lengths.size())} };
 }
 
-void fractions(const std::string& material_name, G4Material* material) {
-  std::cout << "Calculating interaction fractions for : '" << material_name << "'\n";
-  auto fractions = [&] {
-    n4::silence hush{std::cout};
-    return calculate_interaction_process_fractions(material, physics_list());
-  }();
-  using std::setw; using std::setprecision; using std::fixed;
-  std::cout
-      << "\nphotoelectric: " << fixed << setw(4) << setprecision(1) << fractions.photoelectric * 100 << '%'   << std::endl
-      <<   "compton      : " << fixed << setw(4) << setprecision(1) << fractions.compton       * 100 << '%'   << std::endl
-      <<   "rayleigh     : " << fixed << setw(4) << setprecision(1) << fractions.rayleigh      * 100 << "%\n" << std::endl;
+// Runs the jobs which are not cached yet, with at most `max_parallel`
+// child processes at a time
+void run_missing(const std::vector<job>& jobs, const fs::path& cache, unsigned max_parallel) {
+  std::vector<const job*> missing;
+  for (const auto& j: jobs) { if (! fs::exists(cache / j.key)) { missing.push_back(&j); } }
+  if (missing.empty()) { return; }
+  std::cerr << "Running " << missing.size() << " calculations (" << jobs.size() - missing.size() << " cached), "
+            << max_parallel << " at a time" << std::endl;
+
+  unsigned running = 0, failed = 0;
+  auto wait_for_one = [&] {
+    int status;
+    if (wait(&status) > 0) { running--; failed += ! (WIFEXITED(status) && WEXITSTATUS(status) == 0); }
+  };
+
+  for (auto j: missing) {
+    if (running == max_parallel) { wait_for_one(); }
+    auto pid = fork();
+    if (pid < 0) { std::cerr << "fork failed" << std::endl; exit(EXIT_FAILURE); }
+    if (pid == 0) {
+      write_cached(cache / j -> key, calculate(*j));
+      _exit(EXIT_SUCCESS);
+    }
+    running++;
+  }
+  while (running > 0) { wait_for_one(); }
+  if (failed > 0) { std::cerr << failed << " calculations failed" << std::endl; }
 }
 
-void interaction_length(const std::string& material_name, G4Material* material) {
-
-  auto distances = n4::scale_by(mm, {5, 10, 15, 20, 25, 30, 35, 40, 45, 50});
-  std::cout << "Calculating attenuation lengths for : '" << material_name << "'\n"
-            << distances.size() << " statistical samples: ";
-  std::string name;
-  auto results = [&] {
-    n4::silence hush{std::cout};
-    return interaction_lengths(name, material, distances);
-  }();
-  for (const auto& d: results) { std::cout << G4BestUnit(d, "Length") << ' '; }
-  std::cout << std::endl;
-  auto mean = n4::stats::mean(results).value();
-  std::cout << "Mean: " << G4BestUnit(mean, "Length") << std::endl << std::endl;
+// -------------------------------------------------------------------------
+
+G4Material* material_called(const std::string& choice, std::string& name) {
+  if (choice == "csi"  ) { name = "CsI"    ; return petmat::   csi_with_properties(std::nullopt); }
+  if (choice == "csitl") { name = "CsI(Tl)"; return petmat::csi_tl_with_properties(std::nullopt); }
+  if (choice == "bgo"  ) { name = "BGO"    ; return petmat::   bgo_with_properties(std::nullopt); }
+  if (choice == "lyso" ) { name = "LYSO"   ; return petmat::  lyso_with_properties(std::nullopt); }
+  std::cerr << "Unknown material " << choice << std::endl;
+  usage();
+  return nullptr;
 }
 
-std::string downcase(std::string s) {
-  for (auto& c: s) { c = std::tolower(c); }
-  return s;
+void print_table(std::ostream& out, const std::vector<std::pair<std::string, double>>& rows,
+                 const std::map<std::pair<std::string, double>, result>& results, bool csv) {
+  auto cell = [] (std::optional<double> v, double scale) {
+    if (! v.has_value()) { return std::string{"-"}; }
+    std::ostringstream s; s << std::fixed << std::setprecision(2) << v.value() / scale;
+    return s.str();
+  };
+  using std::setw;
+  if (csv) { out << "material,energy_keV,attenuation_length_mm,attenuation_length_error_mm,photoelectric_pct,compton_pct,rayleigh_pct\n"; }
+  else     { out << setw(8) << "material" << setw(10) << "E/keV" << setw(12) << "length/mm" << setw(10) << "+-"
+                 << setw(10) << "photo/%"  << setw(10) << "compt/%" << setw(10) << "rayl/%" << '\n'; }
+  for (const auto& row: rows) {
+    const auto& r = results.at(row);
+    std::vector<std::string> cells { row.first, cell(row.second, keV)
+                                   , cell(r.length_mean  , mm), cell(r.length_error, mm)
+                                   , cell(r.photoelectric, 0.01), cell(r.compton, 0.01), cell(r.rayleigh, 0.01) };
+    for (size_t i=0; i<cells.size(); i++) {
+      if (csv) { out << (i ? "," : "") << cells[i]; }
+      else     { out << setw(i == 2 ? 12 : i ? 10 : 8) << cells[i]; }
+    }
+    out << '\n';
+  }
 }
 
 int main(int argc, char** argv) {
-  if (argc < 3) { std::cout << "Error: not enough arguments\n"; usage(); }
-  auto material_choice = downcase(argv[2]);
-  std::string name;
-  G4Material* material = nullptr;
+  std::vector<std::string> positional;
+  unsigned max_parallel = std::max(std::thread::hardware_concurrency(), 1u);
+  std::optional<std::string> csv;
+  fs::path cache_dir = default_cache_dir();
+  bool use_cache = true;
+
+  for (int i=1; i<argc; i++) {
+    std::string arg = argv[i];
+    auto next = [&] { if (++i == argc) { usage(); } return std::string{argv[i]}; };
+    if      (arg == "-j"        ) { max_parallel = std::max(std::stoi(next()), 1); }
+    else if (arg == "--csv"     ) { csv          = next(); }
+    else if (arg == "--cache"   ) { cache_dir    = next(); }
+    else if (arg == "--no-cache") { use_cache    = false; }
+    else                          { positional.push_back(arg); }
+  }
+  if (positional.size() < 2) { std::cout << "Error: not enough arguments\n"; usage(); }
+
+  auto task_choice = downcase(positional[0]);
+  bool want_fractions = task_choice == "fractions"          || task_choice == "table";
+  bool want_lengths   = task_choice == "interaction-length" || task_choice == "table";
+  if (! want_fractions && ! want_lengths) { std::cerr << "Unknown calculation: " << task_choice << std::endl; usage(); }
+
+  std::vector<double> energies{511 * keV};
+  if (positional.size() > 2) {
+    energies.clear();
+    for (const auto& e: split(positional[2], ',')) { energies.push_back(std::stod(e) * keV); }
+  }
+
+  if (! use_cache) { cache_dir = fs::temp_directory_path() / ("crystal-stats-" + std::to_string(getpid())); }
+  fs::create_directories(cache_dir);
+
+  std::vector<job> jobs;
+  std::vector<std::pair<std::string, double>> rows;
+  for (const auto& choice: split(downcase(positional[1]), ',')) {
+    std::string name;
+    auto material = material_called(choice, name);
+    for (auto energy: energies) {
+      rows.emplace_back(name, energy);
+      if (want_lengths) {
+        jobs.push_back({calculation::interaction_length, name, material, energy, cache_key(calculation::interaction_length, material, energy)});
+      }
+      if (want_fractions && std::abs(energy - 511 * keV) < 1e-9 * keV) {
+        jobs.push_back({calculation::fractions, name, material, energy, cache_key(calculation::fractions, material, energy)});
+      }
+    }
+  }
 
-  if      (material_choice == "csi" ) { name = "CsI" ; material = petmat:: csi_with_properties(std::nullopt); }
-  else if (material_choice == "bgo" ) { name = "BGO" ; material = petmat:: bgo_with_properties(std::nullopt); }
-  else if (material_choice == "lyso") { name = "LYSO"; material = petmat::lyso_with_properties(std::nullopt); }
-  else                                { std::cerr << "Unknown material " << material_choice << std::endl; usage(); }
+  run_missing(jobs, cache_dir, max_parallel);
 
-  auto task_choice = downcase(argv[1]);
-  if      (task_choice == "fractions"         ) {          fractions(name, material); }
-  else if (task_choice == "interaction-length") { interaction_length(name, material); }
-  else    { std:: cerr << "Unknown calculation: " << task_choice << std::endl; usage(); }
+  std::map<std::pair<std::string, double>, result> results;
+  for (const auto& row: rows) { results[row]; }
+  for (const auto& j: jobs) {
+    auto values = read_cached(cache_dir / j.key);
+    if (! values.has_value()) { continue; }
+    auto& r = results[{j.material_name, j.energy}];
+    auto get = [&] (const char* name) -> std::optional<double> {
+      auto found = values -> find(name);
+      return found == values -> end() ? std::nullopt : std::make_optional(found -> second);
+    };
+    if (j.kind == calculation::fractions) {
+      r.photoelectric = get("photoelectric"); r.compton = get("compton"); r.rayleigh = get("rayleigh");
+    } else {
+      r.length_mean = get("length_mean"); r.length_error = get("length_error");
+    }
+  }
+  if (! use_cache) { fs::remove_all(cache_dir); }
 
+  print_table(std::cout, rows, results, false);
+  if (csv.has_value()) {
+    std::ofstream out{csv.value()};
+    print_table(out, rows, results, true);
+  }
 }
@@ -1,14 +1,150 @@
 #include "physics-list.hh"
 
 #include "config.hh"
+#include "geometry.hh"
+#include "hash.hh"
 
 #include <FTFP_BERT.hh>
+#include <G4EmStandardPhysics.hh>
+#include <G4EmStandardPhysics_option3.hh>
 #include <G4EmStandardPhysics_option4.hh>
+#include <G4GenericBiasingPhysics.hh>
+#include <G4OpticalParameters.hh>
 #include <G4OpticalPhysics.hh>
+#include <G4RunManager.hh>
+#include <G4StepLimiterPhysics.hh>
+#include <G4VModularPhysicsList.hh>
+#include <G4Version.hh>
+
+#include <unistd.h>
+
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+// Cache entry which `physics_list` asked Geant4 to read the tables from
+static std::string retrieved_from;
+
+G4VPhysicsConstructor* em_physics() {
+  switch (my.em_physics) {
+    case em_physics_enum::option4 : return new G4EmStandardPhysics_option4{my.physics_verbosity};
+    case em_physics_enum::option3 : return new G4EmStandardPhysics_option3{my.physics_verbosity};
+    case em_physics_enum::standard: return new G4EmStandardPhysics        {my.physics_verbosity};
+  }
+  return nullptr; // unreachable
+}
 
 G4VUserPhysicsList* physics_list() {
-  auto physics_list =             new FTFP_BERT                  {my.physics_verbosity};
-  physics_list ->  ReplacePhysics(new G4EmStandardPhysics_option4{my.physics_verbosity});
-  physics_list -> RegisterPhysics(new G4OpticalPhysics           {my.physics_verbosity});
+  G4VModularPhysicsList* physics_list = nullptr;
+  switch (my.physics_list) {
+  case physics_list_enum::full:
+    physics_list = new FTFP_BERT{my.physics_verbosity};
+    physics_list -> ReplacePhysics(em_physics());
+    break;
+  case physics_list_enum::lean:
+    // Nothing but what 511 keV gammas, their secondaries and optical
+    // photons need: no hadronic or decay physics, and only the particles
+    // defined by the EM constructor
+    physics_list = new G4VModularPhysicsList;
+    physics_list -> SetVerboseLevel(my.physics_verbosity);
+    physics_list -> RegisterPhysics(em_physics());
+    break;
+  }
+  physics_list -> RegisterPhysics(new G4OpticalPhysics{my.physics_verbosity});
+  // Cuts of the world and wrapping; the crystal and readout regions set their own
+  physics_list -> SetDefaultCutValue(my.default_cut);
+  // Enforces the step limit which the geometry attaches to the crystal
+  if (my.crystal_max_step > 0) { physics_list -> RegisterPhysics(new G4StepLimiterPhysics); }
+
+  auto params = G4OpticalParameters::Instance();
+  for (const auto& [process, active]: my.optical_processes) {
+    params -> SetProcessActivation(process, active);
+  }
+  params -> SetCerenkovMaxPhotonsPerStep       (my.cerenkov_max_photons);
+  params -> SetCerenkovTrackSecondariesFirst   (my.track_secondaries_first);
+  params -> SetScintTrackSecondariesFirst      (my.track_secondaries_first);
+  params -> SetScintByParticleType             (my.scint_by_particle_type);
+
+  // When only the deposits are recorded, no optical photons are needed:
+  // they will be generated from the deposits in a later run
+  if (! my.record_deposits.empty()) {
+    params -> SetProcessActivation("Scintillation", false);
+    params -> SetProcessActivation("Cerenkov"     , false);
+  }
+
+  // Lets the geometry attach the operator which forces gammas to interact
+  if (my.force_interaction) {
+    auto biasing = new G4GenericBiasingPhysics;
+    biasing -> Bias("gamma");
+    physics_list -> RegisterPhysics(biasing);
+  }
+
+  // Geant4 checks that the stored cuts and materials match the current
+  // ones, and rebuilds the tables if they do not
+  if (! my.physics_table_cache.empty() && fs::exists(physics_table_dir())) {
+    retrieved_from = physics_table_dir();
+    physics_list -> SetPhysicsTableRetrieved(retrieved_from);
+  }
   return physics_list;
 }
+
+std::string physics_table_dir() {
+  auto key = fnv1a_hex(physics_list_description() + '|' + placed_materials_description());
+  return (fs::path{my.physics_table_cache} / key).string();
+}
+
+void store_physics_tables() {
+  if (my.physics_table_cache.empty()) { return; }
+  auto dir = fs::path{physics_table_dir()};
+
+  // Every worker thread gets here: the first one stores, the rest skip
+  static std::mutex            mutex;
+  static std::set<std::string> stored;
+  std::lock_guard lock{mutex};
+  if (! stored.insert(dir.string()).second) { return; }
+
+  // Storing does not modify the list, but Geant4 does not mark it const
+  auto physics_list = const_cast<G4VUserPhysicsList*>(G4RunManager::GetRunManager() -> GetUserPhysicsList());
+  if (physics_list -> IsPhysicsTableRetrieved()) { return; }
+  // An entry which this job tried to read was rejected by Geant4 and must
+  // be replaced; any other one was stored by a concurrent job meanwhile
+  auto stale = retrieved_from == dir.string();
+  if (fs::exists(dir) && ! stale) { return; }
+
+  // Written to a private directory and renamed into place, so concurrent
+  // jobs never read a half-written cache entry
+  auto suffix = std::to_string(getpid()) + "-" + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+  auto tmp = dir; tmp += ".tmp-"   + suffix;
+  auto old = dir; old += ".stale-" + suffix;
+  std::error_code error;
+  fs::create_directories(tmp, error);
+  if (! error && physics_list -> StorePhysicsTable(tmp.string())) {
+    if (stale) { fs::rename(dir, old, error); }
+    fs::rename(tmp, dir, error);
+    fs::remove_all(old, error);
+    if (fs::exists(dir) && ! fs::exists(tmp)) { return; }
+  }
+  // Another job got there first, or the cache is not writable
+  fs::remove_all(tmp, error);
+  if (! fs::exists(dir)) { std::cerr << "could not store physics tables in " << dir << std::endl; }
+}
+
+std::string physics_list_description() {
+  std::string description = my.physics_list == physics_list_enum::lean ? "lean" : "FTFP_BERT";
+  description += "+EM-" + em_physics_enum_to_string(my.em_physics) + "+optical";
+  for (const auto& [process, active]: my.optical_processes) {
+    description += (active ? "+" : "-") + process;
+  }
+  if (! my.record_deposits.empty()) { description += "-scint-cerenkov"; }
+  if (  my.scint_by_particle_type ) { description += "+scint-by-particle"; }
+  if (  my.force_interaction      ) { description += "+biasing(gamma)"; }
+  if (  my.crystal_max_step > 0   ) { description += "+steplimit"; }
+  description += " cuts " + std::to_string(my.default_cut / mm) + "/" + std::to_string(my.crystal_cut / mm)
+               +        "/" + std::to_string(my.readout_cut / mm) + " mm";
+  return description + " G4 " + G4VERSION_TAG;
+}
@@ -2,4 +2,17 @@
 
 #include "G4VUserPhysicsList.hh"
 
+#include <string>
+
 G4VUserPhysicsList* physics_list();
+// Identifies the physics which `physics_list` builds with the current
+// config, for keying cached results
+std::string physics_list_description();
+
+// Entry of the physics table cache for the current config: changes
+// whenever the physics list, cuts, placed materials or Geant4 version do
+std::string physics_table_dir();
+// Writes the tables built by this job to the cache, unless they were
+// read from it, replacing an entry which Geant4 rejected. Must be called
+// after the run manager is initialised.
+void store_physics_tables();
@@ -0,0 +1,113 @@
+#include "reconstruction.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+reconstructor::reconstructor(const reco_params& params, const std::vector<G4ThreeVector>& sipm_positions,
+                             std::optional<light_response> lrf)
+  : params{params}
+  , n_sipms{sipm_positions.size()}
+{
+  for (const auto& p: sipm_positions) {
+    sipm_x.push_back(p.x());
+    sipm_y.push_back(p.y());
+  }
+  if (params.method != reco_method_enum::ml) { return; }
+
+  if (! lrf.has_value()      ) { throw std::invalid_argument{"maximum likelihood reconstruction needs a light response"}; }
+  if (lrf -> n_sipms != n_sipms) { throw std::invalid_argument{"light response was made with a different number of SiPMs"}; }
+
+  // Only the shape of the light distribution matters: the total is free
+  auto n_points = lrf -> n_points();
+  log_shape.resize(n_points * n_sipms);
+  for (size_t k=0; k<n_points; k++) {
+    const float* mean = &lrf -> mean[k * n_sipms];
+    double total = 0;
+    for (size_t i=0; i<n_sipms; i++) { total += mean[i]; }
+    for (size_t i=0; i<n_sipms; i++) {
+      // Floor avoids log(0) where the scan saw no light at all
+      auto p = std::max<double>(mean[i], 1e-3) / std::max(total, 1e-3);
+      log_shape[k * n_sipms + i] = std::log(p);
+    }
+  }
+  point_x = std::move(lrf -> x);
+  point_y = std::move(lrf -> y);
+  point_z = std::move(lrf -> z);
+}
+
+void reconstructor::reconstruct(const uint32_t* raw_counts, size_t n_events, reco_batch& out) {
+  counts.assign(raw_counts, raw_counts + n_events * n_sipms);
+  out.x  .assign(n_events, std::numeric_limits<float>::quiet_NaN());
+  out.y  .assign(n_events, std::numeric_limits<float>::quiet_NaN());
+  out.doi.assign(n_events, std::numeric_limits<float>::quiet_NaN());
+
+  switch (params.method) {
+    case reco_method_enum::none     : return;
+    case reco_method_enum::truncated: {
+      // Subtracting a fraction of the maximum suppresses the long tails of
+      // the light distribution, which pull the plain centroid to the centre
+      for (size_t e=0; e<n_events; e++) {
+        float* row = &counts[e * n_sipms];
+        auto cut = static_cast<float>(params.truncation) * *std::max_element(row, row + n_sipms);
+        for (size_t i=0; i<n_sipms; i++) { row[i] = std::max(row[i] - cut, 0.0f); }
+      }
+      [[fallthrough]];
+    }
+    case reco_method_enum::anger    : centroids     (n_events, out); return;
+    case reco_method_enum::ml       : max_likelihood(n_events, out); return;
+  }
+}
+
+void reconstructor::centroids(size_t n_events, reco_batch& out) const {
+  const float* sx = sipm_x.data();
+  const float* sy = sipm_y.data();
+  for (size_t e=0; e<n_events; e++) {
+    const float* c = &counts[e * n_sipms];
+    float sum = 0, mx = 0, my = 0;
+    for (size_t i=0; i<n_sipms; i++) {
+      sum += c[i];
+      mx  += c[i] * sx[i];
+      my  += c[i] * sy[i];
+    }
+    if (sum <= 0) { continue; }
+    auto x = mx / sum, y = my / sum;
+    float spread = 0;
+    for (size_t i=0; i<n_sipms; i++) {
+      auto dx = sx[i] - x, dy = sy[i] - y;
+      spread += c[i] * (dx * dx + dy * dy);
+    }
+    out.x  [e] = x;
+    out.y  [e] = y;
+    out.doi[e] = std::sqrt(spread / sum);
+  }
+}
+
+// Poisson likelihood with free normalisation: up to terms which do not
+// depend on the position, log L(k) = sum_i n_i log p_ik, where p_ik is the
+// fraction of the light seen by SiPM i from point k. The scores of the
+// whole batch are then a single matrix product.
+void reconstructor::max_likelihood(size_t n_events, reco_batch& out) {
+  auto n_points = point_x.size();
+  scores.assign(n_events * n_points, 0);
+  for (size_t e=0; e<n_events; e++) {
+    const float* c = &counts[e * n_sipms];
+    float* score   = &scores[e * n_points];
+    for (size_t k=0; k<n_points; k++) {
+      const float* lp = &log_shape[k * n_sipms];
+      float s = 0;
+      for (size_t i=0; i<n_sipms; i++) { s += c[i] * lp[i]; }
+      score[k] = s;
+    }
+  }
+  for (size_t e=0; e<n_events; e++) {
+    const float* c = &counts[e * n_sipms];
+    if (std::all_of(c, c + n_sipms, [] (float n) { return n == 0; })) { continue; }
+    const float* score = &scores[e * n_points];
+    auto best = std::max_element(score, score + n_points) - score;
+    out.x  [e] = point_x[best];
+    out.y  [e] = point_y[best];
+    out.doi[e] = point_z[best];
+  }
+}
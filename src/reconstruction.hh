@@ -0,0 +1,62 @@
+#pragma once
+
+#include <G4ThreeVector.hh>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+enum class reco_method_enum { none, anger, truncated, ml };
+
+struct reco_params {
+  reco_method_enum method;
+  double           truncation; // truncated: fraction of the largest count subtracted from every SiPM
+  std::string      lrf_file;   // ml: scan file whose mean counts are the light response
+};
+
+// Mean counts of every SiPM at each point of a grid of source positions,
+// as written by the scan generator. `mean` is row-major: one row per point.
+struct light_response {
+  size_t             n_sipms;
+  std::vector<float> x, y, z;
+  std::vector<float> mean;
+
+  size_t n_points() const { return x.size(); }
+};
+
+// Estimated interaction position of a batch of events
+struct reco_batch {
+  std::vector<float> x, y;
+  // Anger and truncated: RMS spread of the light around the centroid,
+  // which shrinks as the interaction approaches the readout face.
+  // ml: depth of the best-fitting point of the light response.
+  std::vector<float> doi;
+};
+
+// Works on whole batches of events, with counts laid out as in the
+// photon_counts column: contiguous, one row of `n_sipms` per event. The
+// inner loops run over SiPMs in structure-of-arrays form, so that the
+// compiler can vectorise them.
+class reconstructor {
+public:
+  reconstructor(const reco_params& params, const std::vector<G4ThreeVector>& sipm_positions,
+                std::optional<light_response> lrf = std::nullopt);
+
+  void reconstruct(const uint32_t* counts, size_t n_events, reco_batch& out);
+
+private:
+  void centroids      (size_t n_events, reco_batch& out) const;
+  void max_likelihood (size_t n_events, reco_batch& out);
+
+  reco_params        params;
+  size_t             n_sipms;
+  std::vector<float> sipm_x, sipm_y;
+  std::vector<float> counts;  // Current batch, as floats
+
+  // ml: log of the light response normalised to unit sum, one row per point
+  std::vector<float> log_shape;
+  std::vector<float> point_x, point_y, point_z;
+  std::vector<float> scores;
+};
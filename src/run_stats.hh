@@ -2,6 +2,7 @@
 
 #include <cstddef>
 #include <unordered_map>
+#include <vector>
 
 struct run_stats {
   unsigned n_detected_evt   = 0;
@@ -10,4 +11,6 @@ struct run_stats {
   float n_events_over_threshold_fraction() const;
   std::unordered_map<size_t, size_t> n_detected_at_sipm;
   size_t n_sipms_over_threshold(size_t threshold) const;
+  // Only filled when some per-event stage needs photon arrival times
+  std::unordered_map<size_t, std::vector<double>> arrival_times_at_sipm;
 };
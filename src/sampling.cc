@@ -0,0 +1,107 @@
+#include "sampling.hh"
+
+#include <Randomize.hh>
+
+#include <G4PhysicalConstants.hh>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+alias_sampler::alias_sampler(std::vector<double> x_, std::vector<double> y_)
+  : x{std::move(x_)}
+  , y{std::move(y_)}
+{
+  if (x.size() != y.size() || x.size() < 2) {
+    throw std::invalid_argument{"alias_sampler needs matching x and y with at least 2 points"};
+  }
+
+  auto n_bins = x.size() - 1;
+  std::vector<double> weight(n_bins);
+  double total = 0;
+  for (size_t i=0; i<n_bins; i++) {
+    weight[i] = (x[i+1] - x[i]) * (y[i] + y[i+1]) / 2;
+    total    += weight[i];
+  }
+
+  // Vose's method: pair each under-full bin with an over-full one
+  prob .resize(n_bins);
+  alias.resize(n_bins);
+  std::vector<uint32_t> small, large;
+  for (size_t i=0; i<n_bins; i++) {
+    weight[i] *= n_bins / total;
+    (weight[i] < 1 ? small : large).push_back(i);
+  }
+  while (! small.empty() && ! large.empty()) {
+    auto s = small.back(); small.pop_back();
+    auto l = large.back();
+    prob [s] = weight[s];
+    alias[s] = l;
+    weight[l] -= 1 - weight[s];
+    if (weight[l] < 1) { large.pop_back(); small.push_back(l); }
+  }
+  // Whatever is left is full up to rounding errors
+  for (auto i: small) { prob[i] = 1; alias[i] = i; }
+  for (auto i: large) { prob[i] = 1; alias[i] = i; }
+}
+
+double alias_sampler::from_uniforms(double u_bin, double u_within) const {
+  auto n_bins = prob.size();
+  auto scaled = u_bin * n_bins;
+  auto i      = std::min(static_cast<size_t>(scaled), n_bins - 1);
+  auto bin    = scaled - i < prob[i] ? i : alias[i];
+
+  // Inverse CDF of the linear density between y0 and y1, written so
+  // that it remains stable when the density is flat
+  auto y0 = y[bin], y1 = y[bin+1];
+  auto target = u_within * (y0 + y1) / 2;
+  auto denom  = y0 + std::sqrt(y0*y0 + 2 * (y1 - y0) * target);
+  auto t      = denom > 0 ? 2 * target / denom : u_within;
+  return x[bin] + t * (x[bin+1] - x[bin]);
+}
+
+double alias_sampler::sample() const {
+  return from_uniforms(G4UniformRand(), G4UniformRand());
+}
+
+void alias_sampler::sample(std::vector<double>& out, size_t n) const {
+  std::vector<double> u;
+  fill_uniform(u, 2*n);
+  out.resize(n);
+  for (size_t i=0; i<n; i++) { out[i] = from_uniforms(u[2*i], u[2*i+1]); }
+}
+
+void fill_uniform(std::vector<double>& out, size_t n) {
+  out.resize(n);
+  if (n > 0) { G4Random::getTheEngine() -> flatArray(static_cast<int>(n), out.data()); }
+}
+
+void isotropic_directions( size_t n
+                         , std::vector<G4ThreeVector>& directions
+                         , std::vector<G4ThreeVector>& polarisations) {
+  std::vector<double> u;
+  fill_uniform(u, 3*n);
+
+  // Structure of arrays, so that the trigonometry is done in simple
+  // loops which the compiler can vectorise
+  std::vector<double> cos_theta(n), sin_theta(n), phi(n), psi(n);
+  for (size_t i=0; i<n; i++) {
+    cos_theta[i] = 2 * u[3*i] - 1;
+    sin_theta[i] = std::sqrt(1 - cos_theta[i] * cos_theta[i]);
+    phi      [i] = twopi * u[3*i + 1];
+    psi      [i] = twopi * u[3*i + 2];
+  }
+
+  directions   .resize(n);
+  polarisations.resize(n);
+  for (size_t i=0; i<n; i++) {
+    auto cos_phi = std::cos(phi[i]), sin_phi = std::sin(phi[i]);
+    auto& d = directions[i];
+    d.set(sin_theta[i] * cos_phi, sin_theta[i] * sin_phi, cos_theta[i]);
+
+    // Orthonormal basis of the plane perpendicular to d
+    G4ThreeVector e1{cos_theta[i] * cos_phi, cos_theta[i] * sin_phi, -sin_theta[i]};
+    G4ThreeVector e2{-sin_phi, cos_phi, 0};
+    polarisations[i] = std::cos(psi[i]) * e1 + std::sin(psi[i]) * e2;
+  }
+}
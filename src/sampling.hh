@@ -0,0 +1,38 @@
+#pragma once
+
+#include <G4ThreeVector.hh>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Samples a piecewise-linear density, such as a scintillation spectrum.
+// The bin is chosen in constant time with Vose's alias method, then the
+// position within the bin by inverting the CDF of its linear density.
+class alias_sampler {
+public:
+  alias_sampler(std::vector<double> x, std::vector<double> y);
+
+  double sample() const;
+  // Faster per value than `sample`: the uniforms are generated in one go
+  void sample(std::vector<double>& out, size_t n) const;
+
+  // Maps two independent uniforms in [0, 1) onto the distribution
+  double from_uniforms(double u_bin, double u_within) const;
+
+private:
+  std::vector<double>   x;
+  std::vector<double>   y;
+  std::vector<double>   prob;
+  std::vector<uint32_t> alias;
+};
+
+// Fills `out` with n uniforms in (0, 1) from the current Geant4 engine,
+// with a single call into the engine
+void fill_uniform(std::vector<double>& out, size_t n);
+
+// n isotropic unit vectors, and as many random unit vectors
+// perpendicular to them, as needed for optical photon polarisations
+void isotropic_directions( size_t n
+                         , std::vector<G4ThreeVector>& directions
+                         , std::vector<G4ThreeVector>& polarisations);
@@ -0,0 +1,49 @@
+#include "scan.hh"
+
+#include <algorithm>
+#include <cmath>
+
+G4ThreeVector scan_params::position(size_t index, const G4ThreeVector& scint_size) const {
+  auto iz = index % nz; index /= nz;
+  auto iy = index % ny; index /= ny;
+  auto ix = index % nx;
+  auto centre = [] (size_t i, unsigned n, double width) { return (i + 0.5) * width / n; };
+  return { centre(ix, nx, scint_size.x()) - scint_size.x() / 2
+         , centre(iy, ny, scint_size.y()) - scint_size.y() / 2
+         , centre(iz, nz, scint_size.z()) - scint_size.z()     };
+}
+
+scan_accumulator::scan_accumulator(const scan_params& params, size_t n_sipms)
+  : params{params}
+  , stats(n_sipms)
+  , histogram(n_sipms, std::vector<uint32_t>(params.hist_bins, 0))
+{}
+
+void scan_accumulator::add(const std::unordered_map<size_t, size_t>& counts) {
+  auto bin_width = params.hist_max / params.hist_bins;
+  for (size_t n=0; n<stats.size(); n++) {
+    auto found = counts.find(n);
+    double count = found == counts.end() ? 0 : found -> second;
+    stats[n].add(count);
+    auto bin = std::min(static_cast<size_t>(count / bin_width), histogram[n].size() - 1);
+    histogram[n][bin]++;
+  }
+  n_events++;
+}
+
+scan_summary scan_accumulator::summarise(size_t position) const {
+  scan_summary out{position, n_events, {}, {}, histogram};
+  out.mean    .reserve(stats.size());
+  out.variance.reserve(stats.size());
+  for (const auto& s: stats) {
+    out.mean    .push_back(s.mean);
+    out.variance.push_back(s.variance());
+  }
+  return out;
+}
+
+void scan_accumulator::reset() {
+  n_events = 0;
+  std::fill(begin(stats), end(stats), running_stats{});
+  for (auto& h: histogram) { std::fill(begin(h), end(h), 0); }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <G4ThreeVector.hh>
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Grid of source positions visited by the scan generator, with the
+// binning of the per-SiPM count histograms accumulated at each position
+struct scan_params {
+  unsigned nx, ny, nz;
+  unsigned events_per_position;
+  unsigned hist_bins;
+  double   hist_max; // counts; larger ones go in the last bin
+
+  size_t n_positions() const { return static_cast<size_t>(nx) * ny * nz; }
+  // Positions are visited in order, each for `events_per_position` events
+  size_t position_of_event(size_t event_id) const { return (event_id / events_per_position) % n_positions(); }
+  // Centre of a cell of the grid spanning the crystal, whose entrance
+  // face is at z = -scint_size.z() and readout face at z = 0
+  G4ThreeVector position(size_t index, const G4ThreeVector& scint_size) const;
+};
+
+// Numerically stable single-pass mean and variance (Welford)
+struct running_stats {
+  size_t n    = 0;
+  double mean = 0;
+  double m2   = 0;
+
+  void add(double x) {
+    n++;
+    auto delta = x - mean;
+    mean += delta / n;
+    m2   += delta * (x - mean);
+  }
+  double variance() const { return n > 1 ? m2 / (n - 1) : 0; }
+};
+
+// Summary of all events generated at one scan position
+struct scan_summary {
+  size_t                             position;
+  size_t                             n_events;
+  std::vector<float>                 mean;      // per SiPM
+  std::vector<float>                 variance;  // per SiPM
+  std::vector<std::vector<uint32_t>> histogram; // per SiPM, `hist_bins` bins
+};
+
+// Accumulates the counts of one position at a time: the scan visits the
+// positions in order, so memory does not grow with the size of the grid
+class scan_accumulator {
+public:
+  scan_accumulator(const scan_params& params, size_t n_sipms);
+
+  void add(const std::unordered_map<size_t, size_t>& counts);
+  bool empty() const { return n_events == 0; }
+  scan_summary summarise(size_t position) const;
+  void reset();
+
+private:
+  scan_params                        params;
+  size_t                             n_events = 0;
+  std::vector<running_stats>         stats;
+  std::vector<std::vector<uint32_t>> histogram;
+};
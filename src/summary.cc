@@ -0,0 +1,149 @@
+#include "summary.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+p2_quantile::p2_quantile(double p)
+  : p{p}
+  , height{}
+  , position {1, 2,         3,     4,           5}
+  , desired  {1, 1 + 2 * p, 1 + 4 * p, 3 + 2 * p, 5}
+  , increment{0,     p / 2,     p, (1 + p) / 2, 1}
+{}
+
+void p2_quantile::add(double x) {
+  if (n < 5) {
+    height[n++] = x;
+    if (n == 5) { std::sort(begin(height), end(height)); }
+    return;
+  }
+
+  // Cell containing x, extending the extreme markers if needed
+  size_t k;
+  if      (x <  height[0]) { height[0] = x; k = 0; }
+  else if (x >= height[4]) { height[4] = x; k = 3; }
+  else { k = 0; while (x >= height[k+1]) { k++; } }
+
+  for (auto i=k+1; i<5; i++) { position[i] += 1; }
+  for (auto i=0  ; i<5; i++) { desired [i] += increment[i]; }
+  n++;
+
+  // Move the middle markers towards their desired positions, adjusting
+  // their heights with a piecewise parabolic prediction, or a linear one
+  // when the parabola would break the ordering
+  for (auto i=1; i<4; i++) {
+    auto d = desired[i] - position[i];
+    if ((d >=  1 && position[i+1] - position[i] >  1) ||
+        (d <= -1 && position[i-1] - position[i] < -1)) {
+      double s = d > 0 ? 1 : -1;
+      auto parabolic = height[i] + s / (position[i+1] - position[i-1])
+        * ( (position[i]   - position[i-1] + s) * (height[i+1] - height[i]  ) / (position[i+1] - position[i]  )
+          + (position[i+1] - position[i]   - s) * (height[i]   - height[i-1]) / (position[i]   - position[i-1]) );
+      if (height[i-1] < parabolic && parabolic < height[i+1]) { height[i] = parabolic; }
+      else {
+        auto j = static_cast<size_t>(i + s);
+        height[i] += s * (height[j] - height[i]) / (position[j] - position[i]);
+      }
+      position[i] += s;
+    }
+  }
+}
+
+double p2_quantile::value() const {
+  if (n == 0) { return std::numeric_limits<double>::quiet_NaN(); }
+  if (n >= 5) { return height[2]; }
+  std::array<double, 5> seen = height;
+  std::sort(begin(seen), begin(seen) + n);
+  return seen[static_cast<size_t>(p * (n - 1))];
+}
+
+void count_histogram::add(double x) {
+  auto bin = static_cast<size_t>(std::max(0.0, x) / max * bins.size());
+  bins[std::min(bin, bins.size() - 1)]++;
+}
+
+channel_summary::channel_summary(const summary_params& params, double max)
+  : moments{}
+  , quantiles{}
+  , counts{params.bins, max}
+{
+  for (auto p: run_summary::quantile_probabilities) { quantiles.emplace_back(p); }
+}
+
+void channel_summary::add(double x) {
+  moments.add(x);
+  for (auto& q: quantiles) { q.add(x); }
+  counts.add(x);
+}
+
+run_summary::run_summary(const summary_params& params, size_t n_sipms)
+  : sipms_(n_sipms, channel_summary{params, params.sipm_max})
+  , total_{params, params.total_max}
+{}
+
+void run_summary::add(const std::unordered_map<size_t, size_t>& counts, bool photopeak, bool over_threshold) {
+  double total = 0;
+  for (size_t n=0; n<sipms_.size(); n++) {
+    auto found = counts.find(n);
+    double count = found == counts.end() ? 0 : found -> second;
+    sipms_[n].add(count);
+    total += count;
+  }
+  total_.add(total);
+  n_events_++;
+  n_photopeak_      += photopeak;
+  n_over_threshold_ += over_threshold;
+}
+
+void convergence_monitor::add(double x, bool photoabsorbed, bool over_threshold) {
+  detected.add(x);
+  if (photoabsorbed) { photopeak.add(x); }
+  n_over_threshold += over_threshold;
+}
+
+double convergence_monitor::estimate() const {
+  auto n = detected.n;
+  switch (params.target) {
+    case stop_target_enum::none                   : return std::numeric_limits<double>::quiet_NaN();
+    case stop_target_enum::over_threshold_fraction: return n ? static_cast<double>(n_over_threshold) / n : 0;
+    case stop_target_enum::light_collection       : return detected.mean;
+    case stop_target_enum::resolution             : return photopeak.mean > 0 ? std::sqrt(photopeak.variance()) / photopeak.mean : 0;
+  }
+  return std::numeric_limits<double>::quiet_NaN(); // unreachable
+}
+
+double convergence_monitor::relative_error() const {
+  // The resolution is estimated from the photopeak alone
+  const auto& events = params.target == stop_target_enum::resolution ? photopeak : detected;
+  auto n   = static_cast<double>(events.n);
+  auto inf = std::numeric_limits<double>::infinity();
+  if (n < 2) { return inf; }
+  auto mean = events.mean, var = events.variance();
+  switch (params.target) {
+    case stop_target_enum::none: return inf;
+    case stop_target_enum::over_threshold_fraction: {
+      auto p = estimate();
+      return p > 0 ? std::sqrt(p * (1 - p) / n) / p : inf;
+    }
+    case stop_target_enum::light_collection:
+      return mean > 0 ? std::sqrt(var / n) / mean : inf;
+    case stop_target_enum::resolution:
+      // Errors of sigma (Gaussian approximation) and of the mean, in quadrature
+      return mean > 0 ? std::sqrt(1 / (2 * (n - 1)) + var / (n * mean * mean)) : inf;
+  }
+  return inf; // unreachable
+}
+
+bool convergence_monitor::converged() const {
+  if (params.target == stop_target_enum::none                           ) { return false; }
+  if (n_events() < std::max<size_t>(params.min_events, 2)               ) { return false; }
+  if (params.check_every > 0 && n_events() % params.check_every != 0    ) { return false; }
+  return relative_error() <= params.relative_error;
+}
+
+std::string summary_filename(const std::string& outfile) {
+  const std::string extension = ".parquet";
+  auto stem = outfile.ends_with(extension) ? outfile.substr(0, outfile.size() - extension.size()) : outfile;
+  return stem + ".summary" + extension;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "scan.hh"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Streaming estimate of one quantile in constant memory: the P² algorithm
+// of Jain and Chlamtac, which keeps five markers whose heights follow
+// the minimum, the p/2, p and (1+p)/2 quantiles and the maximum
+class p2_quantile {
+public:
+  explicit p2_quantile(double p);
+  void   add(double x);
+  double value() const; // Exact while fewer than five values have been seen
+  double probability() const { return p; }
+
+private:
+  double                p;
+  size_t                n = 0;
+  std::array<double, 5> height;
+  std::array<double, 5> position;
+  std::array<double, 5> desired;
+  std::array<double, 5> increment;
+};
+
+// Fixed-width histogram; values beyond `max` go in the last bin
+struct count_histogram {
+  double                max;
+  std::vector<uint32_t> bins;
+
+  count_histogram(unsigned n_bins, double max) : max{max}, bins(n_bins, 0) {}
+  void add(double x);
+};
+
+struct summary_params {
+  bool        enabled;
+  unsigned    bins;
+  double      sipm_max;  // counts; histogram range of each SiPM
+  double      total_max; // counts; histogram range of the sum over SiPMs
+  std::string outfile;
+};
+
+// Counts per SiPM and their sum over the event: moments, quantiles and
+// histogram, accumulated as the events are stored
+struct channel_summary {
+  running_stats            moments;
+  std::vector<p2_quantile> quantiles;
+  count_histogram          counts;
+
+  channel_summary(const summary_params& params, double max);
+  void add(double x);
+};
+
+// Everything the dashboards need from a run, accumulated without keeping
+// the events, and written to a small file at the end of the run
+class run_summary {
+public:
+  static constexpr std::array<double, 3> quantile_probabilities{0.1, 0.5, 0.9};
+
+  run_summary(const summary_params& params, size_t n_sipms);
+
+  void add(const std::unordered_map<size_t, size_t>& counts, bool photopeak, bool over_threshold);
+
+  size_t n_events() const { return n_events_; }
+  double photopeak_fraction     () const { return n_events_ ? static_cast<double>(n_photopeak_)      / n_events_ : 0; }
+  double over_threshold_fraction() const { return n_events_ ? static_cast<double>(n_over_threshold_) / n_events_ : 0; }
+  const std::vector<channel_summary>& sipms() const { return sipms_; }
+  const channel_summary&              total() const { return total_; }
+
+private:
+  size_t                       n_events_         = 0;
+  size_t                       n_photopeak_      = 0;
+  size_t                       n_over_threshold_ = 0;
+  std::vector<channel_summary> sipms_;
+  channel_summary              total_;
+};
+
+// Statistic whose convergence ends the run early
+enum class stop_target_enum { none, over_threshold_fraction, light_collection, resolution };
+
+struct stopping_params {
+  stop_target_enum target;
+  double           relative_error; // requested on the estimate of the target
+  unsigned         check_every;    // events between checks
+  unsigned         min_events;     // never stop before this many events
+};
+
+// Online estimate of the target statistic and of its relative error:
+// - over_threshold_fraction: binomial fraction of events over threshold
+// - light_collection: mean number of photons detected per event
+// - resolution: sigma / mean of the photons detected in photoabsorbed
+//   events, the photopeak; Compton-only events would measure the spread
+//   of the whole spectrum instead
+class convergence_monitor {
+public:
+  explicit convergence_monitor(const stopping_params& params) : params{params} {}
+
+  void   add(double detected, bool photoabsorbed, bool over_threshold);
+  size_t n_events() const { return detected.n; }
+  double estimate() const;
+  double relative_error() const;
+  // Only true on the events where a check is due
+  bool   converged() const;
+
+private:
+  stopping_params params;
+  running_stats   detected;
+  running_stats   photopeak;
+  size_t          n_over_threshold = 0;
+};
+
+// The summary file sits next to the main output: x.parquet -> x.summary.parquet
+std::string summary_filename(const std::string& outfile);
@@ -0,0 +1,64 @@
+#include "synthetic.hh"
+
+#include <G4SystemOfUnits.hh>
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+  const double photopeak_photons  = 5'000;
+  const double photopeak_fraction = 0.7;
+  const double resolution         = 0.05; // sigma / mean
+  const double light_spread       = 3 * mm;
+}
+
+synthetic_events::synthetic_events(const std::vector<G4ThreeVector>& sipm_positions, G4ThreeVector scint_size, uint64_t seed)
+  : sipm_positions{sipm_positions}
+  , scint_size{scint_size}
+  , rng{seed}
+  , light_share(sipm_positions.size())
+{}
+
+synthetic_event synthetic_events::next() {
+  std::uniform_real_distribution<double> flat{0, 1};
+  auto sx = scint_size.x(), sy = scint_size.y(), sz = scint_size.z();
+  auto random_point = [&] { return G4ThreeVector{(flat(rng) - 0.5) * sx, (flat(rng) - 0.5) * sy, -flat(rng) * sz}; };
+
+  synthetic_event event;
+  auto entry = random_point();
+  event.primary_pos = {entry.x(), entry.y(), -sz};
+
+  // Geometric number of scatters, each absorbing part of the energy
+  auto   photopeak = flat(rng) < photopeak_fraction;
+  double energy    = 511 * keV;
+  auto   centroid  = G4ThreeVector{};
+  double deposited = 0;
+  while (true) {
+    auto point = random_point();
+    auto absorb = photopeak && flat(rng) < 0.5;
+    auto edep   = absorb ? energy : energy * flat(rng) * 0.6;
+    event.interactions.emplace_back(point.x(), point.y(), point.z(), edep, absorb ? 1 : 0);
+    centroid  += edep * point;
+    deposited += edep;
+    energy    -= edep;
+    if (absorb || (! photopeak && flat(rng) < 0.5)) { break; }
+  }
+  centroid /= deposited;
+
+  auto mean = photopeak_photons * deposited / (511 * keV);
+  auto n_photons = std::max(0.0, std::normal_distribution<double>{mean, resolution * mean}(rng));
+
+  double total_share = 0;
+  for (size_t n=0; n<sipm_positions.size(); n++) {
+    auto d = (sipm_positions[n] - centroid).perp() / light_spread;
+    light_share[n] = 1 / (1 + d * d);
+    total_share   += light_share[n];
+  }
+  for (size_t n=0; n<sipm_positions.size(); n++) {
+    auto expected = n_photons * light_share[n] / total_share;
+    if (expected <= 0) { continue; }
+    auto count = std::poisson_distribution<size_t>{expected}(rng);
+    if (count > 0) { event.counts[n] = count; }
+  }
+  return event;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "io.hh"
+
+#include <G4ThreeVector.hh>
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+struct synthetic_event {
+  G4ThreeVector                      primary_pos;
+  std::vector<interaction>           interactions;
+  std::unordered_map<size_t, size_t> counts;
+};
+
+// Events with roughly the shape of real 511 keV gamma events, for
+// exercising the I/O without running Geant4: a few Compton scatters
+// usually ending in a photoabsorption, a photopeak plus Compton continuum
+// in the total light, shared between the SiPMs according to their
+// distance from the light centroid. Deterministic for a given seed.
+class synthetic_events {
+public:
+  synthetic_events(const std::vector<G4ThreeVector>& sipm_positions, G4ThreeVector scint_size, uint64_t seed = 1234);
+
+  synthetic_event next();
+
+private:
+  std::vector<G4ThreeVector> sipm_positions;
+  G4ThreeVector              scint_size;
+  std::mt19937_64            rng;
+  std::vector<double>        light_share;
+};
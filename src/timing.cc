@@ -0,0 +1,64 @@
+#include "timing.hh"
+
+#include <G4SystemOfUnits.hh>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+std::vector<uint32_t> delta_encode_ps(const std::vector<double>& sorted_times) {
+  std::vector<uint32_t> encoded;
+  encoded.reserve(sorted_times.size());
+  // Differences are taken between already-quantised values, so that
+  // rounding errors do not accumulate along the sequence
+  int64_t previous = 0;
+  for (auto t: sorted_times) {
+    auto current = std::max<int64_t>(std::llround(t / picosecond), previous);
+    encoded.push_back(static_cast<uint32_t>(current - previous));
+    previous = current;
+  }
+  return encoded;
+}
+
+std::vector<double> delta_decode_ps(const std::vector<uint32_t>& encoded) {
+  std::vector<double> times;
+  times.reserve(encoded.size());
+  int64_t current = 0;
+  for (auto delta: encoded) {
+    current += delta;
+    times.push_back(current * picosecond);
+  }
+  return times;
+}
+
+double time_quantile(std::vector<double>& times, double q) {
+  auto index = static_cast<size_t>(std::clamp(q, 0.0, 1.0) * (times.size() - 1));
+  std::nth_element(begin(times), begin(times) + index, end(times));
+  return times[index];
+}
+
+timing_event summarise_arrival_times( const std::unordered_map<size_t, std::vector<double>>& arrival_times
+                                    , size_t n_sipms
+                                    , size_t k
+                                    , double q) {
+  constexpr auto NaN = std::numeric_limits<float>::quiet_NaN();
+  timing_event out;
+  out.first_times.resize(n_sipms);
+  out.earliest   .resize(n_sipms, NaN);
+  out.quantile   .resize(n_sipms, NaN);
+
+  std::vector<double> times;
+  for (const auto& [n, sipm_times]: arrival_times) {
+    if (n >= n_sipms || sipm_times.empty()) { continue; }
+    times = sipm_times;
+    out.quantile[n] = time_quantile(times, q);
+
+    // Only the first K need to be in order
+    auto n_kept = std::min(k, times.size());
+    std::partial_sort(begin(times), begin(times) + n_kept, end(times));
+    out.earliest[n] = times.front();
+    times.resize(n_kept);
+    out.first_times[n] = delta_encode_ps(times);
+  }
+  return out;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Photon arrival times are stored as integer picoseconds. The first
+// value is the time since the start of the event, each subsequent one
+// is the difference from its predecessor: small numbers which compress
+// well.
+std::vector<uint32_t> delta_encode_ps(const std::vector<double>& sorted_times);
+std::vector<double>   delta_decode_ps(const std::vector<uint32_t>& encoded);
+
+// Timing summary of all SiPMs in one event, indexed by SiPM copy number
+struct timing_event {
+  std::vector<std::vector<uint32_t>> first_times; // earliest K, delta-encoded
+  std::vector<float>                 earliest;    // NaN if no photons
+  std::vector<float>                 quantile;    // NaN if no photons
+};
+
+// q-quantile of the arrival times, taking the lower of the two
+// neighbouring values rather than interpolating. Reorders `times`.
+double time_quantile(std::vector<double>& times, double q);
+
+timing_event summarise_arrival_times( const std::unordered_map<size_t, std::vector<double>>& arrival_times
+                                    , size_t n_sipms
+                                    , size_t k
+                                    , double q);
@@ -172,6 +172,45 @@ TEST_CASE("pointlike photon source generator spectrum", "[generator][photon][poi
   CHECK_THAT(e_max  / eV, WithinRel(4.76, 1e-2));
 }
 
+// Settings changed between runs must reach generators created earlier
+TEST_CASE("generator follows config snapshots", "[generator][photon][pointlike]") {
+  n4::test::default_run_manager().run(0);
+  auto generator = pointlike_photon_source();
+  auto n_photons = [&] {
+    G4Event event{};
+    generator(&event);
+    return event.GetPrimaryVertex(0) -> GetNumberOfParticle();
+  };
+
+  G4UImanager::GetUIpointer() -> ApplyCommand("/source/nphotons 12");
+  my.freeze();
+  CHECK(n_photons() == 12);
+
+  G4UImanager::GetUIpointer() -> ApplyCommand("/source/nphotons 34");
+  CHECK(n_photons() == 12); // Not published yet
+  my.freeze();
+  CHECK(n_photons() == 34);
+
+  // Each copy has its own state
+  auto copy = generator;
+  G4Event event{};
+  copy(&event);
+  CHECK(event.GetPrimaryVertex(0) -> GetNumberOfParticle() == 34);
+}
+
+TEST_CASE("gamma generator aims at SiPMs by event ID", "[generator][gamma]") {
+  n4::test::default_run_manager().run(0);
+  auto generator = gammas_from_outside_crystal();
+  auto positions = my.sipm_positions();
+  for (size_t id=0; id<2*positions.size(); id++) {
+    G4Event event{static_cast<G4int>(id)};
+    generator(&event);
+    auto pos = event.GetPrimaryVertex(0) -> GetPosition();
+    CHECK(pos.x() == positions[id % positions.size()].x());
+    CHECK(pos.y() == positions[id % positions.size()].y());
+  }
+}
+
 TEST_CASE("test selector", "[selector]") {
   using generator_type = std::function<n4::generator::function(void)>;
   std::unordered_map<std::string, generator_type> options {
@@ -180,7 +219,11 @@ TEST_CASE("test selector", "[selector]") {
     {"photoelectric_electrons"    , photoelectric_electrons},
     {"electrons"                  , photoelectric_electrons},
     {"pointlike_photon_source"    , pointlike_photon_source},
-    {"photons"                    , pointlike_photon_source}
+    {"photons"                    , pointlike_photon_source},
+    {"replay_deposits"            , replay_deposits},
+    {"replay"                     , replay_deposits},
+    {"scan_positions"             , scan_positions},
+    {"scan"                       , scan_positions}
   };
 
   auto fn_equal = [] (generator_type got, generator_type expected) {
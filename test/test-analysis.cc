@@ -0,0 +1,167 @@
+#include <analysis.hh>
+#include <config.hh>
+#include <io.hh>
+#include <synthetic.hh>
+
+#include <n4-all.hh>
+
+#include <arrow/api.h>
+#include <arrow/io/file.h>
+#include <parquet/arrow/writer.h>
+
+#include <G4UImanager.hh>
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/stat.h>
+
+using Catch::Matchers::WithinAbs;
+
+TEST_CASE("count kernels", "[analysis]") {
+  std::vector<uint32_t> counts {
+    1, 7, 3, 7,
+    0, 0, 0, 0,
+    2, 0, 9, 1,
+  };
+  count_features out;
+  out.resize(4);
+  count_kernels(counts.data(), 3, 4, 2, out, 1); // Leaves the first event alone
+
+  CHECK(out.total           == std::vector<uint32_t>{0, 18, 0, 12});
+  CHECK(out.max             == std::vector<uint32_t>{0,  7, 0,  9});
+  CHECK(out.argmax          == std::vector<uint32_t>{0,  1, 0,  2});
+  CHECK(out.n_over_threshold== std::vector<uint32_t>{0,  3, 0,  2});
+}
+
+TEST_CASE("count features of a file", "[analysis][io]") {
+  std::string filename = std::tmpnam(nullptr);
+  auto UI = G4UImanager::GetUIpointer();
+  UI -> ApplyCommand("/my/n_sipms_xy 4");
+  UI -> ApplyCommand("/my/chunk_size 100"); // Several row groups for the threads to share
+  UI -> ApplyCommand("/my/sipm_threshold 3");
+  UI -> ApplyCommand("/my/outfile " + filename);
+  auto n_events = 1'234;
+  {
+    auto cfg = my.freeze();
+    synthetic_events events{cfg -> sipm_positions, cfg -> scint_size};
+    parquet_writer writer{cfg};
+    for (auto i=0; i<n_events; i++) {
+      auto event = events.next();
+      REQUIRE(writer.append(event.primary_pos, event.interactions, event.counts).ok());
+    }
+  }
+
+  auto rows      = read_entire_file(filename).ValueOrDie();
+  auto positions = my.sipm_positions();
+  for (auto n_threads: {1u, 3u}) {
+    auto maybe_features = analyse_counts(filename, n_threads);
+    REQUIRE(maybe_features.ok());
+    auto features = maybe_features.ValueOrDie();
+    REQUIRE(features.size() == rows.size());
+
+    for (size_t e=0; e<rows.size(); e++) {
+      const auto& counts = std::get<2>(rows[e]);
+      uint32_t total = 0, max = 0, over = 0;
+      double x = 0, y = 0;
+      for (const auto& [n, c]: counts) {
+        total += c;
+        max    = std::max<uint32_t>(max, c);
+        over  += c >= 3;
+        x     += c * positions[n].x();
+        y     += c * positions[n].y();
+      }
+      CHECK(features.total           [e] == total);
+      CHECK(features.max             [e] == max);
+      CHECK(features.n_over_threshold[e] == over);
+      CHECK(counts.at(features.argmax[e]) == max);
+      if (total == 0) { CHECK(std::isnan(features.x[e])); continue; }
+      CHECK_THAT(features.x[e], WithinAbs(x / total, 1e-3));
+      CHECK_THAT(features.y[e], WithinAbs(y / total, 1e-3));
+    }
+  }
+  std::remove(filename.c_str());
+}
+
+TEST_CASE("count features of a file without metadata", "[analysis][io]") {
+  std::string filename = std::tmpnam(nullptr);
+  arrow::UInt32Builder builder;
+  REQUIRE(builder.Append(1).ok());
+  auto column = builder.Finish().ValueOrDie();
+  auto table  = arrow::Table::Make(arrow::schema({arrow::field("event_id", arrow::uint32())}), {column});
+  auto sink   = arrow::io::FileOutputStream::Open(filename).ValueOrDie();
+  REQUIRE(parquet::arrow::WriteTable(*table, arrow::default_memory_pool(), sink, 1).ok());
+  REQUIRE(sink -> Close().ok());
+
+  auto features = analyse_counts(filename, 1);
+  REQUIRE(! features.ok());
+  CHECK(features.status().message().find("No SiPM positions") != std::string::npos);
+  std::remove(filename.c_str());
+}
+
+TEST_CASE("count features of a file with malformed metadata", "[analysis][io]") {
+  auto write = [] (const std::string& filename, std::unordered_map<std::string, std::string> meta) {
+    arrow::UInt32Builder builder;
+    REQUIRE(builder.Append(1).ok());
+    auto column   = builder.Finish().ValueOrDie();
+    auto metadata = std::make_shared<arrow::KeyValueMetadata>(meta);
+    auto schema   = arrow::schema({arrow::field("event_id", arrow::uint32())}, metadata);
+    auto sink     = arrow::io::FileOutputStream::Open(filename).ValueOrDie();
+    REQUIRE(parquet::arrow::WriteTable(*arrow::Table::Make(schema, {column}), arrow::default_memory_pool(), sink, 1).ok());
+    REQUIRE(sink -> Close().ok());
+  };
+  std::string filename = std::tmpnam(nullptr);
+
+  // Reported as errors, not thrown
+  write(filename, {{"x_0", "left"}, {"y_0", "0"}});
+  auto features = analyse_counts(filename, 1);
+  REQUIRE(! features.ok());
+  CHECK(features.status().message().find("x_0 'left'") != std::string::npos);
+
+  write(filename, {{"x_0", "0"}, {"y_0", "0"}, {"sipm_threshold", "many"}});
+  features = analyse_counts(filename, 1);
+  REQUIRE(! features.ok());
+  CHECK(features.status().message().find("sipm_threshold 'many'") != std::string::npos);
+
+  CHECK(sipm_positions_from_metadata(filename).ok());
+  std::remove(filename.c_str());
+}
+
+TEST_CASE("count features of a named pipe", "[analysis][io][fifo]") {
+  n4::test::default_run_manager().run(0);
+  auto UI = G4UImanager::GetUIpointer();
+  UI -> ApplyCommand("/my/n_sipms_xy 2");
+  UI -> ApplyCommand("/my/chunk_size 10");
+  UI -> ApplyCommand("/my/sipm_threshold 1");
+
+  std::string filename = std::tmpnam(nullptr);
+  REQUIRE(mkfifo(filename.c_str(), 0600) == 0);
+  UI -> ApplyCommand("/my/outfile " + filename);
+
+  // The pipe can only be read once: metadata and counts come from the same pass
+  arrow::Result<count_features> features;
+  std::thread consumer{[&] { features = analyse_counts(filename, 2); }};
+  {
+    parquet_writer writer{my.freeze()};
+    for (uint32_t i=0; i<25; i++) {
+      REQUIRE(writer.append({0, 0, 0}, {}, {{0, i}, {3, 2 * i}}).ok());
+    }
+  }
+  consumer.join();
+
+  REQUIRE(features.ok());
+  const auto& out = features.ValueOrDie();
+  REQUIRE(out.size() == 25);
+  for (uint32_t i=0; i<25; i++) {
+    CHECK(out.total [i] == 3 * i);
+    CHECK(out.max   [i] == 2 * i);
+  }
+  std::filesystem::remove(filename);
+}
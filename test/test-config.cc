@@ -138,3 +138,71 @@ TEST_CASE("sipm positions are consistent", "[config]") {
   for (auto i=1; i<x.size(); i++) { CHECK_THAT(std::abs(x[i] - x[i-1]), WithinULP(sipm_size, 1)); }
   for (auto i=1; i<y.size(); i++) { CHECK_THAT(std::abs(y[i] - y[i-1]), WithinULP(sipm_size, 1)); }
 }
+
+TEST_CASE("resolved config snapshot", "[config][resolved]") {
+  auto UI = G4UImanager::GetUIpointer();
+  UI -> ApplyCommand("/my/n_sipms_x 3");
+  UI -> ApplyCommand("/my/n_sipms_y 2");
+
+  auto before = my.freeze();
+  CHECK(before -> generation     == my.generation());
+  CHECK(before -> n_sipms        == 6);
+  CHECK(before -> sipm_positions == my.sipm_positions());
+  CHECK(before -> scint_size     == my.scint_size());
+  CHECK(my.frozen() == before);
+
+  // Changes are only visible in the next snapshot
+  UI -> ApplyCommand("/my/n_sipms_xy 4");
+  CHECK(before      -> n_sipms == 6);
+  CHECK(my.frozen() -> n_sipms == 6);
+
+  auto after = my.freeze();
+  CHECK(after -> n_sipms    == 16);
+  CHECK(after -> generation >  before -> generation);
+
+  frozen_config handle;
+  CHECK(handle -> n_sipms == 16);
+  UI -> ApplyCommand("/my/n_sipms_xy 5");
+  my.freeze();
+  CHECK(handle -> n_sipms == 25);
+}
+
+TEST_CASE("resolved config validation", "[config][resolved]") {
+  my.time_quantile = 1.5;
+  CHECK_THROWS(my.resolve());
+  my.time_quantile = 0.5;
+  CHECK_NOTHROW(my.resolve());
+
+  my.ipc_compression = "brotli";
+  CHECK_THROWS(my.resolve());
+  my.ipc_compression = "ZSTD";
+  CHECK_NOTHROW(my.resolve());
+  my.ipc_compression = "none";
+}
+
+TEST_CASE("resolved config output settings", "[config][resolved]") {
+  auto outfile = my.outfile;
+  my.outfile         = "snapshot.arrow";
+  my.output_format   = output_format_enum::feather;
+  my.ipc_compression = "lz4";
+  auto snapshot = my.resolve();
+
+  // Later changes do not reach the snapshot a writer was given
+  my.outfile         = outfile;
+  my.output_format   = output_format_enum::automatic;
+  my.ipc_compression = "none";
+  CHECK(snapshot -> outfile         == "snapshot.arrow");
+  CHECK(snapshot -> output_format   == output_format_enum::feather);
+  CHECK(snapshot -> ipc_compression == "lz4");
+}
+
+TEST_CASE("scan metadata for every name of the scan generator", "[config][metadata]") {
+  auto original = my.generator;
+  for (auto name: {"scan", "scan_positions", "SCAN"}) {
+    my.generator = name;
+    CHECK(my.as_map().contains("scan_grid"));
+  }
+  my.generator = "gammas";
+  CHECK(! my.as_map().contains("scan_grid"));
+  my.generator = original;
+}
@@ -0,0 +1,114 @@
+#include <config.hh>
+#include <dataset.hh>
+#include <io.hh>
+#include <synthetic.hh>
+
+#include <n4-all.hh>
+
+#include <G4UImanager.hh>
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
+
+#include <unistd.h>
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Shards of one run: same config, different seeds
+fs::path write_shards(unsigned n_shards, unsigned n_events) {
+  auto dir = fs::temp_directory_path() / ("crystal-dataset-test-" + std::to_string(getpid()));
+  fs::remove_all(dir);
+  fs::create_directories(dir);
+  auto UI = G4UImanager::GetUIpointer();
+  UI -> ApplyCommand("/my/n_sipms_xy 2");
+  UI -> ApplyCommand("/my/chunk_size 7"); // Several row groups per file
+  for (unsigned s=0; s<n_shards; s++) {
+    UI -> ApplyCommand("/my/seed " + std::to_string(1000 + s));
+    UI -> ApplyCommand("/my/outfile " + (dir / ("shard-" + std::to_string(s) + ".parquet")).string());
+    auto cfg = my.freeze();
+    synthetic_events events{cfg -> sipm_positions, cfg -> scint_size, s};
+    parquet_writer writer{cfg};
+    for (unsigned i=0; i<n_events; i++) {
+      auto event = events.next();
+      REQUIRE(writer.append(event.primary_pos, event.interactions, event.counts).ok());
+    }
+  }
+  return dir;
+}
+
+TEST_CASE("dataset scan", "[dataset][io]") {
+  n4::test::default_run_manager().run(0);
+  auto dir = write_shards(3, 30);
+
+  auto spec = GENERATE(std::string{""}, std::string{"shard-*.parquet"});
+  auto data = dataset::open((dir / spec).string());
+  REQUIRE(data.ok());
+  auto files = data -> files();
+  REQUIRE(files.size() == 3);
+  CHECK(data -> num_rows() == 90);
+  CHECK(data -> metadata().at("seed") == "1000");
+
+  // Same rows, in the same order, as reading the files one by one
+  std::vector<uint32_t> expected;
+  for (const auto& f: files) {
+    auto table = read_table(f).ValueOrDie() -> CombineChunksToBatch().ValueOrDie();
+    auto counts = std::static_pointer_cast<arrow::FixedSizeListArray>(table -> GetColumnByName("photon_counts"));
+    auto values = std::static_pointer_cast<arrow::UInt32Array>(counts -> values());
+    for (auto i=0; i<values -> length(); i++) { expected.push_back(values -> Value(i)); }
+  }
+
+  for (auto n_threads: {1u, 4u}) {
+    auto scanner = data -> scan({"photon_counts", "x"}, n_threads, 1);
+    REQUIRE(scanner.ok());
+    CHECK(scanner.ValueOrDie() -> schema() -> num_fields() == 2);
+    CHECK(scanner.ValueOrDie() -> schema() -> field(1) -> name() == "x");
+
+    std::vector<uint32_t> got;
+    size_t n_batches = 0;
+    for (std::shared_ptr<arrow::RecordBatch> batch;;) {
+      REQUIRE(scanner.ValueOrDie() -> ReadNext(&batch).ok());
+      if (! batch) { break; }
+      n_batches++;
+      auto counts = std::static_pointer_cast<arrow::FixedSizeListArray>(batch -> column(0));
+      auto values = std::static_pointer_cast<arrow::UInt32Array>(counts -> values());
+      for (auto i=0; i<values -> length(); i++) { got.push_back(values -> Value(i)); }
+    }
+    CHECK(n_batches == 3 * 5); // ceil(30 / 7) row groups per file
+    CHECK(got == expected);
+  }
+
+  auto table = data -> read_table();
+  REQUIRE(table.ok());
+  CHECK(table.ValueOrDie() -> num_rows   () == 90);
+  CHECK(table.ValueOrDie() -> num_columns() == data -> schema() -> num_fields());
+
+  CHECK(! data -> scan({"no_such_column"}).ok());
+  fs::remove_all(dir);
+}
+
+TEST_CASE("dataset config must match", "[dataset][io]") {
+  n4::test::default_run_manager().run(0);
+  auto dir = write_shards(2, 5);
+
+  // A shard made with a different setting
+  auto UI = G4UImanager::GetUIpointer();
+  UI -> ApplyCommand("/my/event_threshold 5");
+  UI -> ApplyCommand("/my/outfile " + (dir / "shard-odd.parquet").string());
+  {
+    auto cfg = my.freeze();
+    parquet_writer writer{cfg};
+    synthetic_events events{cfg -> sipm_positions, cfg -> scint_size};
+    auto event = events.next();
+    REQUIRE(writer.append(event.primary_pos, event.interactions, event.counts).ok());
+  }
+  UI -> ApplyCommand("/my/event_threshold 1");
+
+  CHECK(  dataset::open((dir / "shard-[0-9].parquet").string()).ok());
+  CHECK(! dataset::open( dir                         .string()).ok());
+  CHECK(! dataset::open((dir / "nothing-*.parquet"  ).string()).ok());
+  fs::remove_all(dir);
+}
@@ -0,0 +1,118 @@
+#include <actions.hh>
+#include <config.hh>
+#include <deposits.hh>
+#include <geometry.hh>
+#include <physics-list.hh>
+#include <run_stats.hh>
+
+#include <n4-all.hh>
+
+#include <G4UImanager.hh>
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+
+#include <cstdio>
+
+using Catch::Matchers::WithinRel;
+using Catch::Matchers::WithinULP;
+
+TEST_CASE("deposits roundtrip", "[deposits][io]") {
+  // Needed for CLI metadata
+  n4::test::default_run_manager().run(0);
+
+  std::string filename = std::tmpnam(nullptr);
+  std::vector<G4ThreeVector>        primaries{{1, 2, 3}, {4, 5, 6}, {7, 8, 9}};
+  std::vector<std::vector<deposit>> deposits {
+    {{0.1f, 0.2f, 0.3f, 1.5f, 0.25f, 11}, {0.4f, 0.5f, 0.6f, 2.5f, 0.01f, -11}},
+    {},
+    {{1.1f, 1.2f, 1.3f, 3.5f, 0.5f , 11}},
+  };
+  {
+    auto writer = deposit_writer(filename, 2); // Smaller than the number of events
+    for (auto i=0; i<primaries.size(); i++) { REQUIRE(writer.append(primaries[i], deposits[i]).ok()); }
+  }
+
+  auto events = read_deposits(filename);
+  REQUIRE(events.ok());
+  REQUIRE(events -> size() == primaries.size());
+  for (auto i=0; i<primaries.size(); i++) {
+    const auto& event = events -> at(i);
+    CHECK(event.primary_pos == primaries[i]);
+    REQUIRE(event.deposits.size() == deposits[i].size());
+    for (auto j=0; j<deposits[i].size(); j++) {
+      const auto& got = event.deposits[j], expected = deposits[i][j];
+      CHECK(got.x    == expected.x   );
+      CHECK(got.y    == expected.y   );
+      CHECK(got.z    == expected.z   );
+      CHECK(got.t    == expected.t   );
+      CHECK(got.edep == expected.edep);
+      CHECK(got.pdg  == expected.pdg );
+    }
+  }
+}
+
+TEST_CASE("scintillation photon statistics", "[deposits][scintillation]") {
+  scintillation_params params{.yield = 1000 / MeV, .resolution_scale = 1, .decay_time = 30 * ns, .rise_time = 0};
+
+  auto n = 10'000;
+  double total_photons = 0, total_delay = 0;
+  for (auto i=0; i<n; i++) {
+    total_photons += n_scintillation_photons(0.1 * MeV, params);
+    total_delay   += scintillation_delay(params);
+  }
+  CHECK_THAT(total_photons / n, WithinRel(100, 1e-2));
+  CHECK_THAT(total_delay   / n, WithinRel(30 * ns, 3e-2));
+
+  // Rise and decay times add up on average
+  params.rise_time = 5 * ns;
+  total_delay = 0;
+  for (auto i=0; i<n; i++) { total_delay += scintillation_delay(params); }
+  CHECK_THAT(total_delay / n, WithinRel(35 * ns, 3e-2));
+
+  // Few photons: Poisson, never negative
+  CHECK(n_scintillation_photons(0, params) == 0);
+}
+
+TEST_CASE("record deposits", "[deposits][stage1]") {
+  std::string outfile  = std::tmpnam(nullptr);
+  std::string depfile  = std::tmpnam(nullptr);
+  auto args_list = std::initializer_list<std::string>{
+      "progname"
+    , "-n", "5"
+    , "-e"
+    , "/my/outfile " + outfile
+    , "/my/record_deposits " + depfile
+  };
+  auto args = n4::test::argcv(args_list);
+
+  run_stats stats;
+  n4::run_manager::create()
+    .ui("progname", args.argc, args.argv)
+    .apply_cli_early()
+    .physics(physics_list())
+    .geometry([&] {return crystal_geometry(stats);})
+    .actions(create_actions(stats))
+    .run();
+
+  // No optical photons were generated, so none can have been detected
+  CHECK(stats.n_detected_total == 0);
+
+  auto events = read_deposits(depfile);
+  REQUIRE(events.ok());
+  REQUIRE(events -> size() == 5);
+
+  auto [sx, sy, sz] = n4::unpack(my.scint_size());
+  for (const auto& event: events.ValueOrDie()) {
+    double total = 0;
+    for (const auto& d: event.deposits) {
+      CHECK(std::abs(d.x) <= sx/2);
+      CHECK(std::abs(d.y) <= sy/2);
+      CHECK(d.z <=   0);
+      CHECK(d.z >= -sz);
+      CHECK(d.edep > 0);
+      total += d.edep;
+    }
+    CHECK(total <= my.particle_energy() * (1 + 1e-6));
+  }
+}
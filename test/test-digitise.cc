@@ -0,0 +1,70 @@
+#include <digitise.hh>
+
+#include <n4-all.hh>
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+
+#include <cmath>
+
+using Catch::Matchers::WithinRel;
+using Catch::Matchers::WithinULP;
+
+digitisation_params noiseless() {
+  return { .n_microcells    = 1'000'000'000
+         , .crosstalk_prob  = 0
+         , .afterpulse_prob = 0
+         , .afterpulse_tau  = 20 * ns
+         , .recovery_time   = 50 * ns
+         , .dark_count_rate = 0
+         , .window          = 500 * ns };
+}
+
+TEST_CASE("digitise ideal sipm", "[digitise]") {
+  auto times = std::vector<double>(1234, 10 * ns);
+  auto [charge, time] = digitise_sipm(times, noiseless());
+  CHECK_THAT(charge, WithinRel(1234, 1e-2)); // Two photons may hit the same microcell, very rarely
+  CHECK_THAT(time  , WithinULP(static_cast<float>(10 * ns), 1));
+}
+
+TEST_CASE("digitise no photons", "[digitise]") {
+  auto [charge, time] = digitise_sipm({}, noiseless());
+  CHECK(charge == 0);
+  CHECK(std::isnan(time));
+}
+
+TEST_CASE("digitise ignores photons outside window", "[digitise]") {
+  auto params = noiseless();
+  auto [charge, time] = digitise_sipm({-1 * ns, 20 * ns, params.window + 1 * ns}, params);
+  CHECK_THAT(charge, WithinULP(1.f, 1));
+  CHECK_THAT(time  , WithinULP(static_cast<float>(20 * ns), 1));
+}
+
+TEST_CASE("digitise microcell saturation", "[digitise][saturation]") {
+  auto params = noiseless();
+  params.n_microcells  = 100;
+  params.recovery_time = 1e6 * ns; // Microcells never recover within the window
+  auto [charge, _] = digitise_sipm(std::vector<double>(10'000, 0), params);
+  CHECK_THAT(charge, WithinRel(params.n_microcells, 1e-3));
+}
+
+TEST_CASE("digitise crosstalk", "[digitise][crosstalk]") {
+  auto params = noiseless();
+  params.crosstalk_prob = 0.2;
+  auto n_photons = 100'000;
+  auto [charge, _] = digitise_sipm(std::vector<double>(n_photons, 0), params);
+  // Each avalanche triggers another with probability p: geometric series
+  CHECK_THAT(charge, WithinRel(n_photons / (1 - params.crosstalk_prob), 1e-2));
+}
+
+TEST_CASE("digitise dark counts", "[digitise][dark]") {
+  auto params = noiseless();
+  params.dark_count_rate = 0.01 / ns;
+  auto n_events = 10'000;
+  auto total    = 0.0;
+  auto digis    = digitise({}, n_events, params); // Many SiPMs, no photons
+  for (auto charge: digis.charge) { total += charge; }
+  CHECK(digis.charge.size() == n_events);
+  CHECK(digis.time  .size() == n_events);
+  CHECK_THAT(total / n_events, WithinRel(params.dark_count_rate * params.window, 2e-2));
+}
@@ -4,7 +4,11 @@
 #include <n4-all.hh>
 
 #include <G4LogicalVolume.hh>
+#include <G4ProductionCuts.hh>
+#include <G4Region.hh>
+#include <G4Track.hh>
 #include <G4UImanager.hh>
+#include <G4UserLimits.hh>
 
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/matchers/catch_matchers_floating_point.hpp>
@@ -170,3 +174,107 @@ TEST_CASE("optical surface selector", "[selector]") {
     CHECK(surf -> GetFinish() == RoughESR_LUT);
   }
 }
+
+TEST_CASE("sipm channel from position", "[geometry][sipm][placement]") {
+  auto UI = G4UImanager::GetUIpointer();
+  UI -> ApplyCommand("/my/n_sipms_x 5");
+  UI -> ApplyCommand("/my/n_sipms_y 3");
+
+  auto params = my.scint_params();
+  auto offset = params.sipm_size * 0.49;
+  for (auto [n, pos]: n4::enumerate(my.sipm_positions())) {
+    CHECK(sipm_channel_at(pos.x()         , pos.y()         , params) == n);
+    CHECK(sipm_channel_at(pos.x() + offset, pos.y() - offset, params) == n);
+    CHECK(sipm_channel_at(pos.x() - offset, pos.y() + offset, params) == n);
+  }
+}
+
+TEST_CASE("sipm placement modes", "[geometry][sipm][placement]") {
+  run_stats stats;
+  auto UI = G4UImanager::GetUIpointer();
+  UI -> ApplyCommand("/my/n_sipms_xy 4");
+
+  if (!n4::run_manager::available()) {
+    n4::test::default_run_manager().run(0);
+  }
+
+  auto check_sensitive = [] {
+    auto sipm_logical = n4::find_logical("sipm");
+    REQUIRE(sipm_logical != nullptr);
+    CHECK(sipm_logical -> GetSensitiveDetector() != nullptr);
+  };
+
+  SECTION("parameterised") {
+    n4::clear_geometry();
+    UI -> ApplyCommand("/my/sipm_placement parameterised");
+    crystal_geometry(stats);
+    check_sensitive();
+    auto sipms = n4::find_physical("sipm");
+    REQUIRE(sipms != nullptr);
+    CHECK(sipms -> IsParameterised());
+    CHECK(sipms -> GetMultiplicity() == my.n_sipms());
+  }
+
+  SECTION("plane") {
+    n4::clear_geometry();
+    UI -> ApplyCommand("/my/sipm_placement plane");
+    crystal_geometry(stats);
+    check_sensitive();
+    auto sipm = n4::find_solid<G4Box>("sipm");
+    REQUIRE(sipm != nullptr);
+    auto size = my.scint_size();
+    CHECK_THAT(sipm -> GetXHalfLength(), WithinULP(size.x()/2, 1));
+    CHECK_THAT(sipm -> GetYHalfLength(), WithinULP(size.y()/2, 1));
+  }
+}
+
+TEST_CASE("crystal region cuts and step limit", "[geometry][region]") {
+  run_stats stats;
+  auto UI = G4UImanager::GetUIpointer();
+  UI -> ApplyCommand("/my/crystal_cut 0.1 mm");
+  UI -> ApplyCommand("/my/crystal_max_step 0.05 mm");
+  UI -> ApplyCommand("/my/readout_cut 0.3 mm");
+
+  if (!n4::run_manager::available()) {
+    n4::test::default_run_manager().run(0);
+  }
+
+  n4::clear_geometry();
+  crystal_geometry(stats);
+
+  auto crystal = n4::find_logical("crystal");
+  REQUIRE(crystal != nullptr);
+  auto region = crystal -> GetRegion();
+  REQUIRE(region != nullptr);
+  CHECK(region -> GetName() == "crystal");
+  CHECK_THAT(region -> GetProductionCuts() -> GetProductionCut("e-"), WithinULP(0.1 * mm, 1));
+
+  auto limits = crystal -> GetUserLimits();
+  REQUIRE(limits != nullptr);
+  G4Track track{};
+  CHECK_THAT(limits -> GetMaxAllowedStep(track), WithinULP(0.05 * mm, 1));
+
+  auto readout = n4::find_logical("optical-gel") -> GetRegion();
+  REQUIRE(readout != nullptr);
+  CHECK(readout -> GetName() == "readout");
+  CHECK(n4::find_logical("sipm") -> GetRegion() == readout);
+  CHECK_THAT(readout -> GetProductionCuts() -> GetProductionCut("e-"), WithinULP(0.3 * mm, 1));
+
+  // The surrounding volumes stay in the default region
+  for (auto name: {"reflector", "world"}) {
+    CHECK(n4::find_logical(name) -> GetRegion() != region);
+    CHECK(n4::find_logical(name) -> GetRegion() != readout);
+  }
+
+  // Rebuilding reuses the regions and their cuts
+  auto cuts = region -> GetProductionCuts();
+  UI -> ApplyCommand("/my/crystal_cut 0.2 mm");
+  n4::clear_geometry();
+  crystal_geometry(stats);
+  auto rebuilt = n4::find_logical("crystal") -> GetRegion();
+  CHECK(rebuilt -> GetProductionCuts() == cuts);
+  CHECK_THAT(rebuilt -> GetProductionCuts() -> GetProductionCut("e-"), WithinULP(0.2 * mm, 1));
+
+  UI -> ApplyCommand("/my/crystal_cut 0.7 mm");
+  UI -> ApplyCommand("/my/readout_cut 0.7 mm");
+}
@@ -1,20 +1,37 @@
 #include <actions.hh>
+#include <analysis.hh>
 #include <geometry.hh>
 #include <physics-list.hh>
 #include <run_stats.hh>
 #include <config.hh>
 #include <io.hh>
+#include <synthetic.hh>
 
 #include <n4-all.hh>
 
 #include <G4UImanager.hh>
 
+#include <arrow/api.h>
+#include <arrow/io/api.h>
+#include <arrow/ipc/api.h>
+#include <parquet/arrow/reader.h>
+#include <parquet/arrow/writer.h>
+
 #include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
 #include <catch2/matchers/catch_matchers_floating_point.hpp>
 
+#include <chrono>
+#include <cmath>
 #include <cstdio>
+#include <filesystem>
+#include <thread>
 #include <unordered_map>
 
+#include <sys/stat.h>
+
+using Catch::Matchers::WithinAbs;
 using Catch::Matchers::WithinULP;
 
 void read_and_check(const auto& filename, const auto& source_pos, const auto& sipm_ids, const auto& counts) {
@@ -44,6 +61,16 @@ void read_and_check(const auto& filename, const auto& source_pos, const auto& si
   }
 }
 
+void write_roundtrip_events(const std::vector<G4ThreeVector>& source_pos, const std::vector<std::vector<size_t>>& counts) {
+  auto writer = parquet_writer(my.freeze());
+  std::vector<interaction> interactions;
+  for (auto i=0; i<source_pos.size(); i++) {
+    std::unordered_map<size_t, size_t> map;
+    for (auto sipm_id=0; sipm_id<counts[i].size(); sipm_id++) { map[sipm_id] = counts[i][sipm_id]; }
+    REQUIRE(writer.append(source_pos[i], interactions, map).ok());
+  }
+}
+
 TEST_CASE("io parquet reader", "[io][parquet][reader]") {
   // Needed for CLI metadata
   n4::test::default_run_manager().run(0);
@@ -65,6 +92,92 @@ TEST_CASE("io parquet reader", "[io][parquet][reader]") {
   read_and_check("data/reader-test.parquet", source_pos, sipm_ids, counts);
 }
 
+TEST_CASE("io parquet reader needs no matching config", "[io][parquet][reader]") {
+  // The file has 2x2 SiPMs: the config is irrelevant to reading it
+  G4UImanager::GetUIpointer() -> ApplyCommand("/my/n_sipms_xy 5");
+
+  auto rows = read_entire_file("data/reader-test.parquet");
+  REQUIRE(rows.ok());
+  REQUIRE(rows.ValueOrDie().size() == 4);
+  for (const auto& [pos, interactions, counts]: rows.ValueOrDie()) { CHECK(counts.size() == 4); }
+}
+
+TEST_CASE("io schema fingerprint", "[io][parquet][reader]") {
+  n4::test::default_run_manager().run(0);
+  auto UI = G4UImanager::GetUIpointer();
+  UI -> ApplyCommand("/my/n_sipms_xy 2");
+
+  std::string filename = std::tmpnam(nullptr);
+  UI -> ApplyCommand("/my/outfile " + filename);
+  write_roundtrip_events({{0, 1, 2}}, {{1, 2, 3, 4}});
+  auto fingerprint = expected_fingerprint(*my.frozen());
+
+  CHECK(read_metadata(filename).ValueOrDie()["schema_fingerprint"] == fingerprint);
+  CHECK(read_entire_file(filename, fingerprint).ok());
+
+  UI -> ApplyCommand("/my/n_sipms_xy 3");
+  auto other = expected_fingerprint(*my.freeze());
+  CHECK(other != fingerprint);
+  CHECK(! read_entire_file(filename, other).ok());
+  CHECK(  read_entire_file(filename       ).ok()); // Layout from the file
+
+  // Quantised files match the fingerprint of their own config, which is
+  // that of the columns as stored, not as read back
+  UI -> ApplyCommand("/my/n_sipms_xy 2");
+  UI -> ApplyCommand("/my/position_resolution 10 um");
+  UI -> ApplyCommand("/my/edep_resolution 1 keV");
+  UI -> ApplyCommand("/my/count_bits 16");
+  write_roundtrip_events({{0, 1, 2}}, {{1, 2, 3, 4}});
+  auto quantised = expected_fingerprint(*my.frozen());
+  CHECK(quantised != fingerprint);
+  CHECK(  read_entire_file(filename, quantised  ).ok());
+  CHECK(! read_entire_file(filename, fingerprint).ok());
+
+  UI -> ApplyCommand("/my/position_resolution 0 um");
+  UI -> ApplyCommand("/my/edep_resolution 0 keV");
+  UI -> ApplyCommand("/my/count_bits 0");
+  std::filesystem::remove(filename);
+}
+
+TEST_CASE("io parquet reader options", "[io][parquet][reader]") {
+  n4::test::default_run_manager().run(0);
+  auto UI = G4UImanager::GetUIpointer();
+  UI -> ApplyCommand("/my/n_sipms_x 2");
+  UI -> ApplyCommand("/my/n_sipms_y 2");
+
+  std::string filename = "data/reader-test.parquet";
+  auto expected_rows = read_entire_file(filename).ValueOrDie();
+  auto expected_meta = read_metadata   (filename).ValueOrDie();
+
+  auto [mmap, threads, pre_buffer] = GENERATE(table<std::string, std::string, std::string>({
+      {"false", "false", "false"},
+      {"true" , "false", "false"},
+      {"true" , "true" , "true" },
+      {"false", "true" , "true" },
+  }));
+  UI -> ApplyCommand("/my/read_memory_map " + mmap);
+  UI -> ApplyCommand("/my/read_threads "    + threads);
+  UI -> ApplyCommand("/my/read_pre_buffer " + pre_buffer);
+
+  auto rows = read_entire_file(filename);
+  REQUIRE(rows.ok());
+  CHECK(rows.ValueOrDie().size() == expected_rows.size());
+  for (size_t i=0; i<expected_rows.size(); i++) {
+    CHECK(std::get<0>(rows.ValueOrDie()[i]) == std::get<0>(expected_rows[i]));
+    CHECK(std::get<2>(rows.ValueOrDie()[i]) == std::get<2>(expected_rows[i]));
+  }
+  CHECK(read_metadata(filename).ValueOrDie() == expected_meta);
+
+  auto reader = open_parquet(filename);
+  REQUIRE(reader.ok());
+  CHECK(reader.ValueOrDie() -> properties().use_threads() == (threads    == "true"));
+  CHECK(reader.ValueOrDie() -> properties().pre_buffer () == (pre_buffer == "true"));
+
+  UI -> ApplyCommand("/my/read_memory_map true");
+  UI -> ApplyCommand("/my/read_threads true");
+  UI -> ApplyCommand("/my/read_pre_buffer true");
+}
+
 TEST_CASE("io parquet roundtrip", "[io][parquet][writer]") {
   // Needed for CLI metadata
   n4::test::default_run_manager().run(0);
@@ -84,7 +197,7 @@ TEST_CASE("io parquet roundtrip", "[io][parquet][writer]") {
   };
 
   {
-    auto writer = parquet_writer();
+    auto writer = parquet_writer(my.freeze());
     std::unordered_map<size_t, size_t> map;
     arrow::Status status;
     std::vector<interaction> interactions;
@@ -100,6 +213,183 @@ TEST_CASE("io parquet roundtrip", "[io][parquet][writer]") {
   read_and_check(filename, source_pos, sipm_ids, counts);
 }
 
+TEST_CASE("io arrow ipc roundtrip", "[io][ipc][writer]") {
+  // Needed for CLI metadata
+  n4::test::default_run_manager().run(0);
+
+  auto UI = G4UImanager::GetUIpointer();
+  UI -> ApplyCommand("/my/n_sipms_xy 2");
+  UI -> ApplyCommand("/my/chunk_size 3"); // Several record batches
+
+  std::vector<G4ThreeVector>       source_pos{{0, 1, 2}, {0.25, 1.25, 2.25}, {0.5, 1.5, 2.5}, {0.75, 1.75, 2.75}};
+  std::vector<size_t       >       sipm_ids  {        0,                  1,               2,                 3};
+  std::vector<std::vector<size_t>> counts{   {       16,                 15,              14,                13},
+                                             {       12,                 11,              10,                 9},
+                                             {        8,                  7,               6,                 5},
+                                             {        4,                  3,               2,                 1}
+  };
+
+  auto [extension, format, compression, expected] = GENERATE(table<std::string, std::string, std::string, output_format_enum>({
+      {".arrow"  , "auto"   , "none", output_format_enum::feather},
+      {".feather", "auto"   , "lz4" , output_format_enum::feather},
+      {".arrows" , "auto"   , "zstd", output_format_enum::stream },
+      {".parquet", "feather", "lz4" , output_format_enum::feather},
+      {".parquet", "stream" , "none", output_format_enum::stream },
+      {".parquet", "auto"   , "none", output_format_enum::parquet},
+  }));
+  std::string filename = std::tmpnam(nullptr) + extension;
+  UI -> ApplyCommand("/my/outfile "         + filename);
+  UI -> ApplyCommand("/my/output_format "   + format);
+  UI -> ApplyCommand("/my/ipc_compression " + compression);
+
+  write_roundtrip_events(source_pos, counts);
+  CHECK(file_format(filename).ValueOrDie() == expected);
+  read_and_check(filename, source_pos, sipm_ids, counts);
+
+  auto meta = read_metadata(filename).ValueOrDie();
+  CHECK(meta["output_format"] == format);
+  CHECK(meta["n_sipms_x"    ] == "2");
+
+  UI -> ApplyCommand("/my/output_format auto");
+  UI -> ApplyCommand("/my/ipc_compression none");
+  std::filesystem::remove(filename);
+}
+
+TEST_CASE("io quantised columns", "[io][writer][quantisation]") {
+  n4::test::default_run_manager().run(0);
+
+  auto UI = G4UImanager::GetUIpointer();
+  UI -> ApplyCommand("/my/n_sipms_xy 2");
+  UI -> ApplyCommand("/my/chunk_size 3");
+  UI -> ApplyCommand("/my/position_resolution 10 um");
+  UI -> ApplyCommand("/my/edep_resolution 1 keV");
+  UI -> ApplyCommand("/my/count_bits 16");
+
+  auto extension = GENERATE(".parquet", ".arrow");
+  std::string filename = std::tmpnam(nullptr) + std::string{extension};
+  UI -> ApplyCommand("/my/outfile " + filename);
+
+  std::vector<G4ThreeVector> source_pos{{0.123456, -1.5, 2.25}, {-3.000004, 4.5, -7.777777}, {0, 0, 0}, {1, 2, 3}};
+  std::vector<interaction>   interactions{{0.5f, -0.25f, -3.333333f, 0.3f, 0}, {1.000004f, 2, -5, 0.211f, 1}};
+  {
+    auto writer = parquet_writer(my.freeze());
+    for (size_t i=0; i<source_pos.size(); i++) {
+      REQUIRE(writer.append(source_pos[i], interactions, {{0, 60'000}, {1, i}, {3, 7}}).ok());
+    }
+    // Rejected whole, leaving the columns aligned
+    CHECK(! writer.append(source_pos[0], interactions, {{0, 70'000}}).ok());
+  }
+
+  // Stored narrower, with the scales in the metadata
+  auto meta = read_metadata(filename).ValueOrDie();
+  CHECK(std::stod(meta["position_scale"]) == 10 * um);
+  CHECK(std::stod(meta[    "edep_scale"]) ==  1 * keV);
+  CHECK(meta["count_bits"] == "16");
+  CHECK(meta["schema_fingerprint"] == expected_fingerprint(*my.frozen()));
+
+  // Read back transparently, to within half the resolution
+  auto rows = read_entire_file(filename).ValueOrDie();
+  REQUIRE(rows.size() == source_pos.size());
+  for (size_t i=0; i<rows.size(); i++) {
+    auto [pos, read_interactions, counts] = rows[i];
+    for (auto k: {0, 1, 2}) { CHECK_THAT(pos[k], WithinAbs(source_pos[i][k], 5 * um + 1e-6)); }
+    REQUIRE(read_interactions.size() == interactions.size());
+    for (size_t n=0; n<interactions.size(); n++) {
+      CHECK_THAT(read_interactions[n].x   , WithinAbs(interactions[n].x   , 5 * um + 1e-6));
+      CHECK_THAT(read_interactions[n].z   , WithinAbs(interactions[n].z   , 5 * um + 1e-6));
+      CHECK_THAT(read_interactions[n].edep, WithinAbs(interactions[n].edep, 0.5 * keV + 1e-6));
+      CHECK     (read_interactions[n].type == interactions[n].type);
+    }
+    CHECK(counts[0] == 60'000);
+    CHECK(counts[1] == i);
+    CHECK(counts[2] == 0);
+    CHECK(counts[3] == 7);
+  }
+
+  auto table = read_table(filename).ValueOrDie();
+  CHECK(table -> GetColumnByName("x") -> type() -> Equals(arrow::float32()));
+
+  UI -> ApplyCommand("/my/position_resolution 0 um");
+  UI -> ApplyCommand("/my/edep_resolution 0 keV");
+  UI -> ApplyCommand("/my/count_bits 0");
+  std::filesystem::remove(filename);
+}
+
+TEST_CASE("io quantised column types", "[io][writer][quantisation]") {
+  n4::test::default_run_manager().run(0);
+
+  auto UI = G4UImanager::GetUIpointer();
+  UI -> ApplyCommand("/my/n_sipms_xy 2");
+  UI -> ApplyCommand("/my/position_resolution 10 um");
+  UI -> ApplyCommand("/my/edep_resolution 1 keV");
+  UI -> ApplyCommand("/my/count_bits 8");
+
+  std::string filename = std::tmpnam(nullptr);
+  UI -> ApplyCommand("/my/outfile " + filename);
+  write_roundtrip_events({{0, 1, 2}}, {{1, 2, 3, 255}});
+
+  std::shared_ptr<arrow::Schema> schema;
+  REQUIRE(open_parquet(filename).ValueOrDie() -> GetSchema(&schema).ok());
+  auto fields = static_pointer_cast<arrow::ListType>(schema -> GetFieldByName("interactions") -> type()) -> value_type();
+  auto counts      = static_pointer_cast<arrow::FixedSizeListType>(schema -> GetFieldByName("photon_counts") -> type());
+  CHECK(schema -> GetFieldByName("x") -> type() -> Equals(arrow::int16()));
+  CHECK(fields -> field(0) -> type() -> Equals(arrow:: int16()));
+  CHECK(fields -> field(3) -> type() -> Equals(arrow::uint16())); // 511 keV fits
+  CHECK(counts -> value_type() -> Equals(arrow::uint8()));
+
+  // Too fine for 16 bits over the whole world
+  UI -> ApplyCommand("/my/position_resolution 0.01 um");
+  CHECK(my.freeze() -> quantisation.position_bits == 32);
+
+  UI -> ApplyCommand("/my/count_bits 12");
+  CHECK_THROWS(my.freeze());
+
+  // Narrowed automatically only when the generator bounds the counts
+  UI -> ApplyCommand("/my/count_bits 0");
+  CHECK(my.freeze() -> quantisation.count_bits == 32);
+  auto generator = my.generator;
+  UI -> ApplyCommand("/my/generator photons");
+  UI -> ApplyCommand("/source/nphotons 1000");
+  CHECK(my.freeze() -> quantisation.count_bits == 16);
+  UI -> ApplyCommand("/source/nphotons 200");
+  CHECK(my.freeze() -> quantisation.count_bits ==  8);
+  UI -> ApplyCommand("/my/generator " + generator);
+  UI -> ApplyCommand("/source/nphotons 1000");
+
+  UI -> ApplyCommand("/my/position_resolution 0 um");
+  UI -> ApplyCommand("/my/edep_resolution 0 keV");
+  UI -> ApplyCommand("/my/count_bits 0");
+  std::filesystem::remove(filename);
+}
+
+// An analysis process can consume the events while they are written
+TEST_CASE("io arrow ipc stream through a named pipe", "[io][ipc][writer][fifo]") {
+  n4::test::default_run_manager().run(0);
+
+  auto UI = G4UImanager::GetUIpointer();
+  UI -> ApplyCommand("/my/n_sipms_xy 2");
+  UI -> ApplyCommand("/my/chunk_size 1");
+
+  std::string filename = std::tmpnam(nullptr);
+  REQUIRE(mkfifo(filename.c_str(), 0600) == 0);
+  UI -> ApplyCommand("/my/outfile " + filename);
+  CHECK(resolve_output_format(output_format_enum::automatic, filename) == output_format_enum::stream);
+
+  std::vector<G4ThreeVector>       source_pos{{0, 1, 2}, {0.5, 1.5, 2.5}};
+  std::vector<std::vector<size_t>> counts    {{1, 2, 3, 4}, {5, 6, 7, 8}};
+
+  // Opening either end of the pipe blocks until the other one is opened
+  std::shared_ptr<arrow::Table> table;
+  std::thread consumer{[&] { table = read_table(filename).ValueOrDie(); }};
+  write_roundtrip_events(source_pos, counts);
+  consumer.join();
+
+  REQUIRE(table);
+  CHECK(table -> num_rows() == 2);
+  CHECK(table -> column(4) -> num_chunks() == 2); // One record batch per chunk
+  std::filesystem::remove(filename);
+}
+
 // The parquet test file was generated with
 //
 //   just run -e "/my/n_sipms_xy 2" -n 4
@@ -162,6 +452,47 @@ TEST_CASE("io parquet reader metadata", "[io][parquet][reader][metadata]") {
   CHECK(! meta["ARROW:schema"].empty());
 }
 
+// A single column, and no schema metadata
+std::shared_ptr<arrow::Table> table_without_metadata() {
+  arrow::UInt32Builder builder;
+  REQUIRE(builder.Append(1).ok());
+  auto column = builder.Finish().ValueOrDie();
+  return arrow::Table::Make(arrow::schema({arrow::field("event_id", arrow::uint32())}), {column});
+}
+
+TEST_CASE("io parquet reader without metadata", "[io][parquet][reader][metadata]") {
+  std::string filename = std::tmpnam(nullptr);
+  auto sink = arrow::io::FileOutputStream::Open(filename).ValueOrDie();
+  REQUIRE(parquet::arrow::WriteTable(*table_without_metadata(), arrow::default_memory_pool(), sink, 1).ok());
+  REQUIRE(sink -> Close().ok());
+
+  auto maybe_meta = read_metadata(filename);
+  REQUIRE(maybe_meta.ok());
+  CHECK(maybe_meta.ValueOrDie().empty());
+  CHECK(! sipm_positions_from_metadata(filename).ok());
+  std::remove(filename.c_str());
+}
+
+TEST_CASE("io arrow ipc reader without metadata", "[io][ipc][reader][metadata]") {
+  auto table = table_without_metadata();
+  for (auto stream: {false, true}) {
+    std::string filename = std::tmpnam(nullptr);
+    filename += stream ? ".arrows" : ".arrow";
+    {
+      auto sink   = arrow::io::FileOutputStream::Open(filename).ValueOrDie();
+      auto writer = stream ? arrow::ipc::MakeStreamWriter(sink, table -> schema()).ValueOrDie()
+                           : arrow::ipc::MakeFileWriter  (sink, table -> schema()).ValueOrDie();
+      REQUIRE(writer -> WriteTable(*table).ok());
+      REQUIRE(writer -> Close().ok());
+      REQUIRE(sink -> Close().ok());
+    }
+    auto maybe_meta = read_metadata(filename);
+    REQUIRE(maybe_meta.ok());
+    CHECK(maybe_meta.ValueOrDie().empty());
+    std::remove(filename.c_str());
+  }
+}
+
 TEST_CASE("io parquet roundtrip metadata", "[io][parquet][writer][metadata]") {
   std::string filename = std::tmpnam(nullptr);
   auto nevt = "2";
@@ -210,3 +541,145 @@ TEST_CASE("io parquet roundtrip metadata", "[io][parquet][writer][metadata]") {
   REQUIRE(meta.contains("commit-msg"));
   CHECK(! meta["commit-msg"].empty());
 }
+
+TEST_CASE("io forced interaction weights", "[io][parquet][writer][biasing]") {
+  std::string filename = std::tmpnam(nullptr);
+  auto nevt = 20;
+  auto args_list = std::initializer_list<std::string>{
+      "progname"
+    , "-n", std::to_string(nevt)
+    , "-e"
+    , "/my/outfile " + filename
+    , "/my/scint_depth 2 mm"
+    , "/my/force_interaction true"
+  };
+  auto args = n4::test::argcv(args_list);
+
+  run_stats stats;
+  n4::run_manager::create()
+    .ui("progname", args.argc, args.argv)
+    .apply_cli_early()
+    .physics(physics_list())
+    .geometry([&] {return crystal_geometry(stats);})
+    .actions(create_actions(stats))
+    .run();
+
+  std::shared_ptr<arrow::io::RandomAccessFile> input;
+  std::unique_ptr<parquet::arrow::FileReader> reader;
+  std::shared_ptr<arrow::Table>                table;
+  input = arrow::io::ReadableFile::Open(filename).ValueOrDie();
+  REQUIRE(parquet::arrow::OpenFile(input, arrow::default_memory_pool(), &reader).ok());
+  REQUIRE(reader -> ReadTable(&table).ok());
+  REQUIRE(table -> num_rows() == nevt);
+
+  auto column = table -> GetColumnByName("weight");
+  REQUIRE(column);
+  auto weights = std::static_pointer_cast<arrow::FloatArray>(column -> chunk(0));
+
+  // Every gamma interacts in such a thin crystal only because it is
+  // forced to, so the histories depositing energy carry small weights
+  auto n_weighted = 0;
+  for (auto i=0; i<weights -> length(); i++) {
+    auto w = weights -> Value(i);
+    CHECK(w >  0);
+    CHECK(w <= 1);
+    n_weighted += w < 1;
+  }
+  CHECK(n_weighted > nevt / 2);
+}
+
+TEST_CASE("synthetic events", "[io][synthetic]") {
+  G4UImanager::GetUIpointer() -> ApplyCommand("/my/n_sipms_xy 4");
+  auto cfg = my.freeze();
+  synthetic_events a{cfg -> sipm_positions, cfg -> scint_size, 42};
+  synthetic_events b{cfg -> sipm_positions, cfg -> scint_size, 42};
+  auto [sx, sy, sz] = n4::unpack(cfg -> scint_size);
+
+  size_t n_with_light = 0;
+  for (auto i=0; i<1'000; i++) {
+    auto ea = a.next(), eb = b.next();
+    CHECK(ea.primary_pos         == eb.primary_pos        );
+    CHECK(ea.counts              == eb.counts             );
+    CHECK(ea.interactions.size() == eb.interactions.size());
+    REQUIRE(! ea.interactions.empty());
+    for (const auto& x: ea.interactions) {
+      CHECK(std::abs(x.x) <= sx/2);
+      CHECK(std::abs(x.y) <= sy/2);
+      CHECK(x.z <= 0);
+      CHECK(x.z >= -sz);
+    }
+    for (const auto& [n, _]: ea.counts) { CHECK(n < cfg -> n_sipms); }
+    n_with_light += ! ea.counts.empty();
+  }
+  CHECK(n_with_light > 900);
+}
+
+// Not run by default: select with "[benchmark]". Synthetic events, so no
+// Geant4 run is needed. One setting is varied at a time, around 64
+// SiPMs, chunks of 1024 rows and the default compression.
+void benchmark_io(const std::string& label) {
+  using clock = std::chrono::steady_clock;
+  auto n_events = 10'000;
+  std::string filename = std::tmpnam(nullptr);
+  G4UImanager::GetUIpointer() -> ApplyCommand("/my/outfile " + filename);
+  auto cfg = my.freeze();
+
+  synthetic_events source{cfg -> sipm_positions, cfg -> scint_size};
+  std::vector<synthetic_event> events;
+  for (auto i=0; i<n_events; i++) { events.push_back(source.next()); }
+
+  // Failures are counted rather than checked, to keep Catch2 out of the
+  // timed loop, and required to be none once it is done
+  auto write_all = [&] {
+    size_t n_failed = 0;
+    parquet_writer writer{cfg};
+    for (const auto& e: events) { n_failed += ! writer.append(e.primary_pos, e.interactions, e.counts).ok(); }
+    return n_failed;
+  };
+
+  size_t n_failed = 0;
+  BENCHMARK("write " + label) { n_failed += write_all(); return n_events; };
+  REQUIRE(n_failed == 0);
+  BENCHMARK("read  " + label) { return read_entire_file(filename).ValueOrDie().size(); };
+
+  // Catch2 reports times only: derive the throughputs from one more pass
+  auto bytes = std::filesystem::file_size(filename);
+  auto start = clock::now();
+  n_failed = write_all();
+  std::chrono::duration<double> write_time = clock::now() - start;
+  REQUIRE(n_failed == 0);
+  start = clock::now();
+  auto n_read = read_entire_file(filename).ValueOrDie().size();
+  std::chrono::duration<double> read_time = clock::now() - start;
+  CHECK(n_read == n_events);
+
+  WARN(label << ": " << bytes / n_events << " bytes/row"
+             << "; write " << n_events / write_time.count() << " rows/s, " << bytes / write_time.count() / 1e6 << " MB/s"
+             << "; read "  << n_events /  read_time.count() << " rows/s, " << bytes /  read_time.count() / 1e6 << " MB/s");
+  std::filesystem::remove(filename);
+}
+
+TEST_CASE("io benchmarks", "[.][benchmark][io]") {
+  auto UI = G4UImanager::GetUIpointer();
+  UI -> ApplyCommand("/my/n_sipms_xy 8");
+  UI -> ApplyCommand("/my/chunk_size 1024");
+
+  SECTION("sipms") {
+    for (auto n: {1, 4, 8, 16}) {
+      UI -> ApplyCommand("/my/n_sipms_xy " + std::to_string(n));
+      benchmark_io(std::to_string(n*n) + " SiPMs");
+    }
+  }
+  SECTION("chunk size") {
+    for (auto chunk: {128, 1024, 8192}) {
+      UI -> ApplyCommand("/my/chunk_size " + std::to_string(chunk));
+      benchmark_io("chunks of " + std::to_string(chunk));
+    }
+  }
+  SECTION("compression") {
+    for (auto spec: {"none", "snappy", "lz4", "zstd-3", "zstd", "gzip", "brotli-5", "brotli"}) {
+      UI -> ApplyCommand(std::string{"/my/compression "} + spec);
+      benchmark_io(std::string{"compression "} + spec);
+    }
+  }
+}
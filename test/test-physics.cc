@@ -0,0 +1,133 @@
+#include <actions.hh>
+#include <config.hh>
+#include <geometry.hh>
+#include <physics-list.hh>
+#include <run_stats.hh>
+
+#include <n4-all.hh>
+
+#include <G4OpticalParameters.hh>
+#include <G4ProcessManager.hh>
+#include <G4UImanager.hh>
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+
+#include <unistd.h>
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+
+bool has_process(const std::string& particle, const std::string& process) {
+  auto manager = n4::find_particle(particle) -> GetProcessManager();
+  return manager -> GetProcess(process) != nullptr;
+}
+
+n4::run_manager* run_manager_with(const std::string& list, int n_events, run_stats& stats) {
+  auto args = n4::test::argcv({"progname", "-n", std::to_string(n_events), "-e", "/my/physics_list " + list});
+  return n4::run_manager::create()
+    .ui("progname", args.argc, args.argv)
+    .apply_cli_early()
+    .physics(physics_list())
+    .geometry([&] {return crystal_geometry(stats);})
+    .actions(create_actions(stats))
+    .run();
+}
+
+TEST_CASE("lean physics list", "[physics][lean]") {
+  run_stats stats;
+  run_manager_with("lean", 0, stats);
+
+  for (auto process: {"phot", "compt", "Rayl", "conv"}) { CHECK(has_process("gamma", process)); }
+  CHECK(has_process("e-"           , "eIoni"        ));
+  CHECK(has_process("opticalphoton", "OpAbsorption" ));
+
+  // No hadronic physics
+  CHECK(! has_process("gamma", "photonNuclear"));
+  CHECK(physics_list_description().starts_with("lean+EM-option4+optical"));
+}
+
+TEST_CASE("full physics list", "[physics][full]") {
+  run_stats stats;
+  run_manager_with("full", 0, stats);
+
+  for (auto process: {"phot", "compt", "Rayl", "conv"}) { CHECK(has_process("gamma", process)); }
+  CHECK(has_process("gamma", "photonNuclear"));
+  CHECK(physics_list_description().starts_with("FTFP_BERT+EM-option4+optical"));
+}
+
+TEST_CASE("optical processes can be switched off", "[physics][optical]") {
+  run_stats stats;
+  auto args = n4::test::argcv({ "progname", "-n", "0", "-e"
+                              , "/my/disable_optical_process Cerenkov"
+                              , "/my/disable_optical_process OpWLS"
+                              , "/my/cerenkov_max_photons 7" });
+  n4::run_manager::create()
+    .ui("progname", args.argc, args.argv)
+    .apply_cli_early()
+    .physics(physics_list())
+    .geometry([&] {return crystal_geometry(stats);})
+    .actions(create_actions(stats))
+    .run();
+
+  CHECK(! has_process("e-"           , "Cerenkov"     ));
+  CHECK(! has_process("opticalphoton", "OpWLS"        ));
+  CHECK(  has_process("e-"           , "Scintillation"));
+  CHECK(  has_process("opticalphoton", "OpBoundary"   ));
+  CHECK(G4OpticalParameters::Instance() -> GetCerenkovMaxPhotonsPerStep() == 7);
+
+  auto meta = my.as_map();
+  CHECK(meta["optical_Cerenkov"    ] == "off");
+  CHECK(meta["cerenkov_max_photons"] == "7"  );
+  CHECK_THROWS(G4UImanager::GetUIpointer() -> ApplyCommand("/my/disable_optical_process Cherenkov"));
+}
+
+TEST_CASE("physics tables are stored in the cache", "[physics][cache]") {
+  auto cache = std::filesystem::temp_directory_path() / ("crystal-test-tables-" + std::to_string(getpid()));
+  G4UImanager::GetUIpointer() -> ApplyCommand("/my/physics_table_cache " + cache.string());
+
+  run_stats stats;
+  run_manager_with("lean", 1, stats);
+
+  auto dir = std::filesystem::path{physics_table_dir()};
+  CHECK(dir.parent_path() == cache);
+  REQUIRE(std::filesystem::is_directory(dir));
+  CHECK(! std::filesystem::is_empty(dir));
+
+  // Anything affecting the tables selects a different entry
+  G4UImanager::GetUIpointer() -> ApplyCommand("/my/crystal_cut 0.2 mm");
+  CHECK(physics_table_dir() != dir.string());
+  G4UImanager::GetUIpointer() -> ApplyCommand("/my/crystal_cut 0.7 mm");
+  CHECK(physics_table_dir() == dir.string());
+  G4UImanager::GetUIpointer() -> ApplyCommand("/my/reflectivity 0.5");
+  CHECK(physics_table_dir() != dir.string());
+  G4UImanager::GetUIpointer() -> ApplyCommand("/my/wrapping esr");
+  CHECK(physics_table_dir() != dir.string());
+  G4UImanager::GetUIpointer() -> ApplyCommand("/my/scint BGO");
+  CHECK(physics_table_dir() != dir.string());
+
+  G4UImanager::GetUIpointer() -> ApplyCommand("/my/wrapping teflon");
+  my.reflectivity = std::nullopt;
+  std::filesystem::remove_all(cache);
+}
+
+// Not run by default: select with "[benchmark]". Each list needs its own
+// process, as only one run manager can exist
+void benchmark_physics_list(const std::string& list) {
+  using clock = std::chrono::steady_clock;
+  run_stats stats;
+  auto  start = clock::now();
+  auto  rm    = run_manager_with(list, 1, stats); // Includes table building
+  std::chrono::duration<double> init = clock::now() - start;
+  WARN(list << " physics list initialisation + 1 event: " << init.count() << " s");
+
+  auto n_events = 100;
+  BENCHMARK(list + " physics list: " + std::to_string(n_events) + " events") {
+    rm -> run(n_events);
+    return stats.n_detected_total;
+  };
+}
+
+TEST_CASE("lean physics list benchmark", "[.][benchmark][physics]") { benchmark_physics_list("lean"); }
+TEST_CASE("full physics list benchmark", "[.][benchmark][physics]") { benchmark_physics_list("full"); }
@@ -0,0 +1,141 @@
+#include <actions.hh>
+#include <config.hh>
+#include <geometry.hh>
+#include <io.hh>
+#include <physics-list.hh>
+#include <reconstruction.hh>
+
+#include <n4-all.hh>
+
+#include <arrow/io/api.h>
+#include <parquet/arrow/reader.h>
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+using Catch::Matchers::WithinAbs;
+
+// 2x2 SiPMs at (+-3, +-3), in the order of `config::sipm_positions`
+const std::vector<G4ThreeVector> sipms{{-3, -3, 0}, {-3, 3, 0}, {3, -3, 0}, {3, 3, 0}};
+
+reco_params params(reco_method_enum method, double truncation = 0) {
+  return {.method = method, .truncation = truncation, .lrf_file = ""};
+}
+
+TEST_CASE("anger reconstruction", "[reconstruction]") {
+  reconstructor reco{params(reco_method_enum::anger), sipms};
+  std::vector<uint32_t> counts {
+    10, 10, 10, 10, // Centre
+     0,  0, 30, 10, // Pulled towards +x, -y
+     0,  0,  0,  0, // No light
+  };
+  reco_batch out;
+  reco.reconstruct(counts.data(), 3, out);
+  REQUIRE(out.x.size() == 3);
+
+  CHECK_THAT(out.x  [0], WithinAbs(0, 1e-6));
+  CHECK_THAT(out.y  [0], WithinAbs(0, 1e-6));
+  CHECK_THAT(out.doi[0], WithinAbs(std::sqrt(18), 1e-5));
+
+  CHECK_THAT(out.x[1], WithinAbs( 3  , 1e-6));
+  CHECK_THAT(out.y[1], WithinAbs(-1.5, 1e-6));
+  CHECK(out.doi[1] < out.doi[0]); // More concentrated light
+
+  CHECK(std::isnan(out.x[2]));
+  CHECK(std::isnan(out.y[2]));
+  CHECK(std::isnan(out.doi[2]));
+}
+
+TEST_CASE("truncated centroid reconstruction", "[reconstruction]") {
+  std::vector<uint32_t> counts{5, 5, 40, 10};
+  reco_batch anger, truncated;
+  reconstructor{params(reco_method_enum::anger        ), sipms}.reconstruct(counts.data(), 1, anger);
+  reconstructor{params(reco_method_enum::truncated, .2), sipms}.reconstruct(counts.data(), 1, truncated);
+
+  // Only the SiPMs above 20% of the maximum contribute
+  CHECK_THAT(truncated.x[0], WithinAbs( 3         , 1e-6));
+  CHECK_THAT(truncated.y[0], WithinAbs(-3 + 6 * 2. / 34, 1e-5));
+  CHECK(truncated.x[0] > anger.x[0]);
+  CHECK(truncated.y[0] < anger.y[0]);
+}
+
+TEST_CASE("maximum likelihood reconstruction", "[reconstruction]") {
+  // Each point of the grid puts most of its light in the SiPM below it
+  light_response lrf{.n_sipms = sipms.size()};
+  for (size_t k=0; k<sipms.size(); k++) {
+    for (auto z: {-10.f, -2.f}) {
+      lrf.x.push_back(sipms[k].x());
+      lrf.y.push_back(sipms[k].y());
+      lrf.z.push_back(z);
+      for (size_t i=0; i<sipms.size(); i++) {
+        // Closer to the readout the light is more concentrated
+        lrf.mean.push_back(i == k ? (z > -5 ? 70 : 40) : (z > -5 ? 10 : 20));
+      }
+    }
+  }
+  CHECK_THROWS(reconstructor{params(reco_method_enum::ml), sipms});
+  reconstructor reco{params(reco_method_enum::ml), sipms, lrf};
+
+  std::vector<uint32_t> counts {
+    140, 20,  20,  20, // Near, above SiPM 0
+     40, 40,  80,  40, // Far , above SiPM 2
+      0,  0,   0,   0,
+  };
+  reco_batch out;
+  reco.reconstruct(counts.data(), 3, out);
+  CHECK(out.x  [0] == -3); CHECK(out.y[0] == -3); CHECK(out.doi[0] ==  -2);
+  CHECK(out.x  [1] ==  3); CHECK(out.y[1] == -3); CHECK(out.doi[1] == -10);
+  CHECK(std::isnan(out.x[2]));
+}
+
+TEST_CASE("reconstructed positions are written", "[reconstruction][io]") {
+  std::string filename = std::tmpnam(nullptr);
+  auto nevt = 10;
+  auto args_list = std::initializer_list<std::string>{
+      "progname"
+    , "-n", std::to_string(nevt)
+    , "-e"
+    , "/my/outfile " + filename
+    , "/my/n_sipms_xy 2"
+    , "/my/reco anger"
+  };
+  auto args = n4::test::argcv(args_list);
+
+  run_stats stats;
+  n4::run_manager::create()
+    .ui("progname", args.argc, args.argv)
+    .apply_cli_early()
+    .physics(physics_list())
+    .geometry([&] {return crystal_geometry(stats);})
+    .actions(create_actions(stats))
+    .run();
+
+  std::shared_ptr<arrow::io::RandomAccessFile> input;
+  std::unique_ptr<parquet::arrow::FileReader> reader;
+  std::shared_ptr<arrow::Table>                table;
+  input = arrow::io::ReadableFile::Open(filename).ValueOrDie();
+  REQUIRE(parquet::arrow::OpenFile(input, arrow::default_memory_pool(), &reader).ok());
+  REQUIRE(reader -> ReadTable(&table).ok());
+
+  auto half_width = my.scint_size().x() / 2;
+  for (auto name: {"reco_x", "reco_y"}) {
+    auto column = table -> GetColumnByName(name);
+    REQUIRE(column);
+    REQUIRE(column -> length() == table -> num_rows());
+    for (const auto& chunk: column -> chunks()) {
+      auto values = std::static_pointer_cast<arrow::FloatArray>(chunk);
+      for (auto i=0; i<values -> length(); i++) {
+        auto v = values -> Value(i);
+        if (! std::isnan(v)) { CHECK(std::abs(v) <= half_width); }
+      }
+    }
+  }
+  CHECK(table -> GetColumnByName("reco_doi"));
+
+  my.reco = reco_method_enum::none;
+  std::remove(filename.c_str());
+}
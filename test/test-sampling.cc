@@ -0,0 +1,123 @@
+#include <config.hh>
+#include <sampling.hh>
+
+#include <pet-materials.hh>
+
+#include <n4-all.hh>
+
+#include <G4UImanager.hh>
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+
+#include <cmath>
+
+using Catch::Matchers::WithinAbs;
+using Catch::Matchers::WithinRel;
+
+TEST_CASE("alias sampler trapezoid", "[sampling][alias]") {
+  // Rises over [0,1], flat over [1,2], falls over [2,3]
+  alias_sampler sampler{{0, 1, 2, 3}, {0, 1, 1, 0}};
+  std::vector<double> values;
+  auto n = 1'000'000;
+  sampler.sample(values, n);
+
+  double sum = 0;
+  std::vector<double> in_bin(3, 0);
+  for (auto v: values) {
+    REQUIRE(v >= 0);
+    REQUIRE(v <= 3);
+    sum += v;
+    in_bin[std::min(static_cast<size_t>(v), size_t{2})]++;
+  }
+  CHECK_THAT(sum / n      , WithinRel(1.5 , 1e-2));
+  CHECK_THAT(in_bin[0] / n, WithinRel(0.25, 1e-2));
+  CHECK_THAT(in_bin[1] / n, WithinRel(0.5 , 1e-2));
+  CHECK_THAT(in_bin[2] / n, WithinRel(0.25, 1e-2));
+}
+
+TEST_CASE("alias sampler within bin", "[sampling][alias]") {
+  // Density 2x over [0,1] has mean 2/3
+  alias_sampler sampler{{0, 1}, {0, 2}};
+  auto n = 1'000'000;
+  double sum = 0;
+  for (auto i=0; i<n; i++) { sum += sampler.sample(); }
+  CHECK_THAT(sum / n, WithinRel(2.0/3, 1e-2));
+}
+
+TEST_CASE("alias sampler matches scintillation spectrum", "[sampling][alias][spectrum]") {
+  auto [energies, intensities] = petmat::csi_scint_spectrum();
+  auto [e_min, e_max] = n4::stats::min_max(energies).value();
+  alias_sampler alias{energies, intensities};
+  n4::random::piecewise_linear_distribution reference{std::move(energies), std::move(intensities)};
+
+  auto n = 100'000;
+  std::vector<double> values;
+  alias.sample(values, n);
+  double alias_sum = 0, reference_sum = 0;
+  for (auto v: values) {
+    CHECK(v >= e_min);
+    CHECK(v <= e_max);
+    alias_sum     += v;
+    reference_sum += reference.sample();
+  }
+  CHECK_THAT(alias_sum / n, WithinRel(reference_sum / n, 1e-3));
+}
+
+TEST_CASE("batched isotropic directions", "[sampling][direction]") {
+  std::vector<G4ThreeVector> directions, polarisations;
+  auto n = 100'000;
+  isotropic_directions(n, directions, polarisations);
+  REQUIRE(directions   .size() == n);
+  REQUIRE(polarisations.size() == n);
+
+  G4ThreeVector average{};
+  for (auto i=0; i<n; i++) {
+    CHECK_THAT(directions   [i].mag()                     , WithinRel(1, 1e-12));
+    CHECK_THAT(polarisations[i].mag()                     , WithinRel(1, 1e-12));
+    CHECK_THAT(directions   [i].dot(polarisations[i])     , WithinAbs(0, 1e-12));
+    average += directions[i];
+  }
+  average /= n;
+  CHECK_THAT(average.x(), WithinAbs(0, 1e-2));
+  CHECK_THAT(average.y(), WithinAbs(0, 1e-2));
+  CHECK_THAT(average.z(), WithinAbs(0, 1e-2));
+}
+
+TEST_CASE("rng engine selection", "[sampling][rng]") {
+  auto UI = G4UImanager::GetUIpointer();
+  for (auto engine: {"ranlux", "mtwist", "mixmax"}) {
+    UI -> ApplyCommand(std::string{"/my/rng_engine "} + engine);
+    CHECK(rng_engine_enum_to_string(my.rng_engine) == engine);
+    CHECK(G4Random::getTheSeed() == my.seed);
+  }
+}
+
+// Not run by default: select with "[benchmark]"
+TEST_CASE("sampling benchmarks", "[.][benchmark][sampling]") {
+  auto n = 100'000;
+  auto [energies, intensities] = petmat::csi_scint_spectrum();
+  alias_sampler alias{energies, intensities};
+  n4::random::piecewise_linear_distribution reference{std::move(energies), std::move(intensities)};
+  auto isotropic = n4::random::direction{};
+  std::vector<double> buffer;
+  std::vector<G4ThreeVector> directions, polarisations;
+
+  BENCHMARK("spectrum: piecewise linear") { double s=0; for (auto i=0; i<n; i++) { s += reference.sample(); } return s; };
+  BENCHMARK("spectrum: alias, one by one") { double s=0; for (auto i=0; i<n; i++) { s += alias.sample(); } return s; };
+  BENCHMARK("spectrum: alias, batched"   ) { alias.sample(buffer, n); return buffer.back(); };
+
+  BENCHMARK("directions: n4 one by one") {
+    G4ThreeVector s{};
+    for (auto i=0; i<n; i++) { s += isotropic.get(); s += isotropic.get(); }
+    return s;
+  };
+  BENCHMARK("directions: batched") { isotropic_directions(n, directions, polarisations); return directions.back(); };
+
+  auto UI = G4UImanager::GetUIpointer();
+  for (auto engine: {"mixmax", "ranlux", "ranlux64", "mtwist", "ranecu", "ranshi", "james"}) {
+    UI -> ApplyCommand(std::string{"/my/rng_engine "} + engine);
+    BENCHMARK(std::string{"uniforms: "} + engine) { fill_uniform(buffer, n); return buffer.back(); };
+  }
+}
@@ -0,0 +1,85 @@
+#include <scan.hh>
+
+#include <n4-all.hh>
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+
+#include <cmath>
+#include <set>
+#include <tuple>
+
+using Catch::Matchers::WithinRel;
+using Catch::Matchers::WithinULP;
+
+scan_params grid(unsigned nx, unsigned ny, unsigned nz) {
+  return { .nx = nx, .ny = ny, .nz = nz, .events_per_position = 10, .hist_bins = 4, .hist_max = 40 };
+}
+
+TEST_CASE("running stats", "[scan][welford]") {
+  std::vector<double> xs;
+  for (auto i=0; i<1000; i++) { xs.push_back(1e6 + n4::random::uniform(0, 10)); }
+
+  running_stats stats;
+  for (auto x: xs) { stats.add(x); }
+
+  double mean = 0, var = 0;
+  for (auto x: xs) { mean += x; }                    mean /= xs.size();
+  for (auto x: xs) { var  += (x - mean) * (x - mean); } var /= xs.size() - 1;
+
+  CHECK(stats.n == xs.size());
+  CHECK_THAT(stats.mean      , WithinRel(mean, 1e-12));
+  CHECK_THAT(stats.variance(), WithinRel(var , 1e-9 ));
+}
+
+TEST_CASE("scan grid positions", "[scan][grid]") {
+  auto params = grid(2, 3, 4);
+  G4ThreeVector size{20, 30, 40};
+  REQUIRE(params.n_positions() == 24);
+
+  // Cell centres, all distinct and inside the crystal
+  std::set<std::tuple<double, double, double>> seen;
+  for (size_t i=0; i<params.n_positions(); i++) {
+    auto [x, y, z] = n4::unpack(params.position(i, size));
+    CHECK(std::abs(x) < 10);
+    CHECK(std::abs(y) < 15);
+    CHECK(z > -40);
+    CHECK(z <   0);
+    seen.insert({x, y, z});
+  }
+  CHECK(seen.size() == params.n_positions());
+
+  auto first = params.position(0, size);
+  CHECK_THAT(first.x(), WithinULP( -5.0, 1));
+  CHECK_THAT(first.y(), WithinULP(-10.0, 1));
+  CHECK_THAT(first.z(), WithinULP(-35.0, 1));
+
+  // Consecutive events stay at the same position
+  CHECK(params.position_of_event( 0) == 0);
+  CHECK(params.position_of_event( 9) == 0);
+  CHECK(params.position_of_event(10) == 1);
+  CHECK(params.position_of_event(240) == 0); // Wraps around
+}
+
+TEST_CASE("scan accumulator", "[scan][accumulator]") {
+  scan_accumulator acc{grid(1, 1, 1), 2};
+  CHECK(acc.empty());
+
+  acc.add({{0,  5}});
+  acc.add({{0, 15}, {1, 100}});
+  acc.add({{0, 25}});
+  auto summary = acc.summarise(7);
+
+  CHECK(summary.position == 7);
+  CHECK(summary.n_events == 3);
+  CHECK_THAT(summary.mean    [0], WithinULP(15.f, 1));
+  CHECK_THAT(summary.variance[0], WithinULP(100.f, 1));
+  // SiPMs without counts in an event contribute zeros
+  CHECK_THAT(summary.mean    [1], WithinRel(100.f / 3, 1e-6));
+  CHECK(summary.histogram[0] == std::vector<uint32_t>{1, 1, 1, 0});
+  CHECK(summary.histogram[1] == std::vector<uint32_t>{2, 0, 0, 1}); // Overflow in last bin
+
+  acc.reset();
+  CHECK(acc.empty());
+  CHECK(acc.summarise(0).histogram[0] == std::vector<uint32_t>{0, 0, 0, 0});
+}
@@ -0,0 +1,212 @@
+#include <actions.hh>
+#include <config.hh>
+#include <geometry.hh>
+#include <io.hh>
+#include <physics-list.hh>
+#include <summary.hh>
+
+#include <n4-all.hh>
+
+#include <Randomize.hh>
+
+#include <arrow/io/api.h>
+#include <parquet/arrow/reader.h>
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <numeric>
+
+using Catch::Matchers::WithinAbs;
+using Catch::Matchers::WithinRel;
+
+summary_params params(unsigned bins = 10) {
+  return {.enabled = true, .bins = bins, .sipm_max = 100, .total_max = 1000, .outfile = ""};
+}
+
+double exact_quantile(std::vector<double> xs, double p) {
+  std::sort(begin(xs), end(xs));
+  return xs[static_cast<size_t>(p * (xs.size() - 1))];
+}
+
+TEST_CASE("P2 quantiles", "[summary][quantile]") {
+  std::vector<double> uniform, exponential;
+  for (auto i=0; i<100'000; i++) {
+    uniform    .push_back(n4::random::uniform(0, 10));
+    exponential.push_back(-std::log(n4::random::uniform()));
+  }
+  for (auto p: {0.1, 0.5, 0.9}) {
+    p2_quantile u{p}, e{p};
+    for (auto x: uniform    ) { u.add(x); }
+    for (auto x: exponential) { e.add(x); }
+    CHECK_THAT(u.value(), WithinAbs(exact_quantile(uniform    , p), 0.05));
+    CHECK_THAT(e.value(), WithinRel(exact_quantile(exponential, p), 0.02));
+  }
+
+  // Exact while there are too few values for the markers
+  p2_quantile few{0.5};
+  CHECK(std::isnan(few.value()));
+  for (auto x: {3.0, 1.0, 2.0}) { few.add(x); }
+  CHECK(few.value() == 2);
+}
+
+TEST_CASE("run summary accumulation", "[summary]") {
+  run_summary summary{params(), 2};
+  summary.add({{0, 10}, {1, 30}}, true , true );
+  summary.add({{0, 20}         }, false, true );
+  summary.add({                }, false, false);
+  summary.add({{1, 500}        }, true , true );
+
+  CHECK(summary.n_events() == 4);
+  CHECK_THAT(summary.photopeak_fraction     (), WithinRel(0.5 , 1e-12));
+  CHECK_THAT(summary.over_threshold_fraction(), WithinRel(0.75, 1e-12));
+
+  const auto& sipm0 = summary.sipms()[0];
+  CHECK_THAT(sipm0.moments.mean, WithinRel(7.5, 1e-12));
+  CHECK(sipm0.counts.bins[0] == 2); // The events without light in SiPM 0
+  CHECK(sipm0.counts.bins[1] == 1);
+  CHECK(sipm0.counts.bins[2] == 1);
+
+  // Overflow goes in the last bin
+  CHECK(summary.sipms()[1].counts.bins.back() == 1);
+
+  const auto& total = summary.total();
+  CHECK_THAT(total.moments.mean, WithinRel((40 + 20 + 0 + 500) / 4.0, 1e-12));
+  CHECK(std::accumulate(begin(total.counts.bins), end(total.counts.bins), 0u) == 4);
+}
+
+TEST_CASE("summary file name", "[summary]") {
+  CHECK(summary_filename("out.parquet") == "out.summary.parquet");
+  CHECK(summary_filename("dir/out"    ) == "dir/out.summary.parquet");
+}
+
+TEST_CASE("run summary file", "[summary][io]") {
+  std::string outfile = std::tmpnam(nullptr);
+  outfile += ".parquet";
+  auto nevt = 10;
+  auto args_list = std::initializer_list<std::string>{
+      "progname"
+    , "-n", std::to_string(nevt)
+    , "-e"
+    , "/my/outfile " + outfile
+    , "/my/n_sipms_xy 2"
+    , "/my/summary true"
+    , "/my/summary_bins 20"
+  };
+  auto args = n4::test::argcv(args_list);
+
+  run_stats stats;
+  n4::run_manager::create()
+    .ui("progname", args.argc, args.argv)
+    .apply_cli_early()
+    .physics(physics_list())
+    .geometry([&] {return crystal_geometry(stats);})
+    .actions(create_actions(stats))
+    .run();
+
+  std::shared_ptr<arrow::io::RandomAccessFile> input;
+  std::unique_ptr<parquet::arrow::FileReader> reader;
+  std::shared_ptr<arrow::Table>                table;
+  input = arrow::io::ReadableFile::Open(summary_filename(outfile)).ValueOrDie();
+  REQUIRE(parquet::arrow::OpenFile(input, arrow::default_memory_pool(), &reader).ok());
+  REQUIRE(reader -> ReadTable(&table).ok());
+  REQUIRE(table -> num_rows() == 1 + 4); // The total and one per SiPM
+
+  auto meta = table -> schema() -> metadata();
+  REQUIRE(meta);
+  CHECK(meta -> Get("n_events").ValueOrDie() == std::to_string(nevt));
+  CHECK(meta -> Contains("photopeak_fraction"));
+  CHECK(meta -> Contains("over_threshold_fraction"));
+
+  auto sipm  = std::static_pointer_cast<arrow::Int32Array>(table -> GetColumnByName("sipm") -> chunk(0));
+  auto hists = std::static_pointer_cast<arrow::FixedSizeListArray>(table -> GetColumnByName("histogram") -> chunk(0));
+  CHECK(sipm  -> Value(0) == -1);
+  CHECK(hists -> value_length() == 20);
+  REQUIRE(table -> GetColumnByName("q50"));
+}
+
+TEST_CASE("convergence monitor", "[summary][stopping]") {
+  auto monitor_for = [] (stop_target_enum target) {
+    return convergence_monitor{{.target = target, .relative_error = 0.05, .check_every = 10, .min_events = 50}};
+  };
+
+  auto fraction = monitor_for(stop_target_enum::over_threshold_fraction);
+  auto light    = monitor_for(stop_target_enum::light_collection);
+  auto sigma    = monitor_for(stop_target_enum::resolution);
+  auto never    = monitor_for(stop_target_enum::none);
+  size_t fraction_at = 0, light_at = 0;
+  for (auto i=1; i<=10'000; i++) {
+    auto x = G4RandGauss::shoot(1000, 100);
+    for (auto m: {&fraction, &light, &sigma, &never}) { m -> add(x, true, i % 4 != 0); }
+    if (! fraction_at && fraction.converged()) { fraction_at = i; }
+    if (! light_at    && light   .converged()) { light_at    = i; }
+    CHECK(! never.converged());
+  }
+  // Only checked every 10 events, and never before 50
+  CHECK(fraction_at % 10 == 0);
+  CHECK(light_at    == 50);
+  // sqrt(p (1-p) / n) / p <= 0.05 needs n >= 134
+  CHECK(fraction_at == 140);
+
+  CHECK_THAT(fraction.estimate(), WithinRel(0.75, 1e-3));
+  CHECK_THAT(light   .estimate(), WithinRel(1000, 1e-2));
+  CHECK_THAT(sigma   .estimate(), WithinRel(0.1 , 3e-2));
+  CHECK_THAT(sigma   .relative_error(), WithinRel(std::sqrt(1 / (2 * 9'999.0) + 0.01 / 10'000), 2e-2));
+}
+
+TEST_CASE("resolution of the photopeak alone", "[summary][stopping]") {
+  auto sigma = convergence_monitor{{.target = stop_target_enum::resolution, .relative_error = 0.05, .check_every = 10, .min_events = 50}};
+  auto light = convergence_monitor{{.target = stop_target_enum::light_collection, .relative_error = 0.05, .check_every = 10, .min_events = 50}};
+  // A third of the events are Compton-only, spread well below the photopeak
+  for (auto i=1; i<=30'000; i++) {
+    auto photoabsorbed = i % 3 != 0;
+    auto x = photoabsorbed ? G4RandGauss::shoot(1000, 50) : G4UniformRand() * 700;
+    for (auto m: {&sigma, &light}) { m -> add(x, photoabsorbed, true); }
+  }
+  CHECK(sigma.n_events() == 30'000);
+  CHECK_THAT(sigma.estimate(), WithinRel(0.05, 3e-2));
+  CHECK_THAT(sigma.relative_error(), WithinRel(std::sqrt(1 / (2 * 19'999.0) + 0.0025 / 20'000), 2e-2));
+  // Light collection still counts every event
+  CHECK_THAT(light.estimate(), WithinRel((2 * 1000 + 350) / 3.0, 1e-2));
+
+  // No photoabsorbed events yet: nothing to estimate the resolution from
+  auto empty = convergence_monitor{{.target = stop_target_enum::resolution, .relative_error = 0.05, .check_every = 1, .min_events = 2}};
+  for (auto i=0; i<100; i++) { empty.add(G4UniformRand() * 700, false, true); }
+  CHECK(! empty.converged());
+}
+
+TEST_CASE("run stops once converged", "[summary][stopping]") {
+  std::string outfile = std::tmpnam(nullptr);
+  auto args_list = std::initializer_list<std::string>{
+      "progname"
+    , "-n", "100000"
+    , "-e"
+    , "/my/outfile " + outfile
+    , "/my/stop_when over_threshold_fraction"
+    , "/my/stop_rel_error 0.5"
+    , "/my/stop_min_events 20"
+    , "/my/stop_check_every 10"
+  };
+  auto args = n4::test::argcv(args_list);
+
+  run_stats stats;
+  n4::run_manager::create()
+    .ui("progname", args.argc, args.argv)
+    .apply_cli_early()
+    .physics(physics_list())
+    .geometry([&] {return crystal_geometry(stats);})
+    .actions(create_actions(stats))
+    .run();
+
+  std::shared_ptr<arrow::io::RandomAccessFile> input;
+  std::unique_ptr<parquet::arrow::FileReader> reader;
+  std::shared_ptr<arrow::Table>                table;
+  input = arrow::io::ReadableFile::Open(outfile).ValueOrDie();
+  REQUIRE(parquet::arrow::OpenFile(input, arrow::default_memory_pool(), &reader).ok());
+  REQUIRE(reader -> ReadTable(&table).ok());
+  CHECK(table -> num_rows() >= 20);
+  CHECK(table -> num_rows() <= 100);
+  CHECK(table -> num_rows() % 10 == 0);
+}
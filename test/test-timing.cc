@@ -0,0 +1,57 @@
+#include <timing.hh>
+
+#include <n4-all.hh>
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+using Catch::Matchers::WithinAbs;
+using Catch::Matchers::WithinULP;
+
+TEST_CASE("arrival time delta encoding roundtrip", "[timing][encoding]") {
+  std::vector<double> times;
+  for (auto i=0; i<1000; i++) { times.push_back(n4::random::uniform(0, 100 * ns)); }
+  std::sort(begin(times), end(times));
+
+  auto encoded = delta_encode_ps(times);
+  auto decoded = delta_decode_ps(encoded);
+  REQUIRE(decoded.size() == times.size());
+
+  // Quantisation errors do not accumulate
+  for (auto i=0; i<times.size(); i++) {
+    CHECK_THAT(decoded[i], WithinAbs(times[i], 0.5 * picosecond));
+  }
+  // Deltas are small compared to absolute times
+  CHECK(*std::max_element(begin(encoded) + 1, end(encoded)) < 100 * ns / picosecond / 10);
+}
+
+TEST_CASE("arrival time quantile", "[timing][quantile]") {
+  std::vector<double> times{9, 3, 7, 1, 5, 0, 8, 2, 6, 4};
+  CHECK(time_quantile(times, 0.0) == 0);
+  CHECK(time_quantile(times, 0.5) == 4);
+  CHECK(time_quantile(times, 1.0) == 9);
+}
+
+TEST_CASE("arrival time summary", "[timing]") {
+  std::unordered_map<size_t, std::vector<double>> times {
+    {0, {4 * ns, 1 * ns, 3 * ns, 2 * ns}},
+    {2, {7 * ns}}
+  };
+  auto summary = summarise_arrival_times(times, 3, 2, 0.5);
+
+  REQUIRE(summary.first_times.size() == 3);
+  CHECK  (summary.first_times[0] == std::vector<uint32_t>{1000, 1000});
+  CHECK  (summary.first_times[1].empty());
+  CHECK  (summary.first_times[2] == std::vector<uint32_t>{7000});
+
+  CHECK_THAT(summary.earliest[0], WithinULP(1.f, 1));
+  CHECK     (std::isnan(summary.earliest[1]));
+  CHECK_THAT(summary.earliest[2], WithinULP(7.f, 1));
+
+  CHECK_THAT(summary.quantile[0], WithinULP(2.f, 1));
+  CHECK     (std::isnan(summary.quantile[1]));
+  CHECK_THAT(summary.quantile[2], WithinULP(7.f, 1));
+}